@@ -0,0 +1,516 @@
+// Microbenchmarks for the interpreter, bus, ROM loading, CHR decoding and
+// PPU rendering, plus end-to-end runs of test ROMs and generated stress
+// workloads.
+//
+//   nespp-bench [--filter substring] [--reps N] [--warmup N] [--json out.json]
+//               [--rom path.nes ...]
+//
+// Each benchmark is calibrated until one sample takes at least
+// MIN_SAMPLE_TIME, then run for --warmup discarded samples and --reps
+// measured samples. Results are reported as nanoseconds per operation
+// percentiles across samples. Build with -DCMAKE_BUILD_TYPE=Release so that
+// tracing is compiled out.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <format>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../include/chr.h"
+#include "../include/headless.h"
+#include "../include/instructions.h"
+#include "../include/ppu.h"
+#include "../include/rom.h"
+#include "../include/stress.h"
+#include "../include/video.h"
+#include "../include/word.h"
+
+using namespace NESPP;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr auto MIN_SAMPLE_TIME = std::chrono::milliseconds(2);
+
+template <typename T> inline void doNotOptimize(const T &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct Options {
+  const char *filter = nullptr;
+  int reps = 30;
+  int warmup = 5;
+  const char *jsonPath = nullptr;
+  std::vector<std::string> roms;
+};
+
+struct Result {
+  std::string name;
+  uint64_t iterations;
+  std::vector<double> nsPerOp;
+
+  double percentile(double p) const {
+    std::vector<double> sorted = nsPerOp;
+    std::sort(sorted.begin(), sorted.end());
+    double rank = p * (sorted.size() - 1);
+    size_t low = static_cast<size_t>(rank);
+    size_t high = std::min(low + 1, sorted.size() - 1);
+    return sorted[low] + (sorted[high] - sorted[low]) * (rank - low);
+  }
+
+  double mean() const {
+    double sum = 0;
+    for (double ns : nsPerOp) {
+      sum += ns;
+    }
+    return sum / nsPerOp.size();
+  }
+
+  double stddev() const {
+    double m = mean();
+    double sum = 0;
+    for (double ns : nsPerOp) {
+      sum += (ns - m) * (ns - m);
+    }
+    return std::sqrt(sum / nsPerOp.size());
+  }
+};
+
+/// body(n) must perform n operations.
+using Body = std::function<void(uint64_t)>;
+
+double _sampleNs(const Body &body, uint64_t iterations) {
+  auto start = Clock::now();
+  body(iterations);
+  return std::chrono::duration<double, std::nano>(Clock::now() - start)
+      .count();
+}
+
+class Suite {
+public:
+  Suite(Options options) : options(std::move(options)) {}
+
+  void run(const std::string &name, const Body &body) {
+    if (options.filter != nullptr &&
+        name.find(options.filter) == std::string::npos) {
+      return;
+    }
+    uint64_t iterations = 1;
+    while (_sampleNs(body, iterations) <
+           std::chrono::duration<double, std::nano>(MIN_SAMPLE_TIME).count()) {
+      iterations *= 2;
+    }
+    for (int i = 0; i < options.warmup; i++) {
+      _sampleNs(body, iterations);
+    }
+    Result result = {.name = name, .iterations = iterations, .nsPerOp = {}};
+    for (int i = 0; i < options.reps; i++) {
+      result.nsPerOp.push_back(_sampleNs(body, iterations) / iterations);
+    }
+    fprintf(stderr, "%-36s p50 %10.2f ns  p90 %10.2f ns  %12.0f op/s\n",
+            name.data(), result.percentile(0.5), result.percentile(0.9),
+            1e9 / result.percentile(0.5));
+    results.push_back(std::move(result));
+  }
+
+  std::string toJson() const {
+    std::string out = "{\n  \"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+      const Result &r = results[i];
+      out += std::format(
+          "{}\n    {{\"name\": \"{}\", \"iterations\": {}, \"samples\": {}, "
+          "\"ns_per_op\": {{\"min\": {:.3f}, \"p50\": {:.3f}, \"p90\": {:.3f}, "
+          "\"p99\": {:.3f}, \"max\": {:.3f}, \"mean\": {:.3f}, "
+          "\"stddev\": {:.3f}}}, \"ops_per_second\": {:.0f}}}",
+          i == 0 ? "" : ",", r.name, r.iterations, r.nsPerOp.size(),
+          r.percentile(0), r.percentile(0.5), r.percentile(0.9),
+          r.percentile(0.99), r.percentile(1), r.mean(), r.stddev(),
+          1e9 / r.percentile(0.5));
+    }
+    out += "\n  ]\n}\n";
+    return out;
+  }
+
+  Options options;
+
+private:
+  std::vector<Result> results;
+};
+
+/// A mix of implemented instructions covering every addressing mode.
+const std::vector<uint8_t> DECODE_MIX = {
+    0xA9, 0x10,       // LDA #$10
+    0xAD, 0x00, 0x02, // LDA $0200
+    0x85, 0x10,       // STA $10
+    0xE8,             // INX
+    0xD0, 0x00,       // BNE +0
+    0x8D, 0x00, 0x03, // STA $0300
+    0xC9, 0x05,       // CMP #$05
+    0xA5, 0x10,       // LDA $10
+    0x0A,             // ASL A
+    0x6C, 0x00, 0x02, // JMP ($0200)
+};
+
+/// Writes a 32 KiB PRG / 8 KiB CHR NROM image whose code is DECODE_MIX
+/// repeated through $8000-$83FF and whose CHR is pseudo-random.
+std::string _writeSyntheticRom() {
+  std::vector<uint8_t> image = {'N', 'E', 'S', 0x1A, 2, 1};
+  image.resize(Rom::HEADER_SIZE + 0x8000 + 0x2000);
+  uint8_t *prg = image.data() + Rom::HEADER_SIZE;
+  for (size_t i = 0; i + DECODE_MIX.size() <= 0x400; i += DECODE_MIX.size()) {
+    std::copy(DECODE_MIX.begin(), DECODE_MIX.end(), prg + i);
+  }
+  prg[0x7FFC] = 0x00;
+  prg[0x7FFD] = 0x80;
+  uint32_t seed = 0x12345678;
+  for (size_t i = 0; i < 0x2000; i++) {
+    seed = seed * 1664525 + 1013904223;
+    image[Rom::HEADER_SIZE + 0x8000 + i] = seed >> 24;
+  }
+
+  auto path = std::filesystem::temp_directory_path() / "nespp-bench.nes";
+  FILE *f = fopen(path.c_str(), "wb");
+  if (f == nullptr) {
+    throw std::runtime_error(std::format("Failed to write {}", path.string()));
+  }
+  fwrite(image.data(), image.size(), 1, f);
+  fclose(f);
+  return path.string();
+}
+
+Instruction _instruction(uint8_t opcode, InstructionOperandUnion operand) {
+  return {opCodeLookup[opcode], operand};
+}
+
+void _benchDecode(Suite &suite, const std::shared_ptr<Rom> &rom) {
+  HeadlessVM vm = {rom};
+  suite.run("decodeInstruction", [&](uint64_t n) {
+    vm.PC = Word(0x8000);
+    for (uint64_t i = 0; i < n; i++) {
+      if (vm.PC.high >= 0x84) {
+        vm.PC = Word(0x8000);
+      }
+      Instruction instruction = vm.decodeInstruction();
+      doNotOptimize(instruction);
+    }
+  });
+}
+
+void _benchExecuteFamily(Suite &suite, const std::shared_ptr<Rom> &rom,
+                         const char *family,
+                         std::vector<Instruction> instructions) {
+  HeadlessVM vm = {rom};
+  suite.run(std::format("execute/{}", family), [&](uint64_t n) {
+    size_t j = 0;
+    for (uint64_t i = 0; i < n; i++) {
+      // Keep branches and jumps in a known place, and Z clear for BNE
+      vm.PC = Word(0x8000);
+      vm.S = 0x20;
+      vm.execute(instructions[j]);
+      j = j + 1 == instructions.size() ? 0 : j + 1;
+    }
+    doNotOptimize(vm.A);
+  });
+}
+
+void _benchExecute(Suite &suite, const std::shared_ptr<Rom> &rom) {
+  _benchExecuteFamily(suite, rom, "load",
+                      {
+                          _instruction(0xA9, {.immediate = 0x10}),
+                          _instruction(0xA5, {.zeropage = 0x10}),
+                          _instruction(0xAD, {.absolute = Word(0x0200)}),
+                          _instruction(0xA2, {.immediate = 0x01}),
+                          _instruction(0xA0, {.immediate = 0x02}),
+                      });
+  _benchExecuteFamily(suite, rom, "store",
+                      {
+                          _instruction(0x85, {.zeropage = 0x10}),
+                          _instruction(0x8D, {.absolute = Word(0x0300)}),
+                          _instruction(0x8E, {.absolute = Word(0x0301)}),
+                          _instruction(0x8C, {.absolute = Word(0x0302)}),
+                      });
+  _benchExecuteFamily(suite, rom, "arithmetic",
+                      {
+                          _instruction(0xC9, {.immediate = 0x05}),
+                          _instruction(0xE0, {.immediate = 0x05}),
+                          _instruction(0xE6, {.zeropage = 0x10}),
+                          _instruction(0xC6, {.zeropage = 0x11}),
+                          _instruction(0xE8, {.implied = nullptr}),
+                          _instruction(0x88, {.implied = nullptr}),
+                          _instruction(0x2D, {.absolute = Word(0x0200)}),
+                      });
+  _benchExecuteFamily(suite, rom, "shift",
+                      {
+                          _instruction(0x0A, {.accumulator = nullptr}),
+                          _instruction(0x4A, {.accumulator = nullptr}),
+                      });
+  _benchExecuteFamily(suite, rom, "branch",
+                      {
+                          // Taken (Z and N clear) and not taken (C clear)
+                          _instruction(0xD0, {.relative = 0x10}),
+                          _instruction(0x10, {.relative = 0x80}),
+                          _instruction(0xB0, {.relative = 0x10}),
+                      });
+  _benchExecuteFamily(suite, rom, "jump",
+                      {
+                          _instruction(0x4C, {.absolute = Word(0x8000)}),
+                          _instruction(0x20, {.absolute = Word(0x8000)}),
+                          _instruction(0x60, {.implied = nullptr}),
+                      });
+  _benchExecuteFamily(suite, rom, "flags+transfer",
+                      {
+                          _instruction(0x78, {.implied = nullptr}),
+                          _instruction(0xD8, {.implied = nullptr}),
+                          _instruction(0xAA, {.implied = nullptr}),
+                          _instruction(0x9A, {.implied = nullptr}),
+                      });
+}
+
+void _benchBus(Suite &suite, const std::shared_ptr<Rom> &rom) {
+  struct {
+    const char *region;
+    uint16_t address;
+  } regions[] = {
+      // Eight consecutive addresses from each base are exercised
+      {"ram", 0x0010},    {"ram-mirror", 0x0810}, {"ppu", 0x2000},
+      {"apu-io", 0x4000}, {"prg-ram", 0x6000},    {"prg-rom", 0x8000},
+  };
+  HeadlessVM vm = {rom};
+  for (auto [region, address] : regions) {
+    suite.run(std::format("peek16/{}", region), [&](uint64_t n) {
+      uint8_t sum = 0;
+      for (uint64_t i = 0; i < n; i++) {
+        sum += vm.peek16(address + (i & 7));
+      }
+      doNotOptimize(sum);
+    });
+  }
+  for (auto [region, address] : regions) {
+    suite.run(std::format("poke16/{}", region), [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; i++) {
+        vm.poke16(address + (i & 7), i);
+      }
+    });
+  }
+}
+
+void _benchRom(Suite &suite, const std::string &path) {
+  suite.run("Rom::Rom", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+      Rom rom = {path.data()};
+      doNotOptimize(rom.prgBlob);
+    }
+  });
+}
+
+void _benchChr(Suite &suite, const std::shared_ptr<Rom> &rom) {
+  size_t tiles = rom->chrSize / Rom::TILE_SIZE;
+  std::vector<uint8_t> pixels(tiles * 64);
+  suite.run("chr/decodeTile", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+      size_t tile = i % tiles;
+      decodeTile(rom->chrBlob + tile * Rom::TILE_SIZE,
+                 pixels.data() + tile * 64);
+    }
+    doNotOptimize(pixels.data());
+  });
+  // One op is one tile, so op/s is tiles per second
+  for (bool flip : {false, true}) {
+    suite.run(flip ? "chr/decodeTiles/flip" : "chr/decodeTiles",
+              [&](uint64_t n) {
+                for (uint64_t i = 0; i < n; i += tiles) {
+                  decodeTiles(rom->chrBlob, std::min<uint64_t>(tiles, n - i),
+                              pixels.data(), flip);
+                }
+                doNotOptimize(pixels.data());
+              });
+  }
+}
+
+void _benchPpu(Suite &suite, const std::shared_ptr<Rom> &rom) {
+  HeadlessVM vm = {rom};
+  PPU &ppu = *vm.ppu;
+  uint32_t seed = 0x9E3779B9;
+  for (uint8_t &byte : ppu.nametables) {
+    seed = seed * 1664525 + 1013904223;
+    byte = seed >> 24;
+  }
+  for (int i = 0; i < 32; i++) {
+    ppu.palette[i] = i;
+  }
+  // Background on, with a scroll that is not tile-aligned
+  ppu.mask = 0x0A;
+  ppu.t = 0x0003;
+  ppu.fineX = 5;
+  auto frames = [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+      ppu.catchUp(ppu.cycle + PPU::DOTS_PER_FRAME);
+    }
+    doNotOptimize(ppu.framebuffer[0]);
+  };
+  suite.run("ppu/frame", frames);
+
+  // All 64 sprites, crowded onto the middle of the screen so that many
+  // lines hit the 8-sprite limit
+  for (int i = 0; i < 64; i++) {
+    seed = seed * 1664525 + 1013904223;
+    ppu.oam[i * 4] = 64 + (seed >> 24) % 96;
+    ppu.oam[i * 4 + 1] = seed >> 16;
+    ppu.oam[i * 4 + 2] = seed >> 8;
+    ppu.oam[i * 4 + 3] = seed;
+  }
+  ppu.mask = 0x1E;
+  suite.run("ppu/frame/sprites", frames);
+
+  // The same, keeping up only the flags
+  ppu.renderEvery = 0;
+  suite.run("ppu/frame/skip", frames);
+}
+
+void _benchVideo(Suite &suite) {
+  // Heap: the tables are about 75 KiB
+  auto video = std::make_unique<VideoOutput>();
+  std::vector<uint16_t> framebuffer(PPU::WIDTH * PPU::HEIGHT);
+  uint32_t seed = 0x2545F491;
+  for (uint16_t &pixel : framebuffer) {
+    seed = seed * 1664525 + 1013904223;
+    pixel = seed >> 23;
+  }
+  std::vector<uint32_t> rgba(framebuffer.size());
+  suite.run("video/palette", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+      video->convert(framebuffer.data(), rgba.data());
+    }
+    doNotOptimize(rgba[0]);
+  });
+  suite.run("video/ntsc", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+      video->convertNtsc(framebuffer.data(), rgba.data());
+    }
+    doNotOptimize(rgba[0]);
+  });
+}
+
+void _benchEndToEnd(Suite &suite, const std::string &name,
+                    const std::shared_ptr<Rom> &rom) {
+  HeadlessVM vm = {rom};
+  vm.PC = {vm.peek16(0xFFFD), vm.peek16(0xFFFC)};
+  try {
+    suite.run(name, [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; i++) {
+        vm.step();
+      }
+    });
+  } catch (const std::exception &e) {
+    fprintf(stderr, "%-36s failed: %s\n", name.data(), e.what());
+  } catch (const char *msg) {
+    fprintf(stderr, "%-36s failed: %s\n", name.data(), msg);
+  }
+}
+
+void _benchRomFile(Suite &suite, const std::string &path) {
+  if (!std::filesystem::exists(path)) {
+    fprintf(stderr, "%-36s skipped, %s not found\n", "run", path.data());
+    return;
+  }
+  std::filesystem::path p = path;
+  std::shared_ptr<Rom> rom{new Rom(path.data())};
+  _benchEndToEnd(suite,
+                 std::format("run/{}/{}",
+                             p.parent_path().filename().string(),
+                             p.filename().string()),
+                 rom);
+}
+
+void _benchStress(Suite &suite) {
+  for (auto workload : {StressWorkload::branchHeavy, StressWorkload::zeroPage,
+                        StressWorkload::absolute, StressWorkload::callChain,
+                        StressWorkload::ppuPolling}) {
+    std::vector<uint8_t> image =
+        generateStressRom({.workload = workload, .size = 32});
+    std::shared_ptr<Rom> rom{new Rom(image.data(), image.size())};
+    _benchEndToEnd(suite, std::format("run/stress/{}", toString(workload)),
+                   rom);
+  }
+}
+
+int usage() {
+  fprintf(stderr, "Usage: nespp-bench [--filter substring] [--reps N] "
+                  "[--warmup N] [--json out.json] [--rom path.nes ...]\n");
+  return 1;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      options.filter = argv[++i];
+    } else if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc) {
+      options.reps = std::max(1, atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+      options.warmup = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+      options.jsonPath = argv[++i];
+    } else if (strcmp(argv[i], "--rom") == 0 && i + 1 < argc) {
+      options.roms.push_back(argv[++i]);
+    } else {
+      return usage();
+    }
+  }
+  if (options.roms.empty()) {
+    // Assembled with `make` in each test directory (requires cc65)
+    options.roms = {NESPP_SOURCE_DIR "/test/01/main.nes",
+                    NESPP_SOURCE_DIR "/test/02/main.nes"};
+  }
+
+  try {
+    Suite suite = {options};
+    std::string syntheticPath = _writeSyntheticRom();
+    std::shared_ptr<Rom> rom{new Rom(syntheticPath.data())};
+
+    _benchDecode(suite, rom);
+    _benchExecute(suite, rom);
+    _benchBus(suite, rom);
+    _benchRom(suite, syntheticPath);
+    _benchChr(suite, rom);
+    _benchPpu(suite, rom);
+    _benchVideo(suite);
+    for (auto &path : suite.options.roms) {
+      _benchRomFile(suite, path);
+    }
+    _benchStress(suite);
+
+    std::string json = suite.toJson();
+    if (options.jsonPath == nullptr) {
+      fputs(json.data(), stdout);
+    } else {
+      FILE *f = fopen(options.jsonPath, "w");
+      if (f == nullptr) {
+        fprintf(stderr, "Failed to open %s\n", options.jsonPath);
+        return 1;
+      }
+      fputs(json.data(), f);
+      fclose(f);
+    }
+  } catch (const std::exception &e) {
+    fprintf(stderr, "[Error] %s!\n", e.what());
+    return 1;
+  } catch (const char *msg) {
+    fprintf(stderr, "[Error] %s!\n", msg);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,106 @@
+// Merges and summarizes code/data logs written by `rom-runner --cdl`.
+//
+//   cdl-tool merge out.cdl in.cdl... [--jobs N]
+//   cdl-tool stats log.cdl
+//   cdl-tool ranges log.cdl
+//
+// ranges lists each run of PRG offsets executed as code, which is what the
+// static recompiler is seeded with.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <vector>
+
+#include "../include/cdl.h"
+
+using namespace NESPP;
+
+static int usage() {
+  fprintf(stderr, "Usage:\n"
+                  "  cdl-tool merge out.cdl in.cdl... [--jobs N]\n"
+                  "  cdl-tool stats log.cdl\n"
+                  "  cdl-tool ranges log.cdl\n");
+  return 1;
+}
+
+static int merge(int argc, char **argv) {
+  const char *outPath = argv[0];
+  unsigned jobs = 0;
+  std::vector<std::string> paths;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      jobs = strtoul(argv[++i], nullptr, 10);
+    } else {
+      paths.push_back(argv[i]);
+    }
+  }
+  if (paths.empty()) {
+    return usage();
+  }
+  CodeDataLogger merged = mergeCodeDataLogs(paths, jobs);
+  merged.save(outPath);
+  printf("Merged %zu logs into %s\n", paths.size(), outPath);
+  return 0;
+}
+
+static void _line(const char *name, size_t count, size_t total) {
+  printf("%-10s %8zu / %-8zu %6.2f%%\n", name, count, total,
+         total == 0 ? 0.0 : 100.0 * count / total);
+}
+
+static int stats(const char *path) {
+  CodeDataLogger log = {path};
+  CodeDataLogger::Coverage coverage = log.coverage();
+  _line("prg", coverage.prg, log.prgSize);
+  _line("opcodes", coverage.opCodes, log.prgSize);
+  _line("operands", coverage.operands, log.prgSize);
+  _line("data", coverage.data, log.prgSize);
+  _line("chr", coverage.rendered, log.chrSize);
+  return 0;
+}
+
+static int ranges(const char *path) {
+  CodeDataLogger log = {path};
+  auto isCode = [&](size_t offset) {
+    return CodeDataLogger::test(log.opCodes, offset) ||
+           CodeDataLogger::test(log.operands, offset);
+  };
+  for (size_t offset = 0; offset < log.prgSize;) {
+    if (!isCode(offset)) {
+      offset += 1;
+      continue;
+    }
+    size_t start = offset;
+    while (offset < log.prgSize && isCode(offset)) {
+      offset += 1;
+    }
+    printf("%06zX-%06zX\n", start, offset - 1);
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    return usage();
+  }
+
+  try {
+    if (strcmp(argv[1], "merge") == 0 && argc >= 4) {
+      return merge(argc - 2, argv + 2);
+    } else if (strcmp(argv[1], "stats") == 0 && argc == 3) {
+      return stats(argv[2]);
+    } else if (strcmp(argv[1], "ranges") == 0 && argc == 3) {
+      return ranges(argv[2]);
+    }
+  } catch (const std::exception &e) {
+    fprintf(stderr, "[Error] %s!\n", e.what());
+    return 1;
+  } catch (const char *msg) {
+    fprintf(stderr, "[Error] %s!\n", msg);
+    return 1;
+  }
+  return usage();
+}
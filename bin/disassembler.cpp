@@ -0,0 +1,74 @@
+// Disassembles a ROM's PRG to a ca65 listing.
+//
+//   disassembler rom.nes [--cdl log.cdl] [--jobs N] [-o out.s]
+//
+// Code is found by recursive descent from the vectors; a code/data log from
+// `rom-runner --cdl` adds everything that was seen executing.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <string>
+
+#include "../include/cdl.h"
+#include "../include/disassembler.h"
+#include "../include/rom.h"
+
+using namespace NESPP;
+
+static int usage() {
+  fprintf(stderr, "Usage: disassembler rom.nes [--cdl log.cdl] [--jobs N] "
+                  "[-o out.s]\n");
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  const char *romPath = nullptr;
+  const char *cdlPath = nullptr;
+  const char *outPath = nullptr;
+  unsigned jobs = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--cdl") == 0 && i + 1 < argc) {
+      cdlPath = argv[++i];
+    } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      jobs = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      outPath = argv[++i];
+    } else if (romPath == nullptr && argv[i][0] != '-') {
+      romPath = argv[i];
+    } else {
+      return usage();
+    }
+  }
+  if (romPath == nullptr) {
+    return usage();
+  }
+
+  try {
+    std::shared_ptr<Rom> rom{new Rom(romPath)};
+    Disassembler disassembler = {rom};
+    if (cdlPath != nullptr) {
+      disassembler.seed(CodeDataLogger{cdlPath});
+    }
+    std::string listing = disassembler.listing(jobs);
+
+    FILE *out = outPath == nullptr ? stdout : fopen(outPath, "w");
+    if (out == nullptr) {
+      fprintf(stderr, "[Error] Failed to open %s!\n", outPath);
+      return 1;
+    }
+    fwrite(listing.data(), 1, listing.size(), out);
+    if (out != stdout) {
+      fclose(out);
+    }
+  } catch (const std::exception &e) {
+    fprintf(stderr, "[Error] %s!\n", e.what());
+    return 1;
+  } catch (const char *msg) {
+    fprintf(stderr, "[Error] %s!\n", msg);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,171 @@
+// Runs a directory of test ROMs in parallel and prints a JSON summary.
+//
+//   rom-runner path/to/roms [--jobs N] [--max-cycles N] [--json out.json]
+//              [--profile N] [--callgraph dir] [--cdl dir]
+//              [--timeline out.json] [--metrics out.prom] [--watch SPEC]...
+//              [--render-every N]
+//
+// --profile prints where each ROM spent its cycles: the N hottest addresses
+// and the opcode histogram. --callgraph prints the hottest subroutines and
+// writes dir/<rom>.folded for flamegraph.pl. --cdl accumulates code/data
+// coverage into dir/<rom>.cdl, see cdl-tool. <rom> is the ROM's path under
+// the scanned directory, so same-named ROMs in different directories keep
+// their own files. --timeline writes host-side spans for each worker in
+// Chrome trace format. --metrics publishes runtime counters in Prometheus
+// text format every second while the suite runs. --watch logs accesses
+// matching SPEC, e.g. 0300-03FF:c for value changes on a page; it may be
+// given more than once. --render-every draws one frame in N, for timing
+// runs that should pay for pixels; by default the PPU only keeps up the
+// flags and timing the CPU can see.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../include/metrics.h"
+#include "../include/romrunner.h"
+#include "../include/timeline.h"
+#include "../include/watch.h"
+
+using namespace NESPP;
+
+static int usage() {
+  fprintf(stderr, "Usage: rom-runner path/to/roms [--jobs N] "
+                  "[--max-cycles N] [--json out.json] [--profile N] "
+                  "[--callgraph dir] [--cdl dir] [--timeline out.json] "
+                  "[--metrics out.prom] [--watch SPEC]... "
+                  "[--render-every N]\n");
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    return usage();
+  }
+
+  RomRunOptions options;
+  unsigned jobs = 0;
+  const char *jsonPath = nullptr;
+  const char *foldedDirectory = nullptr;
+  const char *timelinePath = nullptr;
+  const char *metricsPath = nullptr;
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      jobs = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--max-cycles") == 0 && i + 1 < argc) {
+      options.maxCycles = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+      jsonPath = argv[++i];
+    } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+      options.profileTop = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--callgraph") == 0 && i + 1 < argc) {
+      options.callGraph = true;
+      foldedDirectory = argv[++i];
+    } else if (strcmp(argv[i], "--cdl") == 0 && i + 1 < argc) {
+      options.cdlDirectory = argv[++i];
+    } else if (strcmp(argv[i], "--timeline") == 0 && i + 1 < argc) {
+      timelinePath = argv[++i];
+    } else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) {
+      metricsPath = argv[++i];
+    } else if (strcmp(argv[i], "--watch") == 0 && i + 1 < argc) {
+      try {
+        options.watchpoints.push_back(
+            parseWatchpoint(argv[++i], WatchAction::log));
+      } catch (const std::exception &e) {
+        fprintf(stderr, "[Error] %s!\n", e.what());
+        return usage();
+      }
+    } else if (strcmp(argv[i], "--render-every") == 0 && i + 1 < argc) {
+      options.renderEvery = strtoul(argv[++i], nullptr, 10);
+    } else {
+      return usage();
+    }
+  }
+
+  if (foldedDirectory != nullptr) {
+    std::filesystem::create_directories(foldedDirectory);
+  }
+  if (!options.cdlDirectory.empty()) {
+    std::filesystem::create_directories(options.cdlDirectory);
+  }
+
+  std::vector<std::string> paths;
+  std::filesystem::path root = argv[1];
+  if (std::filesystem::is_directory(root)) {
+    options.root = root.string();
+    for (auto &entry : std::filesystem::recursive_directory_iterator(root)) {
+      if (entry.is_regular_file() && entry.path().extension() == ".nes") {
+        paths.push_back(entry.path().string());
+      }
+    }
+  } else {
+    paths.push_back(root.string());
+  }
+  std::sort(paths.begin(), paths.end());
+  if (paths.empty()) {
+    fprintf(stderr, "No .nes files found under %s\n", argv[1]);
+    return 1;
+  }
+
+  if (timelinePath != nullptr) {
+    Timeline::start();
+  }
+  std::vector<RomResult> results;
+  {
+    std::unique_ptr<MetricsPublisher> publisher;
+    if (metricsPath != nullptr) {
+      publisher = std::make_unique<MetricsPublisher>(metricsPath);
+    }
+    results = runTestRoms(paths, options, jobs);
+  }
+  if (timelinePath != nullptr) {
+    Timeline::stop();
+    Timeline::writeChromeTrace(timelinePath);
+  }
+
+  bool allPassed = true;
+  for (auto &result : results) {
+    fprintf(stderr, "%-7s %s (%s, %.1f ms)\n", toString(result.status),
+            result.path.data(), toString(result.protocol),
+            result.milliseconds);
+    if (!result.watchHits.empty()) {
+      fprintf(stderr, "\n%s\n", result.watchHits.data());
+    }
+    if (!result.profile.empty()) {
+      fprintf(stderr, "\n%s\n", result.profile.data());
+    }
+    if (!result.callGraph.empty()) {
+      fprintf(stderr, "\n%s\n", result.callGraph.data());
+      std::string folded = romOutputPath(foldedDirectory, options.root,
+                                         result.path, ".folded");
+      FILE *f = fopen(folded.c_str(), "w");
+      if (f == nullptr) {
+        fprintf(stderr, "Failed to open %s\n", folded.c_str());
+        return 1;
+      }
+      fputs(result.folded.data(), f);
+      fclose(f);
+    }
+    allPassed = allPassed && result.status == RomStatus::pass;
+  }
+
+  std::string json = resultsToJson(results);
+  if (jsonPath == nullptr) {
+    fputs(json.data(), stdout);
+  } else {
+    FILE *f = fopen(jsonPath, "w");
+    if (f == nullptr) {
+      fprintf(stderr, "Failed to open %s\n", jsonPath);
+      return 1;
+    }
+    fputs(json.data(), f);
+    fclose(f);
+  }
+  return allPassed ? 0 : 1;
+}
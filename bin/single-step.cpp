@@ -0,0 +1,226 @@
+// Single-instruction conformance harness.
+//
+//   single-step run path/to/vectors [--jobs N] [--cycles] [--failures N]
+//   single-step generate rom.nes out.json [--count N] [--nestest]
+//
+// Vector files are expected to be named after their opcode (e.g. a9.json),
+// as in the widely used per-opcode sets; files for opcodes the VM does not
+// implement yet are reported as skipped without being parsed.
+//
+// Generated vectors list only the bus accesses the VM actually makes, so
+// --cycles is only meaningful against reference sets.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../include/headless.h"
+#include "../include/instructions.h"
+#include "../include/rom.h"
+#include "../include/singlestep.h"
+#include "../include/word.h"
+
+using namespace NESPP;
+
+struct FileReport {
+  std::string path;
+  bool skipped = false;
+  uint64_t passed = 0;
+  uint64_t failed = 0;
+  std::vector<std::string> failures;
+};
+
+static int usage() {
+  fprintf(stderr,
+          "Usage:\n"
+          "  single-step run path/to/vectors [--jobs N] [--cycles] "
+          "[--failures N]\n"
+          "  single-step generate rom.nes out.json [--count N] [--nestest]\n");
+  return 1;
+}
+
+static bool implemented(const std::filesystem::path &path) {
+  std::string stem = path.stem().string();
+  char *end;
+  unsigned long opcode = strtoul(stem.data(), &end, 16);
+  if (stem.size() != 2 || *end != '\0') {
+    // Not named after an opcode, run it anyway
+    return true;
+  }
+  return opCodeLookup[opcode].type != OpCodeType::unimplemented;
+}
+
+static void runFile(FileReport &report, bool checkCycles, size_t maxFailures) {
+  if (!implemented(report.path)) {
+    report.skipped = true;
+    return;
+  }
+  std::vector<uint8_t> memory(0x10000);
+  HeadlessVM vm = {memory.data()};
+  SingleStepReader reader = {report.path.data()};
+  SingleStepTest test;
+  std::string reason;
+  while (reader.next(test)) {
+    if (runSingleStepTest(vm, memory.data(), test, checkCycles, reason)) {
+      report.passed += 1;
+    } else {
+      report.failed += 1;
+      if (report.failures.size() < maxFailures) {
+        report.failures.push_back(test.name + ": " + reason);
+      }
+    }
+  }
+}
+
+static int run(int argc, char **argv) {
+  unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+  bool checkCycles = false;
+  size_t maxFailures = 3;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      jobs = std::max(1ul, strtoul(argv[++i], nullptr, 10));
+    } else if (strcmp(argv[i], "--cycles") == 0) {
+      checkCycles = true;
+    } else if (strcmp(argv[i], "--failures") == 0 && i + 1 < argc) {
+      maxFailures = strtoul(argv[++i], nullptr, 10);
+    } else {
+      return usage();
+    }
+  }
+
+  std::vector<FileReport> reports;
+  std::filesystem::path root = argv[0];
+  if (std::filesystem::is_directory(root)) {
+    for (auto &entry : std::filesystem::directory_iterator(root)) {
+      if (entry.path().extension() == ".json") {
+        reports.emplace_back().path = entry.path().string();
+      }
+    }
+  } else {
+    reports.emplace_back().path = root.string();
+  }
+  std::sort(reports.begin(), reports.end(),
+            [](auto &a, auto &b) { return a.path < b.path; });
+
+  // Files are the unit of work: each is one opcode's worth of vectors
+  std::atomic<size_t> next = 0;
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < std::min<size_t>(jobs, reports.size()); i++) {
+    workers.emplace_back([&] {
+      for (size_t j = next++; j < reports.size(); j = next++) {
+        try {
+          runFile(reports[j], checkCycles, maxFailures);
+        } catch (const std::exception &e) {
+          reports[j].failed += 1;
+          reports[j].failures.push_back(e.what());
+        }
+      }
+    });
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+
+  uint64_t passed = 0;
+  uint64_t failed = 0;
+  size_t skipped = 0;
+  for (auto &report : reports) {
+    std::string name = std::filesystem::path(report.path).filename().string();
+    if (report.skipped) {
+      skipped += 1;
+      continue;
+    }
+    passed += report.passed;
+    failed += report.failed;
+    printf("%-4s %-12s %lu/%lu\n", report.failed == 0 ? "ok" : "FAIL",
+           name.data(), static_cast<unsigned long>(report.passed),
+           static_cast<unsigned long>(report.passed + report.failed));
+    for (auto &failure : report.failures) {
+      printf("       %s\n", failure.data());
+    }
+  }
+  printf("%lu passed, %lu failed, %zu files skipped (unimplemented opcodes)\n",
+         static_cast<unsigned long>(passed), static_cast<unsigned long>(failed),
+         skipped);
+  return failed == 0 ? 0 : 1;
+}
+
+static int generate(int argc, char **argv) {
+  uint64_t count = 1000;
+  bool nestest = false;
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+      count = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--nestest") == 0) {
+      nestest = true;
+    } else {
+      return usage();
+    }
+  }
+
+  std::shared_ptr<Rom> rom{new Rom(argv[0])};
+  HeadlessVM vm = {rom};
+  if (nestest) {
+    vm.PC = Word(0xC000);
+  } else {
+    vm.PC = {vm.peek16(0xFFFD), vm.peek16(0xFFFC)};
+  }
+  vm.SP = 0xFD;
+  vm.S = 0x24;
+
+  FILE *out = fopen(argv[1], "w");
+  if (out == nullptr) {
+    fprintf(stderr, "Failed to open %s\n", argv[1]);
+    return 1;
+  }
+  SingleStepCapture capture;
+  SingleStepTest test;
+  uint64_t written = 0;
+  fputs("[\n", out);
+  try {
+    while (written < count) {
+      if (capture.capture(vm, test)) {
+        writeSingleStepTest(out, test, written == 0);
+        written += 1;
+      }
+      vm.step();
+    }
+  } catch (const std::exception &e) {
+    fprintf(stderr, "Stopped at $%04X: %s\n", vm.PC.to16(), e.what());
+  } catch (const char *msg) {
+    fprintf(stderr, "Stopped at $%04X: %s\n", vm.PC.to16(), msg);
+  }
+  fputs("\n]\n", out);
+  fclose(out);
+  printf("Wrote %lu vectors\n", static_cast<unsigned long>(written));
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    return usage();
+  }
+  try {
+    if (strcmp(argv[1], "run") == 0) {
+      return run(argc - 2, argv + 2);
+    } else if (strcmp(argv[1], "generate") == 0 && argc >= 4) {
+      return generate(argc - 2, argv + 2);
+    }
+  } catch (const std::exception &e) {
+    fprintf(stderr, "[Error] %s!\n", e.what());
+    return 1;
+  } catch (const char *msg) {
+    fprintf(stderr, "[Error] %s!\n", msg);
+    return 1;
+  }
+  return usage();
+}
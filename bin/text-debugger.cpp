@@ -1,3 +1,4 @@
+#include <cstring>
 #include <memory>
 #ifdef NDEBUG
 #include <cstdio>
@@ -5,6 +6,7 @@
 
 #include "../include/debug.h"
 #include "../include/rom.h"
+#include "../include/timeline.h"
 
 using namespace NESPP;
 
@@ -21,8 +23,24 @@ int main(int argc, char **argv) {
     romPath = argv[1];
   }
 
+  // text-debugger rom.nes --timeline out.json
+  const char *timelinePath = nullptr;
+  if (argc == 4 && strcmp(argv[2], "--timeline") == 0) {
+    timelinePath = argv[3];
+    Timeline::setThreadName("debugger");
+    Timeline::start();
+  }
+
   // No copy
   std::shared_ptr<Rom> p {new Rom(romPath)};
   Debugger debugger = {p};
-  debugger.start();
+  try {
+    debugger.start();
+  } catch (...) {
+    // The debugger only exits by throwing
+    if (timelinePath != nullptr) {
+      Timeline::writeChromeTrace(timelinePath);
+    }
+    throw;
+  }
 }
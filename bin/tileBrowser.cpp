@@ -1,90 +1,303 @@
+// Browses every CHR tile of a ROM.
+//
+//   tileBrowser rom.nes
+//
+// All tiles are decoded once into a palette-indexed atlas texture, with one
+// 16x16-tile block per 4 KiB pattern table; each block is then a single
+// textured quad, coloured by a palette shader. The ROM file is watched and
+// the atlas re-uploaded only when its CHR actually changes.
+//
+// Mouse wheel zooms, dragging or the arrow keys pan, 1-4 pick a palette
+// and 0 resets the view.
+
+#include <algorithm>
+#include <cstdint>
 #include <cstdio>
+#include <exception>
+#include <vector>
 
 #include "../THIRD_PARTY/raylib-5.5/out/raylib/include/raylib.h"
+#include "../include/chr.h"
 #include "../include/rom.h"
 
-void render(Rom *rom);
-void renderTile(Rom *rom, int i);
+namespace {
 
-int main(int argc, char **argv) {
-  if (argc == 1) {
-    fprintf(stderr, "Usage: bin.exe path-to-rom.nes\n");
-    return 1;
+/// Tiles across and down one pattern table
+constexpr int TABLE_TILES = 16;
+constexpr int TABLE_PIXELS = TABLE_TILES * 8;
+constexpr int TILES_PER_TABLE = TABLE_TILES * TABLE_TILES;
+/// Pattern tables across the atlas, and across the screen
+constexpr int TABLES_PER_ROW = 8;
+/// Space between pattern tables on screen, in atlas pixels
+constexpr int GAP = 8;
+
+/// Maps the atlas's indices 0-3 to palette.
+///
+/// Pixels are stored as their raw index in a one-channel texture, so
+/// switching palettes only changes a uniform.
+constexpr const char *PALETTE_SHADER = R"(
+#version 330
+in vec2 fragTexCoord;
+out vec4 finalColor;
+uniform sampler2D texture0;
+uniform vec4 palette[4];
+void main() {
+  int index = int(texture(texture0, fragTexCoord).r * 255.0 + 0.5);
+  finalColor = palette[clamp(index, 0, 3)];
+}
+)";
+
+constexpr Color PALETTES[][4] = {
+    {BLACK, DARKGRAY, LIGHTGRAY, WHITE},
+    // Like the NES's default background palette in many games
+    {{0x0F, 0x0F, 0x0F, 0xFF},
+     {0x00, 0x58, 0xF8, 0xFF},
+     {0xF8, 0x38, 0x00, 0xFF},
+     {0xFC, 0xFC, 0xFC, 0xFF}},
+    {{0x0F, 0x38, 0x0F, 0xFF},
+     {0x30, 0x62, 0x30, 0xFF},
+     {0x8B, 0xAC, 0x0F, 0xFF},
+     {0x9B, 0xBC, 0x0F, 0xFF}},
+    {{0x00, 0x00, 0x00, 0x00},
+     {0xAC, 0x7C, 0x00, 0xFF},
+     {0xF8, 0xB8, 0x00, 0xFF},
+     {0xFC, 0xE0, 0xA8, 0xFF}},
+};
+constexpr int PALETTE_COUNT = sizeof(PALETTES) / sizeof(PALETTES[0]);
+
+class Atlas {
+public:
+  ~Atlas() {
+    if (texture.id != 0) {
+      UnloadTexture(texture);
+    }
   }
-  Rom rom;
-  try {
-    rom = Rom::fromPath(argv[1]);
-  } catch (const char *msg) {
-    fprintf(stderr, "Caught %s!\n", msg);
-    return 1;
+
+  /// Decodes chr into the atlas and uploads it, unless it is what is
+  /// already uploaded
+  void update(const uint8_t *chr, size_t size) {
+    if (texture.id != 0 && size == chrCopy.size() &&
+        std::equal(chr, chr + size, chrCopy.begin())) {
+      return;
+    }
+    chrCopy.assign(chr, chr + size);
+
+    tileCount = size / Rom::TILE_SIZE;
+    tables = (tileCount + TILES_PER_TABLE - 1) / TILES_PER_TABLE;
+    int width = std::min(tables, TABLES_PER_ROW) * TABLE_PIXELS;
+    int height =
+        (tables + TABLES_PER_ROW - 1) / TABLES_PER_ROW * TABLE_PIXELS;
+
+    std::vector<uint8_t> decoded(tileCount * 64);
+    NESPP::decodeTiles(chr, tileCount, decoded.data());
+    // Tile-major to row-major
+    std::vector<uint8_t> pixels(static_cast<size_t>(width) * height, 0);
+    for (size_t tile = 0; tile < tileCount; tile++) {
+      int x = tileX(tile);
+      int y = tileY(tile);
+      for (int row = 0; row < 8; row++) {
+        std::copy_n(decoded.data() + tile * 64 + row * 8, 8,
+                    pixels.data() + (y + row) * width + x);
+      }
+    }
+
+    if (texture.id != 0 && texture.width == width &&
+        texture.height == height) {
+      UpdateTexture(texture, pixels.data());
+      return;
+    }
+    if (texture.id != 0) {
+      UnloadTexture(texture);
+    }
+    Image image = {
+        .data = pixels.data(),
+        .width = width,
+        .height = height,
+        .mipmaps = 1,
+        .format = PIXELFORMAT_UNCOMPRESSED_GRAYSCALE,
+    };
+    texture = LoadTextureFromImage(image);
+    SetTextureFilter(texture, TEXTURE_FILTER_POINT);
   }
-  render(&rom);
-}
 
-void render(Rom *rom) {
-  // Decode n tiles
-  const int n = rom->chrSize / Rom::TILE_SIZE;
+  /// Top left of a tile in the atlas
+  int tileX(size_t tile) const {
+    size_t table = tile / TILES_PER_TABLE;
+    return table % TABLES_PER_ROW * TABLE_PIXELS +
+           tile % TABLE_TILES * 8;
+  }
+  int tileY(size_t tile) const {
+    size_t table = tile / TILES_PER_TABLE;
+    return table / TABLES_PER_ROW * TABLE_PIXELS +
+           tile % TILES_PER_TABLE / TABLE_TILES * 8;
+  }
+
+  /// Where pattern table i is drawn, in world coordinates
+  Vector2 tablePosition(int i) const {
+    return {static_cast<float>(i % TABLES_PER_ROW * (TABLE_PIXELS + GAP)),
+            static_cast<float>(i / TABLES_PER_ROW * (TABLE_PIXELS + GAP))};
+  }
+
+  /// The tile drawn at a world position, or -1
+  int tileAt(Vector2 world) const {
+    if (world.x < 0 || world.y < 0) {
+      return -1;
+    }
+    int column = static_cast<int>(world.x) / (TABLE_PIXELS + GAP);
+    int row = static_cast<int>(world.y) / (TABLE_PIXELS + GAP);
+    int x = static_cast<int>(world.x) % (TABLE_PIXELS + GAP);
+    int y = static_cast<int>(world.y) % (TABLE_PIXELS + GAP);
+    if (column >= TABLES_PER_ROW || x >= TABLE_PIXELS || y >= TABLE_PIXELS) {
+      return -1;
+    }
+    size_t tile = (row * TABLES_PER_ROW + column) * TILES_PER_TABLE +
+                  y / 8 * TABLE_TILES + x / 8;
+    return tile < tileCount ? static_cast<int>(tile) : -1;
+  }
+
+  void draw() const {
+    for (int i = 0; i < tables; i++) {
+      Rectangle source = {
+          static_cast<float>(i % TABLES_PER_ROW * TABLE_PIXELS),
+          static_cast<float>(i / TABLES_PER_ROW * TABLE_PIXELS),
+          TABLE_PIXELS, TABLE_PIXELS};
+      DrawTextureRec(texture, source, tablePosition(i), WHITE);
+    }
+  }
+
+  Texture2D texture = {};
+  size_t tileCount = 0;
+  int tables = 0;
+
+private:
+  /// What is uploaded, to tell whether a reload changed anything
+  std::vector<uint8_t> chrCopy;
+};
+
+void render(const char *path) {
+  InitWindow(Rom::SCREEN_WIDTH, Rom::SCREEN_HEIGHT, "NES tiles");
+  SetTargetFPS(60);
 
-  InitWindow(Rom::SCREEN_WIDTH, Rom::SCREEN_HEIGHT, "NES");
-  SetTargetFPS(10);
+  Shader shader = LoadShaderFromMemory(nullptr, PALETTE_SHADER);
+  int paletteLocation = GetShaderLocation(shader, "palette");
+  int palette = 0;
+  auto setPalette = [&](int i) {
+    palette = i;
+    float colours[4][4];
+    for (int j = 0; j < 4; j++) {
+      Vector4 colour = ColorNormalize(PALETTES[i][j]);
+      colours[j][0] = colour.x;
+      colours[j][1] = colour.y;
+      colours[j][2] = colour.z;
+      colours[j][3] = colour.w;
+    }
+    SetShaderValueV(shader, paletteLocation, colours, SHADER_UNIFORM_VEC4, 4);
+  };
+  setPalette(0);
+
+  Camera2D camera = {};
+  auto resetView = [&] {
+    camera.offset = {Rom::TILE_WIDTH, Rom::TILE_WIDTH};
+    camera.target = {0, 0};
+    camera.zoom = Rom::PIXEL_SCALE / 2.0f;
+  };
+  resetView();
 
-  const int MESSAGE_MAX = 100;
-  char msg[MESSAGE_MAX] = {0};
+  Atlas atlas;
+  long modified = 0;
+  double lastCheck = -1;
+  char message[128] = {0};
 
-  int tileNumber = 0;
   while (!WindowShouldClose()) {
-    if (IsKeyDown(KEY_L)) {
-      tileNumber += 1;
-      if (tileNumber >= n) {
-        tileNumber = n - 1;
+    // Pick up rebuilt ROMs; the atlas ignores reloads with the same CHR
+    if (GetTime() - lastCheck >= 1.0) {
+      lastCheck = GetTime();
+      long now = GetFileModTime(path);
+      if (now != modified) {
+        modified = now;
+        try {
+          Rom rom(path);
+          atlas.update(rom.chrBlob, rom.chrSize);
+        } catch (const std::exception &e) {
+          snprintf(message, sizeof(message), "%s", e.what());
+        } catch (const char *msg) {
+          snprintf(message, sizeof(message), "%s", msg);
+        }
       }
-    } else if (IsKeyDown(KEY_H)) {
-      tileNumber -= 1;
-      if (tileNumber < 0) {
-        tileNumber = 0;
+    }
+
+    for (int key = KEY_ONE; key < KEY_ONE + PALETTE_COUNT; key++) {
+      if (IsKeyPressed(key)) {
+        setPalette(key - KEY_ONE);
       }
     }
-    BeginDrawing();
+    if (IsKeyPressed(KEY_ZERO)) {
+      resetView();
+    }
+
+    // Zoom about the mouse
+    float wheel = GetMouseWheelMove();
+    if (wheel != 0) {
+      Vector2 mouse = GetMousePosition();
+      camera.target = GetScreenToWorld2D(mouse, camera);
+      camera.offset = mouse;
+      camera.zoom = std::clamp(camera.zoom * (wheel > 0 ? 1.25f : 0.8f),
+                               0.5f, 64.0f);
+    }
+    if (IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
+      Vector2 delta = GetMouseDelta();
+      camera.target.x -= delta.x / camera.zoom;
+      camera.target.y -= delta.y / camera.zoom;
+    }
+    float step = 8 * GetFrameTime() * 60 / camera.zoom * 4;
+    camera.target.x += (IsKeyDown(KEY_RIGHT) - IsKeyDown(KEY_LEFT)) * step;
+    camera.target.y += (IsKeyDown(KEY_DOWN) - IsKeyDown(KEY_UP)) * step;
 
-    ClearBackground(BLACK);
+    BeginDrawing();
+    ClearBackground(DARKBLUE);
 
-    renderTile(rom, tileNumber);
+    BeginMode2D(camera);
+    BeginShaderMode(shader);
+    atlas.draw();
+    EndShaderMode();
+    EndMode2D();
 
-    snprintf(msg, MESSAGE_MAX, "%d/%d", tileNumber, n);
-    DrawText(msg, 5 * Rom::PIXEL_SCALE, 20 * Rom::PIXEL_SCALE, 96, WHITE);
+    int tile = atlas.tileAt(GetScreenToWorld2D(GetMousePosition(), camera));
+    if (atlas.tileCount == 0) {
+      const char *text =
+          message[0] != '\0' ? message : "No CHR ROM (the board uses CHR RAM)";
+      DrawText(text, 20, 20, 40, WHITE);
+    } else {
+      char status[128];
+      snprintf(status, sizeof(status),
+               "%zu tiles  zoom %.1fx  palette %d  tile $%03X",
+               atlas.tileCount, camera.zoom, palette + 1, tile < 0 ? 0 : tile);
+      DrawText(status, 20, Rom::SCREEN_HEIGHT - 60, 40, WHITE);
+    }
 
     EndDrawing();
   }
+
+  UnloadShader(shader);
+  CloseWindow();
 }
 
-void renderTile(Rom *rom, int i) {
-  int x = 5;
-  int y = 5;
-
-  std::size_t tileOffset = i * (Rom::TILE_SIZE);
-  for (int byteOffset = 0; byteOffset < 8; byteOffset++) {
-    uint8_t plane0Byte = rom->chrBlob[tileOffset + byteOffset];
-    uint8_t plane1Byte = rom->chrBlob[tileOffset + byteOffset + 8];
-
-    for (int bitOffset = 0; bitOffset < 8; bitOffset++) {
-      uint8_t lowerBit = plane0Byte >> (7 - bitOffset) & 0x1;
-      uint8_t upperBit = plane1Byte >> (7 - bitOffset) & 0x1;
-      uint8_t bit = lowerBit | (upperBit << 1);
-
-      // int x = ((i % TILES_PER_ROW) * 8 + bitOffset);
-      // int y = ((i * 8 / TILES_PER_ROW) + byteOffset);
-      DrawRectangleV(
-          // position
-          (Vector2){.x = (float)((x + bitOffset) * Rom::PIXEL_SCALE),
-                    .y = (float)((y + byteOffset) * Rom::PIXEL_SCALE)},
-          // size
-          (Vector2){.x = Rom::PIXEL_SCALE, .y = Rom::PIXEL_SCALE},
-          (Color){
-              .r = 0xFF,
-              .g = 0xFF,
-              .b = 0xFF,
-              .a = (unsigned char)(0xFF / 3 * bit),
-          });
-    }
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: tileBrowser rom.nes\n");
+    return 1;
+  }
+  try {
+    // Fail before opening a window
+    Rom rom(argv[1]);
+  } catch (const std::exception &e) {
+    fprintf(stderr, "[Error] %s!\n", e.what());
+    return 1;
+  } catch (const char *msg) {
+    fprintf(stderr, "[Error] %s!\n", msg);
+    return 1;
   }
+  render(argv[1]);
 }
@@ -0,0 +1,154 @@
+// Records, dumps and compares binary execution traces.
+//
+//   trace-tool record rom.nes out.trace [--nestest] [--max N]
+//   trace-tool dump out.trace
+//   trace-tool compare out.trace nestest.log
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <memory>
+
+#include "../include/disassembler.h"
+#include "../include/exectrace.h"
+#include "../include/headless.h"
+#include "../include/rom.h"
+#include "../include/word.h"
+
+using namespace NESPP;
+
+static int usage() {
+  fprintf(stderr, "Usage:\n"
+                  "  trace-tool record rom.nes out.trace [--nestest] [--max N]\n"
+                  "  trace-tool dump out.trace\n"
+                  "  trace-tool compare out.trace nestest.log\n");
+  return 1;
+}
+
+static int record(int argc, char **argv) {
+  const char *romPath = argv[0];
+  const char *tracePath = argv[1];
+  bool nestest = false;
+  uint64_t maxInstructions = 10'000'000;
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "--nestest") == 0) {
+      nestest = true;
+    } else if (strcmp(argv[i], "--max") == 0 && i + 1 < argc) {
+      maxInstructions = strtoull(argv[++i], nullptr, 10);
+    } else {
+      return usage();
+    }
+  }
+
+  std::shared_ptr<Rom> rom{new Rom(romPath)};
+  HeadlessVM vm = {rom};
+  ExecutionTraceRecorder recorder = {tracePath};
+  vm.recorder = &recorder;
+
+  // The reset sequence takes 7 cycles before the first instruction
+  vm.cycles = 7;
+  if (nestest) {
+    // Automation mode: start at $C000 with the state nestest.log expects
+    vm.PC = Word(0xC000);
+    vm.SP = 0xFD;
+    vm.S = 0x24;
+  } else {
+    vm.PC = {vm.peek16(0xFFFD), vm.peek16(0xFFFC)};
+  }
+
+  uint64_t count = 0;
+  try {
+    for (; count < maxInstructions; count++) {
+      vm.step();
+    }
+  } catch (const std::exception &e) {
+    fprintf(stderr, "Stopped at $%04X: %s\n", vm.PC.to16(), e.what());
+  } catch (const char *msg) {
+    fprintf(stderr, "Stopped at $%04X: %s\n", vm.PC.to16(), msg);
+  }
+  recorder.close();
+  printf("Recorded %lu instructions\n", static_cast<unsigned long>(count));
+  return 0;
+}
+
+static int dump(const char *tracePath) {
+  ExecutionTraceReader reader = {tracePath};
+  ExecutionRecord record;
+  char text[32];
+  while (reader.next(record)) {
+    formatInstruction(text, sizeof(text), record.pc, record.bytes);
+    printf("%s  %s\n", record.toString().data(), text);
+  }
+  return 0;
+}
+
+static int compare(const char *tracePath, const char *logPath) {
+  ExecutionTraceReader reader = {tracePath};
+  FILE *log = fopen(logPath, "r");
+  if (log == nullptr) {
+    fprintf(stderr, "Failed to open %s\n", logPath);
+    return 1;
+  }
+
+  char line[256];
+  unsigned long lineNumber = 0;
+  int status = 0;
+  while (fgets(line, sizeof(line), log) != nullptr) {
+    lineNumber += 1;
+    ExecutionRecord expected;
+    if (!parseNestestLine(line, expected)) {
+      fprintf(stderr, "%s:%lu: unrecognized line\n", logPath, lineNumber);
+      status = 1;
+      break;
+    }
+    ExecutionRecord actual;
+    if (!reader.next(actual)) {
+      printf("Trace ended before %s:%lu\n  expected: %s", logPath, lineNumber,
+             line);
+      status = 1;
+      break;
+    }
+    bool match = expected.pc == actual.pc && expected.size == actual.size &&
+                 memcmp(expected.bytes, actual.bytes, expected.size) == 0 &&
+                 expected.A == actual.A && expected.X == actual.X &&
+                 expected.Y == actual.Y && expected.P == actual.P &&
+                 expected.SP == actual.SP && expected.cycle == actual.cycle;
+    if (!match) {
+      printf("First mismatch at %s:%lu\n  expected: %s\n  actual:   %s\n",
+             logPath, lineNumber, expected.toString().data(),
+             actual.toString().data());
+      status = 1;
+      break;
+    }
+  }
+  if (status == 0) {
+    printf("All %lu lines match\n", lineNumber);
+  }
+  fclose(log);
+  return status;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    return usage();
+  }
+
+  try {
+    if (strcmp(argv[1], "record") == 0 && argc >= 4) {
+      return record(argc - 2, argv + 2);
+    } else if (strcmp(argv[1], "dump") == 0) {
+      return dump(argv[2]);
+    } else if (strcmp(argv[1], "compare") == 0 && argc == 4) {
+      return compare(argv[2], argv[3]);
+    }
+  } catch (const std::exception &e) {
+    fprintf(stderr, "[Error] %s!\n", e.what());
+    return 1;
+  } catch (const char *msg) {
+    fprintf(stderr, "[Error] %s!\n", msg);
+    return 1;
+  }
+  return usage();
+}
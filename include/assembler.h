@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "instructions.h"
+
+namespace NESPP {
+
+/// A small in-process 6502 assembler.
+///
+/// Mnemonics and encodings come from opCodeLookup / opCodeNameLookup, so it
+/// can only emit what the VM implements. Source uses a ca65-like subset:
+///
+///   label:            ; comments run to the end of the line
+///     LDA #$10        ; immediate, also #%1010, #16, #<label, #>label
+///     STA $10         ; zeropage when the operand fits and the mode exists
+///     STA label       ; absolute
+///     BNE label       ; relative, for branches
+///     JMP ($0200)     ; indirect
+///     ASL A           ; accumulator
+///     .byte $01, 2
+///     .word label
+///
+/// Labels may be used before they are defined; they are resolved by link().
+class Assembler {
+public:
+  Assembler(uint16_t origin = 0x8000);
+
+  /// Assembles one or more lines of source.
+  void assemble(std::string_view source);
+
+  void label(const std::string &name);
+  void emit(OpCodeType type, AddressingMode mode, uint16_t operand = 0);
+  void emit(OpCodeType type, AddressingMode mode, const std::string &label);
+  void byte(uint8_t value);
+  void word(uint16_t value);
+  void word(const std::string &label);
+
+  /// Address of the next byte to be emitted
+  uint16_t here();
+
+  /// Address of a defined label, throws if it is not defined
+  uint16_t address(const std::string &label);
+
+  /// Resolves label references and returns the code, starting at origin.
+  std::vector<uint8_t> link();
+
+private:
+  enum class _FixupKind { low, high, word, relative };
+
+  struct _Fixup {
+    size_t offset;
+    std::string label;
+    _FixupKind kind;
+    /// Line number for error messages, 0 when emitted through the API
+    int line;
+  };
+
+  uint16_t origin;
+  std::vector<uint8_t> code;
+  std::map<std::string, uint16_t> labels;
+  std::vector<_Fixup> fixups;
+  int line = 0;
+
+  void _opcode(OpCodeType type, AddressingMode mode);
+  void _line(std::string_view text);
+  [[noreturn]] void _fail(const std::string &message);
+};
+
+/// Returns the opcode byte for type and mode, or -1 if the VM has no such
+/// instruction.
+int opCodeFor(OpCodeType type, AddressingMode mode);
+
+/// Returns the OpCodeType for a mnemonic such as "LDA", or
+/// OpCodeType::unimplemented.
+OpCodeType opCodeTypeFor(std::string_view mnemonic);
+
+/// Builds a complete iNES image for an NROM (mapper 0) board.
+///
+/// prg is placed at $8000 (16 KiB images are mirrored at $C000 by the
+/// mapper) and padded to 16 or 32 KiB; the vectors are written to its last
+/// six bytes. chr is padded to 8 KiB.
+std::vector<uint8_t> buildINes(const std::vector<uint8_t> &prg, uint16_t reset,
+                               uint16_t nmi = 0, uint16_t irq = 0,
+                               const std::vector<uint8_t> &chr = {});
+
+} // namespace NESPP
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "instructions.h"
+
+namespace NESPP {
+
+/// Builds a guest call graph from JSR/RTS with self and inclusive cycles.
+///
+/// Attach one to VM::callGraph; VM::step then calls record() after every
+/// instruction. A shadow stack of frames mirrors the guest's: each frame
+/// remembers the stack pointer just below its return address, and is popped
+/// once SP rises past that address. Returns are therefore matched by stack
+/// depth rather than by counting RTS, so the profile survives TXS resets,
+/// PLA/PLA unwinding and RTS used as a jump through a pushed address.
+///
+/// The per-routine table is a flat array (about 2 MiB), so allocate
+/// profilers on the heap.
+class CallGraphProfiler {
+public:
+  struct Routine {
+    uint64_t calls = 0;
+    /// Cycles spent in the routine itself, excluding callees
+    uint64_t selfCycles = 0;
+    /// Cycles from entry to return including callees; recursive activations
+    /// are only counted once
+    uint64_t inclusiveCycles = 0;
+  };
+
+  /// Indexed by entry address
+  Routine routines[0x10000];
+
+  /// Cycles spent outside any tracked subroutine
+  uint64_t rootCycles = 0;
+  uint64_t totalCycles = 0;
+
+  /// JSRs not tracked because the shadow stack was full
+  uint64_t droppedCalls = 0;
+
+  CallGraphProfiler();
+
+  /// pc, sp and cycles are after the instruction executed
+  inline void record(OpCodeType type, uint16_t pc, uint8_t sp,
+                     uint64_t cycles) {
+    totalCycles += cycles;
+    if (depth == 0) {
+      rootCycles += cycles;
+    } else {
+      routines[frames[depth - 1].routine].selfCycles += cycles;
+    }
+    nodes[current].selfCycles += cycles;
+
+    if (type == OpCodeType::JSR) {
+      _enter(pc, sp, 2);
+    } else {
+      while (depth > 0 &&
+             frames[depth - 1].sp + frames[depth - 1].returnSize <= sp) {
+        _leave();
+      }
+    }
+  }
+
+  /// Inclusive cycles as of now, counting frames that are still open
+  Routine routine(uint16_t address);
+
+  /// Text report of the top routines by inclusive cycles.
+  std::string report(size_t top = 32);
+
+  /// One line per call path, "root;$C000;$C123 selfCycles", as consumed by
+  /// flamegraph.pl and compatible tools.
+  std::string folded();
+
+private:
+  static constexpr size_t _MAX_DEPTH = 256;
+
+  struct _Frame {
+    uint16_t routine;
+    /// SP after the return address was pushed
+    uint8_t sp;
+    /// Bytes above sp that belong to this frame's return address
+    uint8_t returnSize;
+    uint32_t node;
+    uint64_t startCycles;
+  };
+
+  /// Call tree node, one per distinct call path
+  struct _Node {
+    uint16_t routine;
+    uint32_t parent;
+    uint32_t firstChild = 0;
+    uint32_t nextSibling = 0;
+    uint64_t calls = 0;
+    uint64_t selfCycles = 0;
+  };
+
+  _Frame frames[_MAX_DEPTH];
+  size_t depth = 0;
+
+  /// Number of open frames for each routine, to detect recursion
+  uint16_t active[0x10000] = {0};
+
+  /// nodes[0] is the root
+  std::vector<_Node> nodes;
+  uint32_t current = 0;
+
+  void _enter(uint16_t routine, uint8_t sp, uint8_t returnSize);
+  void _leave();
+  uint32_t _child(uint32_t parent, uint16_t routine);
+};
+
+} // namespace NESPP
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace NESPP {
+
+/// Code/data log: which ROM bytes were executed, read as data or rendered.
+///
+/// Each kind is a packed bitmap indexed by offset into the PRG or CHR blob,
+/// as returned by Mapper::prgOffset / chrOffset, so bank-switched ROMs map
+/// correctly. Marking is a single OR, cheap enough to leave on.
+class CodeDataLogger {
+public:
+  CodeDataLogger(size_t prgSize, size_t chrSize);
+  /// Loads a log written by save()
+  CodeDataLogger(const char *path);
+
+  size_t prgSize;
+  size_t chrSize;
+
+  /// PRG bytes fetched as the first byte of an instruction
+  std::vector<uint64_t> opCodes;
+  /// PRG bytes fetched as instruction operands
+  std::vector<uint64_t> operands;
+  /// PRG bytes read by instructions (not fetched)
+  std::vector<uint64_t> data;
+  /// CHR bytes read by the PPU while rendering
+  std::vector<uint64_t> rendered;
+
+  inline void markOpCode(uint32_t offset) { _set(opCodes, offset); }
+  inline void markOperand(uint32_t offset) { _set(operands, offset); }
+  inline void markData(uint32_t offset) { _set(data, offset); }
+  inline void markRendered(uint32_t offset) { _set(rendered, offset); }
+
+  static inline bool test(const std::vector<uint64_t> &bits,
+                          uint32_t offset) {
+    return (bits[offset >> 6] >> (offset & 63)) & 1;
+  }
+
+  /// ORs other into this log; both must be for the same ROM sizes.
+  void merge(const CodeDataLogger &other);
+
+  /// Binary format: "NESCDL\1\0", u32 PRG size, u32 CHR size, then the
+  /// opCodes, operands, data and rendered bitmaps as little-endian u64s.
+  void save(const char *path);
+
+  struct Coverage {
+    size_t opCodes = 0;
+    size_t operands = 0;
+    size_t data = 0;
+    size_t rendered = 0;
+    /// PRG bytes marked as anything
+    size_t prg = 0;
+  };
+
+  Coverage coverage();
+
+private:
+  static inline void _set(std::vector<uint64_t> &bits, uint32_t offset) {
+    bits[offset >> 6] |= uint64_t{1} << (offset & 63);
+  }
+};
+
+/// Loads and merges logs of the same ROM, jobs at a time (0 = one per core).
+CodeDataLogger mergeCodeDataLogs(const std::vector<std::string> &paths,
+                                 unsigned jobs = 0);
+
+} // namespace NESPP
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace NESPP {
+
+/// Decodes one 16-byte 2bpp planar CHR tile (see Rom::TILE_SIZE) into 64
+/// row-major pixels with values 0-3, mirrored left to right if flip.
+void decodeTile(const uint8_t *tile, uint8_t *pixels, bool flip = false);
+
+/// Decodes count consecutive tiles into count * 64 pixels.
+void decodeTiles(const uint8_t *tiles, size_t count, uint8_t *pixels,
+                 bool flip = false);
+
+/// Decodes count 8-pixel tile rows, given each row's plane 0 and plane 1
+/// bytes, into count * 8 consecutive pixels.
+///
+/// If attributes is not null, attributes[i] is ORed into row i's opaque
+/// (non-zero) pixels, e.g. a palette number shifted left by 2 to make
+/// palette RAM indices. Transparent pixels stay 0.
+///
+/// This is the kernel behind the other decoders and the PPU. It works 32
+/// pixels at a time with AVX2 when compiled for it (see NESPP_NATIVE in
+/// CMakeLists.txt), else 16 at a time with SSE2, else a byte at a time.
+void decodeTileRows(const uint8_t *low, const uint8_t *high,
+                    const uint8_t *attributes, size_t count, uint8_t *pixels,
+                    bool flip = false);
+
+/// ORs attribute into the opaque (non-zero) pixels of a decoded row packed
+/// one pixel per byte into a word, like decodeTileRows' attributes.
+inline uint64_t colourRow(uint64_t row, uint8_t attribute) {
+  constexpr uint64_t broadcast = 0x0101010101010101;
+  // 1 in each opaque pixel's byte, then 0xFF; no byte can carry
+  uint64_t opaque = (row | (row >> 1)) & broadcast;
+  return row | ((attribute * broadcast) & (opaque * 0xFF));
+}
+
+} // namespace NESPP
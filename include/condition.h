@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace NESPP {
+
+class VM; // #include "vm.h"
+
+/// A breakpoint condition, parsed once into stack bytecode.
+///
+///   A == #$10 && [$0300] > 5
+///   X changed || hits >= 100
+///   !Z && [$10 + X] != $FF
+///
+/// Operands are numbers ($hex, #$hex, decimal, 0xhex), registers (A X Y SP
+/// S PC), flags (C Z I D V N), memory ([address], a byte), hits (times the
+/// breakpoint has been reached, including this one) and parentheses.
+/// Operators, loosest first: || && (== != < <= > >=) (+ - & | ^) ! and
+/// postfix "changed", which is true when its operand differs from its value
+/// the last time this condition was evaluated.
+///
+/// Memory is read with VM::inspect, so I/O registers see no side effects.
+/// Every operand is evaluated; && and || do not short-circuit, so that
+/// "changed" always tracks the latest value.
+class BreakCondition {
+public:
+  /// Throws std::runtime_error on a malformed expression
+  BreakCondition(const char *expression);
+
+  /// Counts a hit and evaluates the condition against the VM
+  bool evaluate(VM &);
+
+  std::string source;
+  uint64_t hits = 0;
+
+private:
+  enum class Op : uint8_t {
+    constant,
+    registerA,
+    registerX,
+    registerY,
+    registerSP,
+    registerS,
+    registerPC,
+    flag, // operand is the bit in S
+    hitCount,
+    memory,  // pops the address
+    changed, // operand indexes previous
+    logicalNot,
+    add,
+    subtract,
+    bitAnd,
+    bitOr,
+    bitXor,
+    equal,
+    notEqual,
+    less,
+    lessEqual,
+    greater,
+    greaterEqual,
+    logicalAnd,
+    logicalOr,
+  };
+
+  struct _Operation {
+    Op op;
+    int32_t operand = 0;
+  };
+
+  /// Deepest the evaluation stack may get
+  static constexpr int STACK_SIZE = 32;
+
+  std::vector<_Operation> code;
+  /// Last seen values for each "changed", and whether there has been one
+  std::vector<int32_t> previous;
+  std::vector<bool> seen;
+
+  struct _Parser;
+};
+
+} // namespace NESPP
@@ -1,26 +1,46 @@
 #pragma once
 
 struct Rom; // #include "rom.h"
+#include "condition.h"
+#include "rewind.h"
 #include "vm.h"
-#include <list>
-
+#include "watch.h"
+#include <bitset>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 
 namespace NESPP {
 
+/// Fixed-capacity ring of text lines for a pane. Enqueueing never
+/// allocates; lines longer than LINE_SIZE - 1 are truncated.
 class _Queue {
 public:
+  static constexpr unsigned int CAPACITY = 16;
+  static constexpr size_t LINE_SIZE = 80;
+
   _Queue(int _size);
 
-  void enqueue(std::string element);
+  void enqueue(std::string_view element);
+
+  /// Claims the next line and returns it to be written in place, NUL
+  /// terminated and at most LINE_SIZE bytes.
+  char *next();
+
+  void clear();
 
   void renderLines(int y, int x, int height, int width);
 
   const unsigned int size;
 
 private:
-  std::list<std::string> contents;
+  char lines[CAPACITY][LINE_SIZE] = {};
+  /// Lines ever enqueued; the newest is at (count - 1) % size
+  uint64_t count = 0;
 };
 
 class Debugger : public VM::VM {
@@ -31,10 +51,59 @@ public:
   _Queue instructionQueue = {5};
   _Queue debugQueue = {8};
 
+  /// One bit per CPU address; checked before every instruction in run mode
+  std::bitset<0x10000> breakpoints;
+  /// Only looked up when the PC hits a set bit in breakpoints
+  std::unordered_map<uint16_t, BreakCondition> conditions;
+
+  /// Installed as VM::watchpoints only while non-empty
+  WatchpointSet watches;
+
+  /// Keyframes for stepping backwards
+  RewindBuffer rewind;
+
+  /// Fastest the UI is redrawn while running
+  static constexpr std::chrono::milliseconds REDRAW_INTERVAL{50};
+
   void start();
 
+  /// Executes up to count instructions at full speed, stopping early at a
+  /// breakpoint, at address until (if non-negative), or on any keypress.
+  /// The breakpoint at the starting PC is ignored so that execution can
+  /// continue from it.
+  void run(uint64_t count, int32_t until = -1);
+
 private:
+  /// Most recent instructions, formatted into instructionQueue at render
+  /// time rather than on every step
+  struct _Executed {
+    uint16_t address;
+    Instruction instruction;
+  };
+  _Executed history[_Queue::CAPACITY];
+  uint64_t executed = 0;
+
+  /// Shown on the prompt line, e.g. why the last run stopped
+  std::string status;
+
   void render();
+  void drainTrace();
+  bool _shouldBreak(uint16_t address);
+
+  /// Loads the newest keyframe at or before target and replays forward to
+  /// it. Returns false, changing nothing, if target is older than every
+  /// keyframe.
+  bool _seek(uint64_t target);
+
+  /// Replays the run so far in keyframe intervals, newest first, looking
+  /// for the newest instruction before the current one for which before()
+  /// (ahead of executing it) or after() (once it has executed) holds.
+  /// Leaves the VM where it started.
+  template <typename Before, typename After>
+  bool _reverseSearch(Before before, After after, uint64_t &found);
+
+  void _discardTrace();
+  void command(const char *input);
   virtual void debug(std::string) override;
 };
 
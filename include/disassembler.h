@@ -0,0 +1,193 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct Rom; // #include "rom.h"
+
+namespace NESPP {
+
+class CodeDataLogger; // #include "cdl.h"
+
+/// Every 6502 addressing mode, unlike AddressingMode which only has the
+/// ones the VM implements
+enum class DisassemblyMode : uint8_t {
+  implied,
+  accumulator,
+  immediate,
+  zeropage,
+  zeropageX,
+  zeropageY,
+  absolute,
+  absoluteX,
+  absoluteY,
+  indirect,
+  indirectX,
+  indirectY,
+  relative,
+};
+
+/// One entry of the full official 6502 instruction set
+struct DisassemblyOpCode {
+  /// nullptr for unofficial opcodes, which are disassembled as data
+  const char *mnemonic = nullptr;
+  DisassemblyMode mode = DisassemblyMode::implied;
+};
+
+consteval std::array<DisassemblyOpCode, 256> _buildDisassemblyLookup() {
+  using enum DisassemblyMode;
+  std::array<DisassemblyOpCode, 256> table = {};
+
+  // The eight-mode ALU instructions, opcodes in the order immediate,
+  // zeropage, zeropage,X, absolute, absolute,X, absolute,Y, (zp,X), (zp),Y
+  constexpr DisassemblyMode aluModes[8] = {
+      immediate, zeropage,  zeropageX, absolute,
+      absoluteX, absoluteY, indirectX, indirectY};
+  constexpr std::pair<const char *, std::array<uint8_t, 8>> alu[] = {
+      {"ADC", {0x69, 0x65, 0x75, 0x6D, 0x7D, 0x79, 0x61, 0x71}},
+      {"AND", {0x29, 0x25, 0x35, 0x2D, 0x3D, 0x39, 0x21, 0x31}},
+      {"CMP", {0xC9, 0xC5, 0xD5, 0xCD, 0xDD, 0xD9, 0xC1, 0xD1}},
+      {"EOR", {0x49, 0x45, 0x55, 0x4D, 0x5D, 0x59, 0x41, 0x51}},
+      {"LDA", {0xA9, 0xA5, 0xB5, 0xAD, 0xBD, 0xB9, 0xA1, 0xB1}},
+      {"ORA", {0x09, 0x05, 0x15, 0x0D, 0x1D, 0x19, 0x01, 0x11}},
+      {"SBC", {0xE9, 0xE5, 0xF5, 0xED, 0xFD, 0xF9, 0xE1, 0xF1}},
+  };
+  for (auto &[mnemonic, opCodes] : alu) {
+    for (int i = 0; i < 8; i++) {
+      table[opCodes[i]] = {mnemonic, aluModes[i]};
+    }
+  }
+
+  struct Entry {
+    uint8_t opCode;
+    const char *mnemonic;
+    DisassemblyMode mode;
+  };
+  constexpr Entry entries[] = {
+      // Read-modify-write
+      {0x0A, "ASL", accumulator}, {0x06, "ASL", zeropage},
+      {0x16, "ASL", zeropageX},   {0x0E, "ASL", absolute},
+      {0x1E, "ASL", absoluteX},   {0x4A, "LSR", accumulator},
+      {0x46, "LSR", zeropage},    {0x56, "LSR", zeropageX},
+      {0x4E, "LSR", absolute},    {0x5E, "LSR", absoluteX},
+      {0x2A, "ROL", accumulator}, {0x26, "ROL", zeropage},
+      {0x36, "ROL", zeropageX},   {0x2E, "ROL", absolute},
+      {0x3E, "ROL", absoluteX},   {0x6A, "ROR", accumulator},
+      {0x66, "ROR", zeropage},    {0x76, "ROR", zeropageX},
+      {0x6E, "ROR", absolute},    {0x7E, "ROR", absoluteX},
+      {0xC6, "DEC", zeropage},    {0xD6, "DEC", zeropageX},
+      {0xCE, "DEC", absolute},    {0xDE, "DEC", absoluteX},
+      {0xE6, "INC", zeropage},    {0xF6, "INC", zeropageX},
+      {0xEE, "INC", absolute},    {0xFE, "INC", absoluteX},
+      // Index registers
+      {0xA2, "LDX", immediate},   {0xA6, "LDX", zeropage},
+      {0xB6, "LDX", zeropageY},   {0xAE, "LDX", absolute},
+      {0xBE, "LDX", absoluteY},   {0xA0, "LDY", immediate},
+      {0xA4, "LDY", zeropage},    {0xB4, "LDY", zeropageX},
+      {0xAC, "LDY", absolute},    {0xBC, "LDY", absoluteX},
+      {0x86, "STX", zeropage},    {0x96, "STX", zeropageY},
+      {0x8E, "STX", absolute},    {0x84, "STY", zeropage},
+      {0x94, "STY", zeropageX},   {0x8C, "STY", absolute},
+      {0xE0, "CPX", immediate},   {0xE4, "CPX", zeropage},
+      {0xEC, "CPX", absolute},    {0xC0, "CPY", immediate},
+      {0xC4, "CPY", zeropage},    {0xCC, "CPY", absolute},
+      // STA has no immediate form
+      {0x85, "STA", zeropage},    {0x95, "STA", zeropageX},
+      {0x8D, "STA", absolute},    {0x9D, "STA", absoluteX},
+      {0x99, "STA", absoluteY},   {0x81, "STA", indirectX},
+      {0x91, "STA", indirectY},   {0x24, "BIT", zeropage},
+      {0x2C, "BIT", absolute},
+      // Control flow
+      {0x10, "BPL", relative},    {0x30, "BMI", relative},
+      {0x50, "BVC", relative},    {0x70, "BVS", relative},
+      {0x90, "BCC", relative},    {0xB0, "BCS", relative},
+      {0xD0, "BNE", relative},    {0xF0, "BEQ", relative},
+      {0x4C, "JMP", absolute},    {0x6C, "JMP", indirect},
+      {0x20, "JSR", absolute},    {0x60, "RTS", implied},
+      {0x40, "RTI", implied},     {0x00, "BRK", implied},
+      // Everything else is implied
+      {0x08, "PHP", implied},     {0x28, "PLP", implied},
+      {0x48, "PHA", implied},     {0x68, "PLA", implied},
+      {0x18, "CLC", implied},     {0x38, "SEC", implied},
+      {0x58, "CLI", implied},     {0x78, "SEI", implied},
+      {0xB8, "CLV", implied},     {0xD8, "CLD", implied},
+      {0xF8, "SED", implied},     {0x88, "DEY", implied},
+      {0xC8, "INY", implied},     {0xCA, "DEX", implied},
+      {0xE8, "INX", implied},     {0x8A, "TXA", implied},
+      {0x98, "TYA", implied},     {0xAA, "TAX", implied},
+      {0xA8, "TAY", implied},     {0x9A, "TXS", implied},
+      {0xBA, "TSX", implied},     {0xEA, "NOP", implied},
+  };
+  for (const Entry &entry : entries) {
+    table[entry.opCode] = {entry.mnemonic, entry.mode};
+  }
+  return table;
+}
+
+/// Indexed by opcode byte
+constexpr std::array<DisassemblyOpCode, 256> disassemblyLookup =
+    _buildDisassemblyLookup();
+
+/// Encoded length in bytes of the instruction starting with opCode, 1 for
+/// unofficial opcodes
+uint8_t disassemblySize(uint8_t opCode);
+
+/// Formats the instruction in bytes (at least disassemblySize(bytes[0])
+/// long) at address in ca65 syntax, e.g. "LDA $0200,X" or "BNE $8012".
+/// Absolute operands below $0100 get an "a:" prefix so ca65 keeps their
+/// size. Unofficial opcodes come out as ".byte $XX".
+///
+/// Writes at most size bytes including the terminating NUL and returns the
+/// length. Never allocates; this is the formatter used by the debugger,
+/// trace-tool and profiler reports.
+size_t formatInstruction(char *buffer, size_t size, uint16_t address,
+                         const uint8_t *bytes);
+
+/// Recursive-descent disassembler for a ROM's PRG.
+///
+/// Starts from the reset, NMI and IRQ vectors (and optionally from every
+/// opcode a CodeDataLogger saw execute) and follows branches, jumps and
+/// subroutine calls, so bytes that are only reachable as data are listed as
+/// data. PRG up to 32 KiB is one bank at its NROM address. Larger PRG is
+/// split into 16 KiB banks, the last fixed at $C000 and the rest at $8000,
+/// as on UxROM; control flow into the other window is not followed.
+class Disassembler {
+public:
+  Disassembler(std::shared_ptr<Rom> rom);
+
+  /// Adds every PRG byte the log saw fetched as an opcode as an entry point
+  void seed(const CodeDataLogger &);
+
+  /// Adds an entry point in the given bank
+  void addEntryPoint(size_t bank, uint16_t address);
+
+  size_t bankCount() const { return banks.size(); }
+
+  /// A ca65 listing of every bank, analysed and formatted jobs at a time
+  /// (0 = one per core).
+  std::string listing(unsigned jobs = 0);
+
+private:
+  struct _Bank {
+    /// CPU address of the first byte
+    uint16_t origin;
+    /// Offset into Rom::prgBlob
+    size_t offset;
+    size_t size;
+    std::vector<uint16_t> entryPoints;
+  };
+
+  std::shared_ptr<Rom> rom;
+  std::vector<_Bank> banks;
+
+  /// Offset into the bank of a CPU address, or -1 if it is not mapped there
+  int32_t _bankOffset(const _Bank &, uint16_t address) const;
+  std::string _listBank(size_t index) const;
+};
+
+} // namespace NESPP
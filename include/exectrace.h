@@ -0,0 +1,106 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace NESPP {
+
+/// CPU state immediately before an instruction executes, as in nestest.log.
+struct ExecutionRecord {
+  uint16_t pc = 0;
+  uint8_t bytes[3] = {0};
+  /// Number of valid entries in bytes, 1-3
+  uint8_t size = 1;
+  uint8_t A = 0;
+  uint8_t X = 0;
+  uint8_t Y = 0;
+  uint8_t P = 0;
+  uint8_t SP = 0;
+  uint64_t cycle = 0;
+
+  /// Formats as a nestest.log style line (without the disassembly column)
+  std::string toString();
+};
+
+/// Writes a compact binary stream of ExecutionRecords.
+///
+/// Each record is delta-encoded against the previous one: a flags byte says
+/// which registers changed and whether PC followed the previous instruction,
+/// followed by the opcode bytes, only the changed fields and a varint cycle
+/// delta. Records are appended to a block; full blocks are handed to a
+/// background thread which zlib-compresses and writes them, so the emulation
+/// thread only ever does a handful of byte stores per instruction.
+///
+/// Every block starts from a zeroed state so it can be decoded on its own.
+///
+/// Write and compression errors on the background thread are kept, and
+/// the writer drops everything after the first one; flush() and close()
+/// throw it.
+class ExecutionTraceRecorder {
+public:
+  ExecutionTraceRecorder(const char *path);
+  /// Closes the file, printing rather than throwing any error; call
+  /// close() first to handle it.
+  ~ExecutionTraceRecorder();
+
+  void record(const ExecutionRecord &);
+
+  /// Hands the current block to the writer and waits for everything queued so
+  /// far to hit the disk.
+  void flush();
+  /// Flushes, stops the writer and closes the file. Nothing may be recorded
+  /// after this.
+  void close();
+
+  static constexpr size_t BLOCK_SIZE = 1 << 16;
+
+private:
+  FILE *file;
+  std::vector<uint8_t> block;
+  ExecutionRecord previous;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::deque<std::vector<uint8_t>> pending;
+  std::vector<std::vector<uint8_t>> spare;
+  bool writing = false;
+  bool done = false;
+  /// The writer's first error, if any
+  std::string error;
+  std::thread writer;
+
+  void _submit();
+  void _writeLoop();
+  /// Throws error, if any
+  void _checkError();
+};
+
+/// Decodes a stream written by ExecutionTraceRecorder.
+class ExecutionTraceReader {
+public:
+  ExecutionTraceReader(const char *path);
+  ~ExecutionTraceReader();
+
+  /// Returns false at the end of the stream.
+  bool next(ExecutionRecord &);
+
+private:
+  FILE *file;
+  std::vector<uint8_t> block;
+  size_t offset = 0;
+  ExecutionRecord previous;
+
+  bool _readBlock();
+};
+
+/// Parses one line of nestest.log. Returns false if the line is malformed.
+bool parseNestestLine(const char *line, ExecutionRecord &);
+
+} // namespace NESPP
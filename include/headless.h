@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+struct Rom; // #include "rom.h"
+#include "vm.h"
+
+namespace NESPP {
+
+/// A VM with no UI attached; debug messages are discarded.
+class HeadlessVM : public VM {
+public:
+  HeadlessVM(std::shared_ptr<Rom> rom);
+  /// See VM::VM(uint8_t *)
+  HeadlessVM(uint8_t *flatBus);
+
+protected:
+  virtual void debug(std::string) override;
+};
+
+} // namespace NESPP
@@ -34,6 +34,7 @@ enum class OpCodeType {
   LDY,
   LSR, // Logical shift right
   PHA, // Push accumulator onto stack
+  RTI, // Return from interrupt
   RTS, // Return from subroutine
   SEI, // Set interrupt disabled
   STA,
@@ -58,6 +59,9 @@ struct OpCode {
   OpCodeType type = OpCodeType::unimplemented;
   AddressingMode addressing = AddressingMode::implied;
 
+  /// Base cycle count, not including page-crossing or branch-taken penalties
+  uint8_t cycles = 0;
+
   std::string toString();
   bool operator==(OpCode other);
 };
@@ -74,143 +78,147 @@ _buildOpCodeLookup() {
     switch (i) {
     case 0x0A:
       table1[i] = "ASL";
-      table2[i] = {.type = ASL, .addressing = accumulator};
+      table2[i] = {.type = ASL, .addressing = accumulator, .cycles = 2};
       break;
     case 0x10:
       table1[i] = "BPL";
-      table2[i] = {.type = BPL, .addressing = relative};
+      table2[i] = {.type = BPL, .addressing = relative, .cycles = 2};
       break;
     case 0x20:
       table1[i] = "JSR";
-      table2[i] = {.type = JSR, .addressing = absolute};
+      table2[i] = {.type = JSR, .addressing = absolute, .cycles = 6};
       break;
     case 0x2D:
       table1[i] = "AND";
-      table2[i] = {.type = AND, .addressing = absolute};
+      table2[i] = {.type = AND, .addressing = absolute, .cycles = 4};
       break;
     case 0x48:
       table1[i] = "PHA";
-      table2[i] = {.type = PHA, .addressing = implied};
+      table2[i] = {.type = PHA, .addressing = implied, .cycles = 3};
+      break;
+    case 0x40:
+      table1[i] = "RTI";
+      table2[i] = {.type = RTI, .addressing = implied, .cycles = 6};
       break;
     case 0x4A:
       table1[i] = "LSR";
-      table2[i] = {.type = LSR, .addressing = accumulator};
+      table2[i] = {.type = LSR, .addressing = accumulator, .cycles = 2};
       break;
     case 0x4C:
       table1[i] = "JMP";
-      table2[i] = {.type = JMP, .addressing = absolute};
+      table2[i] = {.type = JMP, .addressing = absolute, .cycles = 3};
       break;
     case 0x60:
       table1[i] = "RTS";
-      table2[i] = {.type = RTS, .addressing = implied};
+      table2[i] = {.type = RTS, .addressing = implied, .cycles = 6};
       break;
     case 0x6C:
       table1[i] = "JMP";
-      table2[i] = {.type = JMP, .addressing = indirect};
+      table2[i] = {.type = JMP, .addressing = indirect, .cycles = 5};
       break;
     case 0x78:
       table1[i] = "SEI";
-      table2[i] = {.type = SEI, .addressing = implied};
+      table2[i] = {.type = SEI, .addressing = implied, .cycles = 2};
       break;
     case 0x85:
       table1[i] = "STA";
-      table2[i] = {.type = STA, .addressing = zeropage};
+      table2[i] = {.type = STA, .addressing = zeropage, .cycles = 3};
       break;
     case 0x88:
       table1[i] = "DEY";
-      table2[i] = {.type = DEY, .addressing = implied};
+      table2[i] = {.type = DEY, .addressing = implied, .cycles = 2};
       break;
     case 0x8C:
       table1[i] = "STY";
-      table2[i] = {.type = STY, .addressing = absolute};
+      table2[i] = {.type = STY, .addressing = absolute, .cycles = 4};
       break;
     case 0x8D:
       table1[i] = "STA";
-      table2[i] = {.type = STA, .addressing = absolute};
+      table2[i] = {.type = STA, .addressing = absolute, .cycles = 4};
       break;
     case 0x8E:
       table1[i] = "STX";
-      table2[i] = {.type = STX, .addressing = absolute};
+      table2[i] = {.type = STX, .addressing = absolute, .cycles = 4};
       break;
     case 0x90:
       table1[i] = "BCC";
-      table2[i] = {.type = BCC, .addressing = relative};
+      table2[i] = {.type = BCC, .addressing = relative, .cycles = 2};
       break;
     case 0x9A:
       table1[i] = "TXS";
-      table2[i] = {.type = TXS, .addressing = implied};
+      table2[i] = {.type = TXS, .addressing = implied, .cycles = 2};
       break;
     case 0xA0:
       table1[i] = "LDY";
-      table2[i] = {.type = LDY, .addressing = immediate};
+      table2[i] = {.type = LDY, .addressing = immediate, .cycles = 2};
       break;
     case 0xA2:
       table1[i] = "LDX";
-      table2[i] = {.type = LDX, .addressing = immediate};
+      table2[i] = {.type = LDX, .addressing = immediate, .cycles = 2};
       break;
     case 0xA5:
       table1[i] = "LDA";
-      table2[i] = {.type = LDA, .addressing = zeropage};
+      table2[i] = {.type = LDA, .addressing = zeropage, .cycles = 3};
       break;
     case 0xA9:
       table1[i] = "LDA";
-      table2[i] = {.type = LDA, .addressing = immediate};
+      table2[i] = {.type = LDA, .addressing = immediate, .cycles = 2};
       break;
     case 0xAA:
       table1[i] = "TAX";
-      table2[i] = {.type = TAX, .addressing = implied};
+      table2[i] = {.type = TAX, .addressing = implied, .cycles = 2};
       break;
     case 0xAD:
       table1[i] = "LDA";
-      table2[i] = {.type = LDA, .addressing = absolute};
+      table2[i] = {.type = LDA, .addressing = absolute, .cycles = 4};
       break;
     case 0xB0:
       table1[i] = "BCS";
-      table2[i] = {.type = BCS, .addressing = relative};
+      table2[i] = {.type = BCS, .addressing = relative, .cycles = 2};
       break;
     case 0xBD:
       table1[i] = "LDA";
-      table2[i] = {.type = LDA, .addressing = absolute};
+      table2[i] = {.type = LDA, .addressing = absolute, .cycles = 4};
       break;
     case 0xCA:
       table1[i] = "DEX";
-      table2[i] = {.type = DEX, .addressing = implied};
+      table2[i] = {.type = DEX, .addressing = implied, .cycles = 2};
       break;
     case 0xC6:
       table1[i] = "DEC";
-      table2[i] = {.type = DEC, .addressing = zeropage};
+      table2[i] = {.type = DEC, .addressing = zeropage, .cycles = 5};
       break;
     case 0xC8:
       table1[i] = "INY";
-      table2[i] = {.type = INY, .addressing = zeropage};
+      table2[i] = {.type = INY, .addressing = zeropage, .cycles = 2};
       break;
     case 0xC9:
       table1[i] = "CMP";
-      table2[i] = {.type = CMP, .addressing = immediate};
+      table2[i] = {.type = CMP, .addressing = immediate, .cycles = 2};
       break;
     case 0xD0:
       table1[i] = "BNE";
-      table2[i] = {.type = BNE, .addressing = relative};
+      table2[i] = {.type = BNE, .addressing = relative, .cycles = 2};
       break;
     case 0xD8:
       table1[i] = "CLD";
-      table2[i] = {.type = CLD, .addressing = implied};
+      table2[i] = {.type = CLD, .addressing = implied, .cycles = 2};
       break;
     case 0xE0:
       table1[i] = "CPX";
-      table2[i] = {.type = CPX, .addressing = immediate};
+      table2[i] = {.type = CPX, .addressing = immediate, .cycles = 2};
       break;
     case 0xE6:
       table1[i] = "INC";
-      table2[i] = {.type = INC, .addressing = zeropage};
+      table2[i] = {.type = INC, .addressing = zeropage, .cycles = 5};
       break;
     case 0xE8:
       table1[i] = "INX";
-      table2[i] = {.type = INX, .addressing = implied};
+      table2[i] = {.type = INX, .addressing = implied, .cycles = 2};
       break;
     case 0xF0:
       table1[i] = "BEQ";
-      table2[i] = {.type = BEQ, .addressing = relative};
+      table2[i] = {.type = BEQ, .addressing = relative, .cycles = 2};
       break;
     default:
       table1[i] = "unimplemented";
@@ -226,6 +234,37 @@ constexpr auto opCodeLookupPair = _buildOpCodeLookup();
 constexpr auto opCodeNameLookup = opCodeLookupPair.first;
 constexpr auto opCodeLookup = opCodeLookupPair.second;
 
+constexpr int OPCODE_TYPE_COUNT =
+    static_cast<int>(OpCodeType::unimplemented) + 1;
+constexpr int ADDRESSING_MODE_COUNT =
+    static_cast<int>(AddressingMode::zeropage) + 1;
+
+using _OpCodeByteTable =
+    std::array<std::array<int16_t, ADDRESSING_MODE_COUNT>, OPCODE_TYPE_COUNT>;
+
+consteval _OpCodeByteTable _buildOpCodeByteLookup() {
+  _OpCodeByteTable table = {};
+  for (auto &modes : table) {
+    modes.fill(-1);
+  }
+  for (int i = 0; i < 256; i++) {
+    OpCode code = opCodeLookup[i];
+    if (code.type == OpCodeType::unimplemented) {
+      continue;
+    }
+    int16_t &entry = table[static_cast<int>(code.type)]
+                          [static_cast<int>(code.addressing)];
+    // Keep the first encoding when the table lists one twice
+    if (entry == -1) {
+      entry = i;
+    }
+  }
+  return table;
+}
+
+/// opCodeLookup in reverse: [type][addressing] to the opcode byte, or -1
+constexpr _OpCodeByteTable opCodeByteLookup = _buildOpCodeByteLookup();
+
 union InstructionOperandUnion {
   Word absolute;
   uint8_t immediate;
@@ -253,4 +292,12 @@ public:
 // TODO: do we even need this anymore?
 Instruction decodeInstruction(uint8_t **src, int idx);
 
+/// Decodes the instruction whose opcode is bytes[0], reading as many
+/// operand bytes as its addressing mode needs. Nothing is checked, so
+/// unimplemented opcodes decode as OpCodeType::unimplemented.
+Instruction decodeInstruction(const uint8_t *bytes);
+
+/// Encoded length in bytes, including the opcode
+uint8_t instructionSize(AddressingMode);
+
 } // namespace NESPP
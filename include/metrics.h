@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/// Compile-time switch for VM runtime counters.
+///
+/// Defaults to on. When off, the counters are not part of the VM and every
+/// counter site compiles away.
+#ifndef NESPP_METRICS
+#define NESPP_METRICS 1
+#endif
+
+namespace NESPP {
+
+enum class BusRegion : uint8_t {
+  ram,    // $0000-$1FFF
+  ppu,    // $2000-$3FFF
+  apuIo,  // $4000-$401F
+  mapper, // $4020-$FFFF
+};
+
+constexpr int BUS_REGION_COUNT = 4;
+
+/// Counters owned by one VM.
+///
+/// Only the VM's own thread writes them, with a relaxed load and store
+/// rather than an atomic read-modify-write, so an increment costs the same
+/// as on a plain integer. The struct is cache-line aligned so that VMs on
+/// different threads never share a line. Publishers read them concurrently.
+struct alignas(64) VMMetrics {
+  using Counter = std::atomic<uint64_t>;
+
+  Counter instructions = 0;
+  Counter cycles = 0;
+  Counter frames = 0;
+  Counter reads[BUS_REGION_COUNT] = {};
+  Counter writes[BUS_REGION_COUNT] = {};
+  Counter bankSwitches = 0;
+  /// PPU tile lookups served by the decoded tile cache, and those that had
+  /// to decode
+  Counter tileCacheHits = 0;
+  Counter tileCacheMisses = 0;
+  /// Cycles fast-forwarded by idle-loop skipping
+  Counter idleCyclesSkipped = 0;
+  /// Exceptions that escaped VM::step
+  Counter exceptions = 0;
+
+  /// Assigned by Metrics::attach
+  uint64_t id = 0;
+
+  static inline void add(Counter &counter, uint64_t value = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + value,
+                  std::memory_order_relaxed);
+  }
+};
+
+namespace Metrics {
+
+/// Makes a VM's counters visible to prometheusText(). VMs attach
+/// themselves on construction.
+void attach(VMMetrics *);
+
+/// Folds a VM's counters into the retired totals so aggregates never go
+/// backwards. Detaching twice is harmless.
+void detach(VMMetrics *);
+
+/// Every live VM's counters plus a vm="all" aggregate, in the Prometheus
+/// text exposition format.
+std::string prometheusText();
+
+} // namespace Metrics
+
+/// Periodically writes Metrics::prometheusText() to a file, e.g. for the
+/// node_exporter textfile collector.
+///
+/// The file is replaced atomically by writing a temporary and renaming it.
+class MetricsPublisher {
+public:
+  MetricsPublisher(const char *path, std::chrono::milliseconds interval =
+                                         std::chrono::seconds(1));
+  /// Stops the thread and publishes one last time.
+  ~MetricsPublisher();
+
+  void publish();
+
+private:
+  std::string path;
+  std::chrono::milliseconds interval;
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+  std::thread thread;
+};
+
+} // namespace NESPP
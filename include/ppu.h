@@ -0,0 +1,239 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "tileCache.h"
+
+struct Rom; // #include "rom.h"
+
+namespace NESPP {
+
+/// Which VRAM each of the four nametables at $2000-$2FFF shows
+enum class Mirroring : uint8_t {
+  /// $2400 mirrors $2000 and $2C00 mirrors $2800
+  horizontal,
+  /// $2800 mirrors $2000 and $2C00 mirrors $2400
+  vertical,
+  /// All four are the first 1 KiB of VRAM
+  singleScreenLow,
+  /// All four are the second 1 KiB of VRAM
+  singleScreenHigh,
+  /// Four distinct nametables, the second two in VRAM on the cartridge
+  fourScreen,
+};
+
+class CodeDataLogger; // #include "cdl.h"
+class Mapper;         // #include "vm.h"
+
+/// Everything about the PPU that the CPU can observe or that affects what
+/// is rendered later, so that it can be saved and restored with the VM. The
+/// framebuffer is output, not state.
+struct PPUState {
+  /// PPU cycles (dots) run since power on, 3 per CPU cycle
+  uint64_t cycle = 0;
+  /// Frames whose vblank has started
+  uint64_t frames = 0;
+
+  /// $2000
+  uint8_t control = 0;
+  /// $2001
+  uint8_t mask = 0;
+  /// $2002; only the top three bits are real
+  uint8_t status = 0;
+  /// $2003
+  uint8_t oamAddress = 0;
+  /// $2007 reads lag one byte behind, except palette reads
+  uint8_t readBuffer = 0;
+  /// The last value written to any register, returned by the unreadable ones
+  uint8_t openBus = 0;
+
+  // "Loopy" scroll registers, see
+  // https://www.nesdev.org/wiki/PPU_scrolling
+
+  /// Current VRAM address: yyy NN YYYYY XXXXX (fine Y, nametable, coarse Y,
+  /// coarse X)
+  uint16_t v = 0;
+  /// Temporary VRAM address, copied into v at the start of lines and frames
+  uint16_t t = 0;
+  /// Fine X scroll, 0-7
+  uint8_t fineX = 0;
+  /// Second write of $2005/$2006 pending
+  bool writeToggle = false;
+
+  /// Set at the start of vblank when NMIs are enabled; taken by the VM
+  bool nmiPending = false;
+
+  /// Two nametables, mirrored over $2000-$2FFF, and two more for
+  /// Mirroring::fourScreen
+  uint8_t nametables[0x1000] = {0};
+  /// $3F00-$3F1F
+  uint8_t palette[32] = {0};
+  /// Pattern tables for boards without CHR ROM
+  uint8_t chrRam[0x2000] = {0};
+  /// Object attribute memory: 64 sprites of Y, tile, attributes and X
+  uint8_t oam[256] = {0};
+};
+
+/// Scanline-based PPU.
+///
+/// The PPU runs lazily: it only catches up to the CPU when a register is
+/// accessed or when the CPU reaches deadline, the start of the next vblank.
+/// Catching up fires the frame's events in order, rendering each visible
+/// line whole at dot 257 from the scroll registers as they were then. So
+/// any register write lands between the right pair of scanlines, which is
+/// what scroll splits need, while a frame with no mid-frame writes costs 240
+/// line renders and no per-dot work.
+///
+/// Sprites are evaluated for each line when it is rendered, against the
+/// line before as the hardware does, so the sprite overflow and sprite 0
+/// hit flags are set at dot 257 of the line rather than mid-line. Games
+/// that poll for them only see them up to a line late.
+///
+/// Tile rows for both the background and sprites come from a TileCache
+/// over the CHR ROM or CHR RAM, so each tile is decoded once rather than on
+/// every line that shows it.
+///
+/// The PPU bus is a table of 1 KiB pages, so nametable mirroring and CHR
+/// banks are pointers aliasing the same memory and each access is a lookup
+/// with no branching on either.
+///
+/// Frames can also be run without drawing them (see renderEvery), for
+/// headless runs that only need the CPU's view of the PPU.
+class PPU : public PPUState {
+public:
+  static constexpr int WIDTH = 256;
+  static constexpr int HEIGHT = 240;
+  static constexpr int DOTS_PER_SCANLINE = 341;
+  static constexpr int SCANLINES = 262;
+  static constexpr int DOTS_PER_FRAME = DOTS_PER_SCANLINE * SCANLINES;
+
+  /// mapper is not owned and must outlive the PPU
+  PPU(std::shared_ptr<Rom> rom, Mapper *mapper);
+
+  /// Each pixel is a palette RAM value (0-63) with the $2001 colour
+  /// emphasis bits in bits 6-8, i.e. an index into a 512-entry RGB table.
+  uint16_t framebuffer[WIDTH * HEIGHT] = {0};
+
+  /// Optional, not owned; CHR bytes fetched while rendering are marked
+  CodeDataLogger *cdl = nullptr;
+
+  /// Pixels are generated for one frame in renderEvery, counting from frame
+  /// 0, and none when it is 0. Other frames leave the framebuffer as it was
+  /// but still set the sprite 0 hit and sprite overflow flags, from a test
+  /// of sprite 0's pixels against the background under them alone, so what
+  /// the CPU sees is the same. Read at the start of each frame (the
+  /// pre-render line), so it can be changed at any time and only ever
+  /// switches whole frames. Skipped frames mark only the CHR bytes that
+  /// test fetches in cdl.
+  unsigned renderEvery = 1;
+
+  /// PPU cycle at which the CPU must call catchUp() so that vblank and NMIs
+  /// happen on time
+  uint64_t deadline = 0;
+
+  /// Runs the PPU up to (not including) cycle. Call before every register
+  /// access, with the CPU's cycle count times 3.
+  inline void catchUp(uint64_t target) {
+    if (target > _nextEventCycle) {
+      _runEvents(target);
+    }
+    if (target > cycle) {
+      cycle = target;
+    }
+  }
+
+  /// Called by the VM once it has taken the pending NMI
+  void acknowledgeNmi();
+
+  /// Register access; reg is the address modulo 8
+  uint8_t read(uint8_t reg);
+  void write(uint8_t reg, uint8_t value);
+  /// What read() would return, without side effects. For debuggers.
+  uint8_t inspect(uint8_t reg) const;
+
+  /// What 256 writes of source to $2004 do, i.e. OAM DMA: a copy into OAM
+  /// starting at, and wrapping around to, oamAddress
+  void writeOam(const uint8_t *source);
+
+  /// The PPU bus, $0000-$3FFF, without side effects
+  uint8_t peekVram(uint16_t address) const;
+
+  /// Re-reads the mapper's CHR banks and mirroring into the page table.
+  /// Call after either changes, having caught up to the change.
+  void remap();
+
+  void loadState(const PPUState &);
+
+  /// For its hit and miss counters
+  const TileCache &tileCache() const { return _tiles; }
+
+private:
+  std::shared_ptr<Rom> rom;
+  Mapper *mapper;
+  TileCache _tiles;
+
+  /// renderEvery as of the start of this frame
+  bool _drawFrame = true;
+  inline bool _drawsFrame() const {
+    return renderEvery != 0 && frames % renderEvery == 0;
+  }
+
+  /// Index into the frame's event table of the next event to fire
+  size_t _event = 0;
+  uint64_t _nextEventCycle = 0;
+
+  void _runEvents(uint64_t target);
+  /// Points _event at the first event at or after cycle
+  void _seekEvent();
+  void _updateDeadline();
+
+  inline bool _renderingEnabled() const { return (mask & 0x18) != 0; }
+  inline uint16_t _increment() const { return control & 0x04 ? 32 : 1; }
+
+  /// $0000-$3FFF in 1 KiB pages: the pattern tables, then the nametables
+  /// and their mirror at $3000. Palette RAM, at $3F00, is handled before
+  /// the lookup.
+  const uint8_t *_readPages[16];
+  /// The same for writes; read-only and unmapped pages are _discarded
+  uint8_t *_writePages[16];
+  uint8_t _discarded[0x400];
+  /// Offset of each pattern table page into the CHR ROM or CHR RAM, or -1
+  /// if unmapped
+  int32_t _chrPages[8];
+
+  /// Any address below $3F00
+  inline uint8_t _vram(uint16_t address) const {
+    return _readPages[address >> 10][address & 0x3FF];
+  }
+  size_t _paletteIndex(uint16_t address) const;
+  /// Offset of a pattern table address into the CHR ROM or CHR RAM, or -1
+  /// if unmapped
+  int32_t _chrOffset(uint16_t address) const;
+  void _pokeVram(uint16_t address, uint8_t value);
+
+  void _renderScanline(int line);
+  /// The flags _renderScanline would set, without any pixels
+  void _skipScanline(int line);
+  /// Pattern row 0-7 of the tile at a CHR offset, as decoded pixels 0-3 one
+  /// per byte, or 0 if offset is -1
+  uint64_t _tileRow(int32_t offset, int row);
+  /// The row of OAM sprite index that line shows, flipped as need be
+  uint64_t _spriteRow(int line, int index);
+  /// Palette indices 0-15 of the background for one line, 0 where
+  /// transparent
+  void _renderBackground(uint8_t *pixels);
+  /// Fills selected with the OAM indices of the sprites on line, in
+  /// priority order, and returns how many there are, at most 8. Sets the
+  /// sprite overflow flag as the hardware would, false positives included.
+  int _evaluateSprites(int line, uint8_t *selected);
+  /// Palette indices 16-31 of the selected sprites for one line, 0 where
+  /// transparent. Bit 5 is set where the sprite is behind the background
+  /// and bit 6 where the pixel is sprite 0's.
+  void _renderSprites(int line, const uint8_t *selected, int count,
+                      uint8_t *pixels);
+  void _incrementY();
+};
+
+} // namespace NESPP
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace NESPP {
+
+class VM;
+
+/// Counts guest executions and cycles per PC address and per opcode.
+///
+/// Attach one to VM::profiler; VM::step then calls record() for every
+/// instruction. Detached, the cost is a single null check per instruction.
+/// The tables are flat arrays (about 1 MiB), so allocate profilers on the
+/// heap.
+class GuestProfiler {
+public:
+  struct Counter {
+    uint64_t count = 0;
+    /// Including page crossing and taken branch penalties
+    uint64_t cycles = 0;
+  };
+
+  /// Indexed by the address of the instruction's opcode byte
+  Counter byAddress[0x10000];
+  /// Indexed by opcode byte
+  Counter byOpCode[0x100];
+
+  inline void record(uint16_t address, uint8_t opCode, uint64_t cycles) {
+    byAddress[address].count += 1;
+    byAddress[address].cycles += cycles;
+    byOpCode[opCode].count += 1;
+    byOpCode[opCode].cycles += cycles;
+  }
+
+  void clear();
+
+  /// Totals over every address
+  Counter total();
+
+  /// Text report of the top hottest addresses by cycles, disassembled from
+  /// vm's current memory, followed by the opcode histogram.
+  std::string report(VM &vm, size_t top = 32);
+};
+
+} // namespace NESPP
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "vm.h"
+
+namespace NESPP {
+
+/// Keyframes of a VM at regular instruction counts, so that any recent
+/// instruction can be reached again by loading the keyframe before it and
+/// stepping forward.
+///
+/// Keyframes live in a ring whose slots are reused, so capturing does not
+/// allocate once the ring has filled.
+class RewindBuffer {
+public:
+  /// interval must be a power of two. The defaults keep about 4 million
+  /// instructions (several seconds of a game). Each keyframe is a VMState,
+  /// about 55 KiB with Mapper0 (14 KiB of it the CPU and PPU, 40 KiB the
+  /// mapper's PRG RAM and PRG copy), so 256 of them take about 14 MiB.
+  RewindBuffer(uint64_t interval = 1 << 14, size_t capacity = 256);
+
+  /// Call after every step; captures a keyframe every interval instructions
+  inline void onStep(VM &vm) {
+    if ((vm.instructions & (interval - 1)) == 0) {
+      capture(vm);
+    }
+  }
+
+  /// Captures a keyframe now, replacing any at or after this instruction
+  void capture(VM &);
+
+  /// Newest keyframe at or before instruction, or nullptr if that is older
+  /// than anything kept
+  const VMState *keyframeAtOrBefore(uint64_t instruction) const;
+
+  /// Drops keyframes after instruction, e.g. once the user has changed
+  /// state so that replaying would no longer reach them
+  void truncate(uint64_t instruction);
+
+  void clear() { count = 0; }
+
+  /// Instruction count of the oldest keyframe, or UINT64_MAX if none
+  uint64_t oldest() const;
+
+  const uint64_t interval;
+
+private:
+  std::vector<VMState> slots;
+  /// Index of the oldest keyframe
+  size_t first = 0;
+  size_t count = 0;
+
+  VMState &_at(size_t i) { return slots[(first + i) % slots.size()]; }
+  const VMState &_at(size_t i) const {
+    return slots[(first + i) % slots.size()];
+  }
+};
+
+} // namespace NESPP
@@ -5,6 +5,8 @@
 
 struct Rom {
   Rom(const char *path);
+  /// Parses an iNES image already in memory; image is copied.
+  Rom(const uint8_t *image, size_t size);
 
   ~Rom();
 
@@ -53,6 +55,8 @@ struct Rom {
   static const int TILES_PER_ROW = SCREEN_WIDTH / TILE_WIDTH;
 
 private:
+  void _parse(const uint8_t *image, size_t size);
+
   inline size_t prgStart();
   inline size_t chrStart();
 };
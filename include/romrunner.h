@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "watch.h"
+
+namespace NESPP {
+
+/// How a test ROM reports its result.
+enum class RomProtocol {
+  /// nestest.nes in automation mode: starts at $C000, error codes in $02/$03
+  nestest,
+  /// blargg-style: $DE $B0 $61 at $6001, status at $6000, text at $6004
+  blargg,
+  /// Neither; only timeouts, idle loops and crashes can be reported
+  unknown,
+};
+
+enum class RomStatus {
+  pass,
+  fail,
+  /// Ran out of cycles before reporting a result
+  timeout,
+  /// Settled into a tight loop without reporting a result
+  idle,
+  /// The emulator threw (e.g. an unimplemented instruction)
+  error,
+};
+
+struct RomRunOptions {
+  /// About 10 seconds of emulated time
+  uint64_t maxCycles = 18'000'000;
+  /// Consecutive idle sampling windows before giving up, 0 disables
+  int idleWindows = 8;
+  /// When positive, profile each ROM and report this many hottest addresses
+  /// in RomResult::profile
+  size_t profileTop = 0;
+  /// Build a call graph of each ROM into RomResult::callGraph and ::folded
+  bool callGraph = false;
+  /// When set, log code/data coverage of each ROM and merge it into
+  /// cdlDirectory/<rom path>.cdl (see romOutputPath), accumulating across
+  /// runs
+  std::string cdlDirectory;
+  /// Where the ROM paths were found, if they were found by scanning a
+  /// directory; per-ROM output files are named relative to it
+  std::string root;
+  /// Draw one frame in renderEvery, see PPU::renderEvery. No result depends
+  /// on pixels, so by default none are drawn.
+  unsigned renderEvery = 0;
+  /// Logged (never halting) watchpoints installed on each ROM's VM, with
+  /// hits reported in RomResult::watchHits
+  std::vector<Watchpoint> watchpoints;
+};
+
+struct RomResult {
+  std::string path;
+  RomProtocol protocol = RomProtocol::unknown;
+  RomStatus status = RomStatus::error;
+  /// Protocol-specific result code ($6000 for blargg, $02/$03 for nestest)
+  int code = -1;
+  /// Text output, or the exception message on error
+  std::string message;
+  uint64_t cycles = 0;
+  uint64_t instructions = 0;
+  double milliseconds = 0;
+  /// GuestProfiler::report, when RomRunOptions::profileTop is set
+  std::string profile;
+  /// CallGraphProfiler::report and ::folded, when RomRunOptions::callGraph
+  /// is set
+  std::string callGraph;
+  std::string folded;
+  /// One WatchHit per line, when RomRunOptions::watchpoints is set
+  std::string watchHits;
+};
+
+RomResult runTestRom(const std::string &path, const RomRunOptions &);
+
+/// Runs every ROM on its own worker, jobs at a time (0 = one per core).
+///
+/// Results are in the same order as paths.
+std::vector<RomResult> runTestRoms(const std::vector<std::string> &paths,
+                                   const RomRunOptions &, unsigned jobs = 0);
+
+/// Where a per-ROM output file goes: under directory, at path's location
+/// relative to root with extension (e.g. ".cdl") as its extension, so that
+/// ROMs with the same name in different directories get different files.
+/// With no root, or a path outside it, it is named by the file name alone.
+/// Creates the file's parent directories.
+std::string romOutputPath(const std::string &directory,
+                          const std::string &root, const std::string &path,
+                          const char *extension);
+
+/// Machine-readable summary of a suite run.
+std::string resultsToJson(const std::vector<RomResult> &);
+
+const char *toString(RomProtocol);
+const char *toString(RomStatus);
+
+} // namespace NESPP
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace NESPP {
+
+class VM;
+
+/// CPU registers plus the RAM bytes a single-step vector cares about.
+struct SingleStepState {
+  uint16_t pc = 0;
+  uint8_t s = 0;
+  uint8_t a = 0;
+  uint8_t x = 0;
+  uint8_t y = 0;
+  uint8_t p = 0;
+  std::vector<std::pair<uint16_t, uint8_t>> ram;
+};
+
+struct SingleStepCycle {
+  uint16_t address;
+  uint8_t value;
+  bool write;
+};
+
+/// One test vector in the widely used single-step JSON layout:
+///
+///   {"name": "a9 23 3a",
+///    "initial": {"pc": .., "s": .., "a": .., "x": .., "y": .., "p": ..,
+///                "ram": [[address, value], ...]},
+///    "final": {...},
+///    "cycles": [[address, value, "read" | "write"], ...]}
+struct SingleStepTest {
+  std::string name;
+  SingleStepState initial;
+  SingleStepState final;
+  std::vector<SingleStepCycle> cycles;
+};
+
+/// Streaming parser for a JSON array of SingleStepTests.
+///
+/// Reads through a fixed buffer and reuses the caller's vectors, so files
+/// with tens of thousands of vectors are never held in memory at once.
+class SingleStepReader {
+public:
+  SingleStepReader(const char *path);
+  ~SingleStepReader();
+
+  /// Returns false after the last vector.
+  bool next(SingleStepTest &);
+
+private:
+  FILE *file;
+  char buffer[1 << 16];
+  size_t length = 0;
+  size_t offset = 0;
+  bool started = false;
+
+  int _peek();
+  int _get();
+  void _skipWhitespace();
+  void _expect(char);
+  void _string(std::string &);
+  uint64_t _number();
+  void _skipValue();
+  void _state(SingleStepState &);
+  void _cycles(std::vector<SingleStepCycle> &);
+  [[noreturn]] void _fail(const char *what);
+};
+
+void writeSingleStepTest(FILE *, const SingleStepTest &, bool first);
+
+/// Runs one vector on a flat-bus VM whose bus is memory.
+///
+/// Registers and final RAM must match. With checkCycles, the cycle count
+/// must also match and every bus access the VM made must appear, in order,
+/// in the vector's cycle list (the VM does not emulate dummy accesses).
+/// On failure returns false and describes the first difference in reason.
+bool runSingleStepTest(VM &vm, uint8_t *memory, const SingleStepTest &,
+                       bool checkCycles, std::string &reason);
+
+/// Builds vectors from a running ROM.
+class SingleStepCapture {
+public:
+  SingleStepCapture();
+  ~SingleStepCapture();
+
+  /// Captures the instruction at vm's PC without disturbing vm.
+  ///
+  /// The instruction is replayed on a flat-bus copy of the CPU-visible
+  /// memory. Returns false if it touches I/O registers, which a flat bus
+  /// cannot represent.
+  bool capture(VM &vm, SingleStepTest &);
+
+private:
+  std::vector<uint8_t> memory;
+  std::unique_ptr<VM> flat;
+  bool romCopied = false;
+};
+
+} // namespace NESPP
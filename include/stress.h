@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace NESPP {
+
+/// Synthetic workloads for benchmarks and fuzzers.
+///
+/// Every workload loops forever, so it can be stepped for as many
+/// instructions as a caller wants. Only opcodes the VM implements are used.
+enum class StressWorkload {
+  /// Dense compares and conditional branches, about two thirds of them taken
+  branchHeavy,
+  /// LDA/STA traffic to zero page
+  zeroPage,
+  /// The same traffic as zeroPage, to absolute RAM addresses
+  absolute,
+  /// JSR/RTS chains size calls deep
+  callChain,
+  /// A vblank wait loop reading $2002
+  ppuPolling,
+};
+
+struct StressParameters {
+  StressWorkload workload = StressWorkload::branchHeavy;
+
+  /// Work per outer loop iteration: blocks of branches or memory accesses,
+  /// call depth (at most 120), or polling reads.
+  int size = 16;
+};
+
+const char *toString(StressWorkload);
+
+/// Returns the assembly source for a workload, see Assembler.
+std::string stressSource(const StressParameters &);
+
+/// Assembles a workload into a complete iNES image.
+std::vector<uint8_t> generateStressRom(const StressParameters &);
+
+} // namespace NESPP
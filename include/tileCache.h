@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace NESPP {
+
+/// Decoded CHR tiles, so that rendering copies pixels rather than decoding
+/// the same tile rows again for every line and every sprite.
+///
+/// Tiles are identified by their byte offset into the CHR they come from.
+/// For CHR ROM that is an offset into Rom::chrBlob, as returned by
+/// Mapper::chrOffset, so the bank a mapper has switched in is part of the
+/// key and switching banks never invalidates anything. CHR ROM cannot
+/// change, so it is all decoded once up front. CHR RAM tiles are decoded on
+/// first use and must be invalidated when the game writes to them.
+class TileCache {
+public:
+  /// chr is not owned and must outlive the cache. size is a multiple of
+  /// Rom::TILE_SIZE. Unless writable, every tile is decoded now.
+  TileCache(const uint8_t *chr, size_t size, bool writable);
+
+  /// The 64 pixels (0-3, row-major) of the tile at offset
+  inline const uint8_t *tile(uint32_t offset) {
+    uint32_t index = offset >> 4;
+    if (!valid[index]) [[unlikely]] {
+      _decode(index);
+      misses += 1;
+    } else {
+      hits += 1;
+    }
+    return pixels.data() + index * 64;
+  }
+
+  /// Call after writing any byte of CHR RAM, at offset
+  inline void invalidate(uint32_t offset) { valid[offset >> 4] = false; }
+  /// Call after replacing CHR RAM wholesale, e.g. loading a state
+  void invalidateAll();
+
+  /// tile() calls answered from the cache, and those that decoded
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+
+private:
+  const uint8_t *chr;
+  bool writable;
+  std::vector<uint8_t> pixels;
+  /// One flag per tile; bytes rather than bits so tile() is one load
+  std::vector<uint8_t> valid;
+
+  void _decode(uint32_t index);
+};
+
+} // namespace NESPP
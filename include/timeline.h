@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace NESPP {
+
+/// One completed span of host wall-clock time.
+struct TimelineEvent {
+  /// Must outlive the timeline, in practice a string literal
+  const char *name;
+  /// Nanoseconds since Timeline::start()
+  uint64_t start;
+  uint64_t duration;
+};
+
+/// Host-side instrumentation, exported in Chrome trace-event format.
+///
+/// Each thread appends to its own fixed-size buffer, so recording takes no
+/// locks; events past a thread's capacity are dropped and counted. While
+/// stopped, a TimelineSpan costs one relaxed atomic load.
+///
+/// Load the exported file in chrome://tracing or https://ui.perfetto.dev.
+namespace Timeline {
+
+/// Starts recording, discarding any previous events.
+void start();
+void stop();
+
+/// Writes every thread's events as Chrome trace-event JSON. Safe to call
+/// while other threads are still recording; their newest spans may be
+/// missing.
+void writeChromeTrace(const char *path);
+
+/// Names the calling thread in the exported trace.
+void setThreadName(const char *name);
+
+/// Nanoseconds since start() on a monotonic clock
+uint64_t now();
+
+void record(const char *name, uint64_t start, uint64_t duration);
+
+extern std::atomic<bool> enabled;
+
+} // namespace Timeline
+
+/// Records the time from construction to destruction, e.g.
+///
+///   {
+///     TimelineSpan span = {"Debugger::render"};
+///     ...
+///   }
+class TimelineSpan {
+public:
+  inline TimelineSpan(const char *name)
+      : name(Timeline::enabled.load(std::memory_order_relaxed) ? name
+                                                               : nullptr) {
+    if (this->name != nullptr) {
+      start = Timeline::now();
+    }
+  }
+
+  inline ~TimelineSpan() {
+    if (name != nullptr) {
+      Timeline::record(name, start, Timeline::now() - start);
+    }
+  }
+
+  TimelineSpan(const TimelineSpan &) = delete;
+  TimelineSpan &operator=(const TimelineSpan &) = delete;
+
+private:
+  const char *name;
+  uint64_t start = 0;
+};
+
+} // namespace NESPP
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+/// Compile-time switch for VM trace events.
+///
+/// Defaults to on for debug builds and off for release (NDEBUG) builds. When
+/// off, the ring buffer is not part of the VM and every trace site compiles
+/// away.
+#ifndef NESPP_TRACE
+#ifdef NDEBUG
+#define NESPP_TRACE 0
+#else
+#define NESPP_TRACE 1
+#endif
+#endif
+
+namespace NESPP {
+
+enum class TraceEventKind : uint8_t {
+  ppuRead, // Read of a PPU register, $2000-$2007
+  apuRead, // Read of an APU or I/O register, $4000-$4017
+  jump,    // Taken branch, JMP or JSR; address is the target
+  nmi,     // NMI taken; address is the handler
+  oamDma,  // OAM DMA; address is the source page
+};
+
+/// A binary trace record. Formatting is deferred to whoever drains the ring.
+struct TraceEvent {
+  uint64_t cycle;
+  /// Address of the instruction that produced the event
+  uint16_t pc;
+  uint16_t address;
+  uint8_t value;
+  TraceEventKind kind;
+
+  /// Writes a NUL-terminated description into buffer, returns its length.
+  size_t format(char *buffer, size_t size) const;
+  std::string toString() const;
+};
+
+/// Fixed-size, lock-free, single-producer single-consumer ring of events.
+///
+/// The VM is the producer. When the consumer falls behind, new events are
+/// dropped (and counted) rather than blocking the interpreter.
+template <size_t Capacity> class TraceRing {
+  static_assert((Capacity & (Capacity - 1)) == 0,
+                "Capacity must be a power of two");
+
+public:
+  bool push(const TraceEvent &event) {
+    size_t head = _head.load(std::memory_order_relaxed);
+    if (head - _tail.load(std::memory_order_acquire) == Capacity) {
+      _dropped.store(_dropped.load(std::memory_order_relaxed) + 1,
+                     std::memory_order_relaxed);
+      return false;
+    }
+    _events[head & (Capacity - 1)] = event;
+    _head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(TraceEvent &event) {
+    size_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail == _head.load(std::memory_order_acquire)) {
+      return false;
+    }
+    event = _events[tail & (Capacity - 1)];
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  size_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+private:
+  alignas(64) std::atomic<size_t> _head = 0;
+  alignas(64) std::atomic<size_t> _tail = 0;
+  std::atomic<size_t> _dropped = 0;
+  std::array<TraceEvent, Capacity> _events;
+};
+
+using TraceBuffer = TraceRing<4096>;
+
+/// Drains trace events into a text file, one line per event.
+class TraceFileSink {
+public:
+  TraceFileSink(const char *path);
+  ~TraceFileSink();
+
+  void drain(TraceBuffer &buffer);
+
+private:
+  FILE *file;
+};
+
+} // namespace NESPP
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "ppu.h"
+
+namespace NESPP {
+
+/// Turns PPU::framebuffer into 32-bit pixels for display or encoding.
+///
+/// Both conversions write PPU::WIDTH * PPU::HEIGHT pixels into a buffer the
+/// caller owns, so a stream of frames allocates nothing. Pixels are bytes
+/// R, G, B, A in memory, whatever the host's endianness.
+///
+/// The colours come from a model of the NES's composite video signal (see
+/// https://www.nesdev.org/wiki/NTSC_video): palette[] is each colour
+/// decoded on its own, and convertNtsc() decodes the whole line, so the
+/// two agree on flat areas of colour.
+class VideoOutput {
+public:
+  VideoOutput();
+
+  /// RGBA for every framebuffer value: a 6-bit colour plus 3 emphasis bits
+  uint32_t palette[512];
+
+  /// Through palette[]; a table lookup per pixel
+  void convert(const uint16_t *framebuffer, uint32_t *rgba) const;
+
+  /// Through a composite signal and back, with the colour fringes and
+  /// blending between neighbouring pixels of a real NTSC NES. Rows are
+  /// split across jobs threads (0 = one per core), the calling thread
+  /// being one of them.
+  void convertNtsc(const uint16_t *framebuffer, uint32_t *rgba,
+                   unsigned jobs = 1) const;
+
+private:
+  /// The decoder is linear and each pixel's 12-sample window takes in only
+  /// its own 8 samples and 2 of each neighbour's, so a pixel's RGB is the
+  /// sum of three contributions: its own, its left neighbour's and its
+  /// right neighbour's. These are those contributions, by framebuffer value
+  /// and by the contributing pixel's phase within the colour subcarrier
+  /// (0, 4 or 8 of 12 samples, divided by 4). The fourth lane is 0.
+  alignas(16) float _own[512][3][4];
+  alignas(16) float _toRight[512][3][4];
+  alignas(16) float _toLeft[512][3][4];
+
+  void _ntscRows(const uint16_t *framebuffer, uint32_t *rgba, int first,
+                 int last) const;
+};
+
+} // namespace NESPP
@@ -3,9 +3,18 @@
 #include <cstdint>
 #include <memory>
 #include <string>
+#include <vector>
 
+#include "callgraph.h"
+#include "cdl.h"
+#include "exectrace.h"
 #include "instructions.h"
+#include "metrics.h"
+#include "ppu.h"
+#include "profiler.h"
 struct Rom; // #include "rom.h"
+#include "trace.h"
+#include "watch.h"
 #include "word.h"
 
 namespace NESPP {
@@ -15,6 +24,25 @@ public:
   virtual ~Mapper() {}
   virtual uint8_t peek16(uint16_t address) = 0;
   virtual void poke16(uint16_t address, uint8_t value) = 0;
+
+  /// Offset into Rom::prgBlob currently mapped at a CPU address, or -1
+  virtual int32_t prgOffset(uint16_t address) = 0;
+  /// Offset into Rom::chrBlob currently mapped at a PPU address, or -1
+  virtual int32_t chrOffset(uint16_t address) = 0;
+  /// Nametable mirroring, as currently selected for mappers that switch it
+  virtual Mirroring mirroring() = 0;
+  /// Whether writes can switch CHR banks or mirroring, so that the VM must
+  /// catch the PPU up before them and PPU::remap after
+  virtual bool remapsVram() { return false; }
+
+  /// The 256 bytes of plain memory backing CPU page $XX00-$XXFF, or null if
+  /// reads there have side effects or are not contiguous. Lets OAM DMA copy
+  /// a page in one go.
+  virtual const uint8_t *memoryPage(uint8_t) { return nullptr; }
+
+  /// Everything writable, for VM::saveState. Reuses out's capacity.
+  virtual void saveState(std::vector<uint8_t> &out) = 0;
+  virtual void loadState(const std::vector<uint8_t> &in) = 0;
 };
 
 class Mapper0 : public Mapper {
@@ -23,17 +51,56 @@ public:
   virtual ~Mapper0();
   virtual uint8_t peek16(uint16_t address);
   virtual void poke16(uint16_t address, uint8_t value);
+  virtual int32_t prgOffset(uint16_t address);
+  virtual int32_t chrOffset(uint16_t address);
+  virtual Mirroring mirroring();
+  virtual const uint8_t *memoryPage(uint8_t page);
+  virtual void saveState(std::vector<uint8_t> &out);
+  virtual void loadState(const std::vector<uint8_t> &in);
 
   std::shared_ptr<Rom> rom;
 
 private:
   // 32 KiB = 32768 = 0x8000
   uint8_t prg[0x8000] = {0};
+
+  /// 8 KiB of PRG-RAM at $6000-$7FFF
+  uint8_t prgRam[0x2000] = {0};
+};
+
+/// A copy of everything that determines how a VM executes from here, e.g.
+/// for rewinding. Copies are cheap enough to take every few thousand
+/// instructions.
+struct VMState {
+  Word PC;
+  uint8_t A;
+  uint8_t X;
+  uint8_t Y;
+  uint8_t SP;
+  uint8_t S;
+  uint64_t cycles;
+  uint64_t instructions;
+  uint8_t ram[2048];
+  uint8_t ppuRegisters[8];
+  uint8_t apuAndIoRegisters[24];
+  PPUState ppu;
+  /// Mapper::saveState
+  std::vector<uint8_t> mapper;
+};
+
+/// One CPU bus access, as logged in flat-bus mode
+struct BusAccess {
+  uint16_t address;
+  uint8_t value;
+  bool write;
 };
 
 class VM {
 public:
   VM(std::shared_ptr<Rom> rom);
+  /// Bare CPU on a flat 64 KiB bus instead of the NES memory map, for
+  /// conformance testing. flatBus is not owned.
+  VM(uint8_t *flatBus);
   ~VM();
 
   // registers
@@ -63,22 +130,77 @@ public:
   /// +--------- Negative
   uint8_t S = 1 << 5;
 
+  /// CPU cycles elapsed since power on
+  uint64_t cycles = 0;
+
+  /// Instructions completed by step() since power on. Execution is
+  /// deterministic, so this names a point in a run exactly.
+  uint64_t instructions = 0;
+
+#if NESPP_TRACE
+  /// Drained by whoever wants to display or persist the events
+  TraceBuffer trace;
+#endif
+
+#if NESPP_METRICS
+  /// Published by Metrics::prometheusText
+  VMMetrics metrics;
+#endif
+
   // Memory
 
   /// Mapped from $0000-$07FF, with 3 mirrors from $0800-$1FF
   uint8_t ram[2048] = {0};
 
-  /// Mapped from $2000-$2007
+  /// The last value written to each of $2000-$2007, for display; the
+  /// registers themselves are in ppu
   uint8_t ppuRegisters[8] = {0};
   uint8_t apuAndIoRegisters[24] = {0};
 
+  /// Mapped from $2000-$3FFF. Owned; null in flat-bus mode.
+  PPU *ppu = nullptr;
+
+  /// Optional per-instruction recorder, not owned
+  ExecutionTraceRecorder *recorder = nullptr;
+
+  /// Optional per-instruction profiler, not owned
+  GuestProfiler *profiler = nullptr;
+
+  /// Optional call graph profiler, not owned
+  CallGraphProfiler *callGraph = nullptr;
+
+  /// Optional code/data logger for the mapped ROM, not owned
+  CodeDataLogger *cdl = nullptr;
+
+  /// Optional watchpoints, not owned. Leave null rather than empty when
+  /// there are none, so the bus skips even the page test.
+  WatchpointSet *watchpoints = nullptr;
+
+  /// Every access in flat-bus mode, in order; cleared by the caller
+  std::vector<BusAccess> busLog;
+
   // Methods
   void start();
 
+  /// Decode and execute a single instruction, returning it
+  Instruction step();
+
+  /// Soft reset: jump through the reset vector like the console's button
+  void reset();
+
+  /// Not supported in flat-bus mode
+  void saveState(VMState &) const;
+  void loadState(const VMState &);
+
   uint8_t peek(Word address);
   uint8_t peek8(uint8_t offset);
   uint8_t peek16(uint16_t address);
 
+  /// What peek16 would return, without side effects on I/O registers,
+  /// counters, logs or watchpoints. For debuggers. Mapper space without
+  /// plain memory behind it (see Mapper::memoryPage) reads as 0.
+  uint8_t inspect(uint16_t address);
+
   void poke(Word address, uint8_t value);
   void poke16(uint16_t address, uint8_t value);
 
@@ -88,7 +210,24 @@ public:
 private:
   std::shared_ptr<Rom> rom;
 
-  Mapper *mapper;
+  Mapper *mapper = nullptr;
+
+  uint8_t *_flatBus = nullptr;
+
+  /// Address of the most recently decoded instruction
+  uint16_t _instructionAddress = 0;
+  /// Opcode byte of the most recently decoded instruction
+  uint8_t _instructionOpCode = 0;
+
+  /// Set while decodeInstruction fetches, so the CDL can tell fetches from
+  /// data reads
+  bool _fetching = false;
+
+  /// ppu->frames already added to metrics.frames
+  uint64_t _framesCounted = 0;
+  /// Tile cache counters already added to metrics
+  uint64_t _tileHitsCounted = 0;
+  uint64_t _tileMissesCounted = 0;
 
   /// Negative bitmask
   static constexpr uint8_t _N = 1 << 7;
@@ -119,12 +258,36 @@ private:
   inline bool _getZ();
   inline bool _getC();
 
+  inline void _branch(Instruction);
+  inline void _trace(TraceEventKind, uint16_t address, uint8_t value);
+  inline void _countBus(BusRegion, bool write);
+
+  /// The bus itself; peek16 and poke16 add watchpoints on top
+  inline uint8_t _peek16(uint16_t address);
+  inline void _poke16(uint16_t address, uint8_t value);
+  uint8_t _watchedPeek16(uint16_t address);
+  void _watchedPoke16(uint16_t address, uint8_t value);
+
+  /// Brings the PPU up to the current cycle
+  inline void _catchUpPpu();
+  /// Catches up and takes a pending NMI; called once cycles passes
+  /// ppu->deadline
+  void _syncPpu();
+  uint8_t _ppuRead(uint8_t reg);
+  void _ppuWrite(uint8_t reg, uint8_t value);
+  /// Copies a CPU page into OAM for a write to $4014, and stalls the CPU
+  void _oamDma(uint8_t page);
+  void _interrupt(uint16_t vector);
+
   void _push(uint8_t);
   void _pushWord(Word);
 
   uint8_t _pop();
   Word _popWord();
 
+  void _record(uint16_t address);
+  void _logCode(uint16_t address);
+
   uint8_t _operandToValue(Instruction);
   Word _operandToAddress(Instruction);
 
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace NESPP {
+
+/// Which bus a watchpoint's addresses belong to
+enum class WatchSpace : uint8_t {
+  cpu,
+  /// PPU address space, $0000-$3FFF
+  vram,
+};
+
+/// Bit flags for Watchpoint::kinds
+namespace WatchKind {
+constexpr uint8_t read = 1 << 0;
+constexpr uint8_t write = 1 << 1;
+/// A write that stores a different value than was there
+constexpr uint8_t change = 1 << 2;
+} // namespace WatchKind
+
+enum class WatchAction : uint8_t {
+  /// Stop at the end of the instruction, see WatchpointSet::halted
+  halt,
+  /// Append to WatchpointSet::hits and keep going
+  log,
+};
+
+struct Watchpoint {
+  /// Assigned by WatchpointSet::add
+  uint32_t id = 0;
+  WatchSpace space = WatchSpace::cpu;
+  /// Inclusive range
+  uint16_t first = 0;
+  uint16_t last = 0;
+  uint8_t kinds = WatchKind::write;
+  WatchAction action = WatchAction::halt;
+
+  std::string toString() const;
+};
+
+/// Parses "[vram:]XXXX[-YYYY][:rwc]", e.g. "0300-03FF:c" or "vram:2000:w".
+/// Kinds default to writes. Throws std::runtime_error on malformed input.
+Watchpoint parseWatchpoint(const char *spec, WatchAction);
+
+struct WatchHit {
+  uint32_t id;
+  /// Address of the instruction that made the access
+  uint16_t pc;
+  uint16_t address;
+  uint8_t oldValue;
+  uint8_t value;
+  bool write;
+  WatchSpace space;
+  uint64_t cycle;
+
+  /// Writes a NUL-terminated description into buffer, returns its length.
+  size_t format(char *buffer, size_t size) const;
+  std::string toString() const;
+};
+
+/// Watchpoints on one VM.
+///
+/// The bus only calls check() for addresses on a page (256 bytes) that some
+/// watchpoint covers, so unwatched pages pay one bitmap test.
+class WatchpointSet {
+public:
+  /// Logged hits kept before further ones are only counted
+  static constexpr size_t HIT_LIMIT = 4096;
+
+  /// Returns the new watchpoint's id
+  uint32_t add(Watchpoint);
+  /// Returns false if there is no such watchpoint
+  bool remove(uint32_t id);
+  bool empty() const { return watchpoints.empty(); }
+  const std::vector<Watchpoint> &list() const { return watchpoints; }
+
+  inline bool watched(WatchSpace space, uint16_t address) const {
+    return pages[static_cast<int>(space)].test((address >> 8) & 0xFF);
+  }
+
+  /// Matches an access against every watchpoint. For reads oldValue and
+  /// value are the same.
+  void check(WatchSpace, bool write, uint16_t address, uint8_t oldValue,
+             uint8_t value, uint16_t pc, uint64_t cycle);
+
+  /// The first hit of a halting watchpoint; the caller clears it once it has
+  /// stopped
+  std::optional<WatchHit> halted;
+  /// Hits of logging watchpoints, oldest first; drained by the caller
+  std::vector<WatchHit> hits;
+  uint64_t droppedHits = 0;
+
+private:
+  std::vector<Watchpoint> watchpoints;
+  std::bitset<256> pages[2];
+  uint32_t nextId = 1;
+
+  void _rebuildPages();
+};
+
+} // namespace NESPP
@@ -0,0 +1,348 @@
+#include "../include/assembler.h"
+#include "../include/instructions.h" // for opCodeLookup, opCodeNameLookup
+#include "../include/rom.h"          // for Rom::HEADER_SIZE
+#include <cctype>  // for isalnum, toupper
+#include <cstdlib> // for strtoul
+#include <format>
+#include <stdexcept> // std::runtime_error
+
+namespace NESPP {
+
+namespace {
+
+std::string_view _trim(std::string_view text) {
+  size_t start = text.find_first_not_of(" \t\r");
+  if (start == std::string_view::npos) {
+    return {};
+  }
+  size_t end = text.find_last_not_of(" \t\r");
+  return text.substr(start, end - start + 1);
+}
+
+bool _isIdentifierChar(char c) {
+  return isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+/// An operand expression: either a number or a label reference
+struct _Value {
+  bool isLabel = false;
+  uint32_t number = 0;
+  std::string label;
+};
+
+} // namespace
+
+int opCodeFor(OpCodeType type, AddressingMode mode) {
+  return opCodeByteLookup[static_cast<int>(type)][static_cast<int>(mode)];
+}
+
+OpCodeType opCodeTypeFor(std::string_view mnemonic) {
+  std::string upper;
+  for (char c : mnemonic) {
+    upper.push_back(toupper(static_cast<unsigned char>(c)));
+  }
+  for (int i = 0; i < 256; i++) {
+    if (opCodeLookup[i].type != OpCodeType::unimplemented &&
+        upper == opCodeNameLookup[i]) {
+      return opCodeLookup[i].type;
+    }
+  }
+  return OpCodeType::unimplemented;
+}
+
+Assembler::Assembler(uint16_t origin) : origin(origin) {}
+
+uint16_t Assembler::here() { return origin + code.size(); }
+
+uint16_t Assembler::address(const std::string &name) {
+  auto found = labels.find(name);
+  if (found == labels.end()) {
+    _fail(std::format("Undefined label \"{}\"", name));
+  }
+  return found->second;
+}
+
+void Assembler::_fail(const std::string &message) {
+  if (line > 0) {
+    throw std::runtime_error(std::format("line {}: {}", line, message));
+  }
+  throw std::runtime_error(message);
+}
+
+void Assembler::label(const std::string &name) {
+  if (!labels.emplace(name, here()).second) {
+    _fail(std::format("Duplicate label \"{}\"", name));
+  }
+}
+
+void Assembler::_opcode(OpCodeType type, AddressingMode mode) {
+  int opcode = opCodeFor(type, mode);
+  if (opcode == -1) {
+    _fail("Addressing mode not implemented for this instruction");
+  }
+  code.push_back(opcode);
+}
+
+void Assembler::emit(OpCodeType type, AddressingMode mode, uint16_t operand) {
+  _opcode(type, mode);
+  using enum AddressingMode;
+  switch (mode) {
+  case implied:
+  case accumulator:
+    return;
+  case immediate:
+  case zeropage:
+    code.push_back(operand & 0xFF);
+    return;
+  case relative: {
+    // operand is the branch target
+    int offset = operand - (here() + 1);
+    if (offset < -128 || offset > 127) {
+      _fail(std::format("Branch target ${:04X} out of range", operand));
+    }
+    code.push_back(static_cast<uint8_t>(offset));
+    return;
+  }
+  case absolute:
+  case indirect:
+    word(operand);
+    return;
+  }
+}
+
+void Assembler::emit(OpCodeType type, AddressingMode mode,
+                     const std::string &target) {
+  _opcode(type, mode);
+  using enum AddressingMode;
+  switch (mode) {
+  case immediate:
+    fixups.push_back({code.size(), target, _FixupKind::low, line});
+    code.push_back(0);
+    return;
+  case relative:
+    fixups.push_back({code.size(), target, _FixupKind::relative, line});
+    code.push_back(0);
+    return;
+  case absolute:
+  case indirect:
+    word(target);
+    return;
+  case implied:
+  case accumulator:
+  case zeropage:
+    _fail("Labels can not be used with this addressing mode");
+  }
+}
+
+void Assembler::byte(uint8_t value) { code.push_back(value); }
+
+void Assembler::word(uint16_t value) {
+  code.push_back(value & 0xFF);
+  code.push_back(value >> 8);
+}
+
+void Assembler::word(const std::string &target) {
+  fixups.push_back({code.size(), target, _FixupKind::word, line});
+  word(static_cast<uint16_t>(0));
+}
+
+void Assembler::assemble(std::string_view source) {
+  while (!source.empty()) {
+    size_t end = source.find('\n');
+    line += 1;
+    _line(source.substr(0, end));
+    source = end == std::string_view::npos ? "" : source.substr(end + 1);
+  }
+}
+
+void Assembler::_line(std::string_view text) {
+  text = _trim(text.substr(0, text.find(';')));
+
+  // Any number of leading labels
+  while (true) {
+    size_t length = 0;
+    while (length < text.size() && _isIdentifierChar(text[length])) {
+      length += 1;
+    }
+    if (length == 0 || length >= text.size() || text[length] != ':') {
+      break;
+    }
+    label(std::string(text.substr(0, length)));
+    text = _trim(text.substr(length + 1));
+  }
+  if (text.empty()) {
+    return;
+  }
+
+  size_t split = text.find_first_of(" \t");
+  std::string_view mnemonic = text.substr(0, split);
+  std::string_view operand =
+      split == std::string_view::npos ? "" : _trim(text.substr(split));
+
+  auto parseValue = [this](std::string_view expression) {
+    expression = _trim(expression);
+    _Value value;
+    if (expression.empty()) {
+      _fail("Missing operand");
+    }
+    std::string digits;
+    int base = 10;
+    if (expression[0] == '$') {
+      base = 16;
+      digits = expression.substr(1);
+    } else if (expression[0] == '%') {
+      base = 2;
+      digits = expression.substr(1);
+    } else if (isdigit(static_cast<unsigned char>(expression[0]))) {
+      digits = expression;
+    } else {
+      for (char c : expression) {
+        if (!_isIdentifierChar(c)) {
+          _fail(std::format("Bad label \"{}\"", expression));
+        }
+      }
+      value.isLabel = true;
+      value.label = expression;
+      return value;
+    }
+    char *end;
+    value.number = strtoul(digits.data(), &end, base);
+    if (digits.empty() || *end != '\0' || value.number > 0xFFFF) {
+      _fail(std::format("Bad number \"{}\"", expression));
+    }
+    return value;
+  };
+
+  if (mnemonic == ".byte" || mnemonic == ".word") {
+    while (!operand.empty()) {
+      size_t comma = operand.find(',');
+      _Value value = parseValue(operand.substr(0, comma));
+      if (mnemonic == ".word") {
+        value.isLabel ? word(value.label) : word(value.number);
+      } else if (value.isLabel || value.number > 0xFF) {
+        _fail(".byte values must be numbers up to $FF");
+      } else {
+        byte(value.number);
+      }
+      operand = comma == std::string_view::npos ? "" : operand.substr(comma + 1);
+    }
+    return;
+  } else if (mnemonic[0] == '.') {
+    _fail(std::format("Unknown directive {}", mnemonic));
+  }
+
+  OpCodeType type = opCodeTypeFor(mnemonic);
+  if (type == OpCodeType::unimplemented) {
+    _fail(std::format("Unknown or unimplemented mnemonic {}", mnemonic));
+  }
+  using enum AddressingMode;
+  auto has = [type](AddressingMode mode) {
+    return opCodeFor(type, mode) != -1;
+  };
+
+  if (operand.empty()) {
+    emit(type, has(implied) ? implied : accumulator);
+  } else if (operand == "A" || operand == "a") {
+    emit(type, accumulator);
+  } else if (operand[0] == '#') {
+    operand = _trim(operand.substr(1));
+    bool high = !operand.empty() && operand[0] == '>';
+    bool low = !operand.empty() && operand[0] == '<';
+    _Value value = parseValue((high || low) ? operand.substr(1) : operand);
+    if (value.isLabel) {
+      emit(type, immediate, value.label);
+      if (high) {
+        fixups.back().kind = _FixupKind::high;
+      }
+    } else {
+      uint16_t number = value.number;
+      if (!high && !low && number > 0xFF) {
+        _fail("Immediate value out of range");
+      }
+      emit(type, immediate, high ? number >> 8 : number & 0xFF);
+    }
+  } else if (operand[0] == '(') {
+    if (operand.back() != ')') {
+      _fail("Only (address) indirect operands are supported");
+    }
+    _Value value = parseValue(operand.substr(1, operand.size() - 2));
+    value.isLabel ? emit(type, indirect, value.label)
+                  : emit(type, indirect, value.number);
+  } else {
+    _Value value = parseValue(operand);
+    if (has(relative)) {
+      value.isLabel ? emit(type, relative, value.label)
+                    : emit(type, relative, value.number);
+    } else if (value.isLabel) {
+      emit(type, absolute, value.label);
+    } else if (value.number <= 0xFF && has(zeropage)) {
+      emit(type, zeropage, value.number);
+    } else {
+      emit(type, absolute, value.number);
+    }
+  }
+}
+
+std::vector<uint8_t> Assembler::link() {
+  int savedLine = line;
+  for (const _Fixup &fixup : fixups) {
+    line = fixup.line;
+    uint16_t target = address(fixup.label);
+    switch (fixup.kind) {
+    case _FixupKind::low:
+      code[fixup.offset] = target & 0xFF;
+      break;
+    case _FixupKind::high:
+      code[fixup.offset] = target >> 8;
+      break;
+    case _FixupKind::word:
+      code[fixup.offset] = target & 0xFF;
+      code[fixup.offset + 1] = target >> 8;
+      break;
+    case _FixupKind::relative: {
+      int offset = target - (origin + fixup.offset + 1);
+      if (offset < -128 || offset > 127) {
+        _fail(std::format("Branch to \"{}\" out of range", fixup.label));
+      }
+      code[fixup.offset] = static_cast<uint8_t>(offset);
+      break;
+    }
+    }
+  }
+  line = savedLine;
+  return code;
+}
+
+std::vector<uint8_t> buildINes(const std::vector<uint8_t> &prg, uint16_t reset,
+                               uint16_t nmi, uint16_t irq,
+                               const std::vector<uint8_t> &chr) {
+  size_t prgSize = prg.size() <= 0x4000 - 6 ? 0x4000 : 0x8000;
+  if (prg.size() > prgSize - 6) {
+    throw std::runtime_error(
+        std::format("PRG of {} bytes overlaps the vectors", prg.size()));
+  }
+  size_t chrSize = ((chr.size() + 0x1FFF) / 0x2000) * 0x2000;
+  if (chrSize == 0) {
+    chrSize = 0x2000;
+  }
+
+  std::vector<uint8_t> image(Rom::HEADER_SIZE + prgSize + chrSize);
+  image[0] = 'N';
+  image[1] = 'E';
+  image[2] = 'S';
+  image[3] = 0x1A;
+  image[4] = prgSize / 0x4000;
+  image[5] = chrSize / 0x2000;
+
+  uint8_t *prgStart = image.data() + Rom::HEADER_SIZE;
+  std::copy(prg.begin(), prg.end(), prgStart);
+  uint16_t vectors[] = {nmi, reset, irq};
+  for (int i = 0; i < 3; i++) {
+    prgStart[prgSize - 6 + 2 * i] = vectors[i] & 0xFF;
+    prgStart[prgSize - 5 + 2 * i] = vectors[i] >> 8;
+  }
+  std::copy(chr.begin(), chr.end(), prgStart + prgSize);
+  return image;
+}
+
+} // namespace NESPP
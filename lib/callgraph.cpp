@@ -0,0 +1,121 @@
+#include "../include/callgraph.h"
+#include <algorithm> // std::partial_sort
+#include <format>
+
+namespace NESPP {
+
+CallGraphProfiler::CallGraphProfiler() {
+  nodes.push_back({.routine = 0, .parent = 0});
+}
+
+void CallGraphProfiler::_enter(uint16_t routine, uint8_t sp,
+                               uint8_t returnSize) {
+  if (depth == _MAX_DEPTH) {
+    // The callee's cycles stay with the caller
+    droppedCalls += 1;
+    return;
+  }
+  routines[routine].calls += 1;
+  active[routine] += 1;
+  current = _child(current, routine);
+  nodes[current].calls += 1;
+  frames[depth++] = {
+      .routine = routine,
+      .sp = sp,
+      .returnSize = returnSize,
+      .node = current,
+      .startCycles = totalCycles,
+  };
+}
+
+void CallGraphProfiler::_leave() {
+  const _Frame &frame = frames[--depth];
+  active[frame.routine] -= 1;
+  if (active[frame.routine] == 0) {
+    routines[frame.routine].inclusiveCycles +=
+        totalCycles - frame.startCycles;
+  }
+  current = depth == 0 ? 0 : frames[depth - 1].node;
+}
+
+uint32_t CallGraphProfiler::_child(uint32_t parent, uint16_t routine) {
+  uint32_t last = 0;
+  for (uint32_t child = nodes[parent].firstChild; child != 0;
+       child = nodes[child].nextSibling) {
+    if (nodes[child].routine == routine) {
+      return child;
+    }
+    last = child;
+  }
+  uint32_t child = nodes.size();
+  nodes.push_back({.routine = routine, .parent = parent});
+  if (last == 0) {
+    nodes[parent].firstChild = child;
+  } else {
+    nodes[last].nextSibling = child;
+  }
+  return child;
+}
+
+CallGraphProfiler::Routine CallGraphProfiler::routine(uint16_t address) {
+  Routine result = routines[address];
+  // Only the outermost open activation contributes
+  for (size_t i = 0; i < depth; i++) {
+    if (frames[i].routine == address) {
+      result.inclusiveCycles += totalCycles - frames[i].startCycles;
+      break;
+    }
+  }
+  return result;
+}
+
+std::string CallGraphProfiler::report(size_t top) {
+  std::vector<std::pair<uint16_t, Routine>> called;
+  for (uint32_t address = 0; address < 0x10000; address++) {
+    if (routines[address].calls > 0) {
+      called.emplace_back(address, routine(address));
+    }
+  }
+  top = std::min(top, called.size());
+  std::partial_sort(called.begin(), called.begin() + top, called.end(),
+                    [](auto &a, auto &b) {
+                      return a.second.inclusiveCycles >
+                             b.second.inclusiveCycles;
+                    });
+
+  double percentScale = totalCycles == 0 ? 0 : 100.0 / totalCycles;
+  std::string out = std::format(
+      "{} cycles, {} outside subroutines, {} routines, {} untracked calls\n\n",
+      totalCycles, rootCycles, called.size(), droppedCalls);
+  out += "   inclusive       %         self       %        calls  routine\n";
+  for (size_t i = 0; i < top; i++) {
+    auto &[address, stats] = called[i];
+    out += std::format("{:12} {:6.2f}% {:12} {:6.2f}% {:12}  ${:04X}\n",
+                       stats.inclusiveCycles,
+                       stats.inclusiveCycles * percentScale, stats.selfCycles,
+                       stats.selfCycles * percentScale, stats.calls, address);
+  }
+  return out;
+}
+
+std::string CallGraphProfiler::folded() {
+  std::string out;
+  std::vector<uint32_t> path;
+  for (uint32_t node = 0; node < nodes.size(); node++) {
+    if (nodes[node].selfCycles == 0) {
+      continue;
+    }
+    path.clear();
+    for (uint32_t n = node; n != 0; n = nodes[n].parent) {
+      path.push_back(n);
+    }
+    out += "root";
+    for (auto n = path.rbegin(); n != path.rend(); n++) {
+      out += std::format(";${:04X}", nodes[*n].routine);
+    }
+    out += std::format(" {}\n", nodes[node].selfCycles);
+  }
+  return out;
+}
+
+} // namespace NESPP
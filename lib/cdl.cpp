@@ -0,0 +1,192 @@
+#include "../include/cdl.h"
+#include <algorithm> // std::min, std::max
+#include <atomic>
+#include <bit>     // std::popcount
+#include <cstdio>  // for fopen, fread, fwrite
+#include <cstring> // for memcmp
+#include <exception>
+#include <format>
+#include <optional>
+#include <stdexcept> // std::runtime_error
+#include <thread>
+
+namespace NESPP {
+
+namespace {
+
+constexpr char MAGIC[8] = {'N', 'E', 'S', 'C', 'D', 'L', 1, 0};
+
+size_t _words(size_t bytes) { return (bytes + 63) / 64; }
+
+void _writeU32(uint8_t *dst, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    dst[i] = value >> (8 * i);
+  }
+}
+
+uint32_t _readU32(const uint8_t *src) {
+  return src[0] | (src[1] << 8) | (src[2] << 16) |
+         (static_cast<uint32_t>(src[3]) << 24);
+}
+
+void _writeBits(FILE *file, const std::vector<uint64_t> &bits) {
+  std::vector<uint8_t> bytes(bits.size() * 8);
+  for (size_t i = 0; i < bits.size(); i++) {
+    for (int j = 0; j < 8; j++) {
+      bytes[i * 8 + j] = bits[i] >> (8 * j);
+    }
+  }
+  fwrite(bytes.data(), bytes.size(), 1, file);
+}
+
+bool _readBits(FILE *file, std::vector<uint64_t> &bits) {
+  std::vector<uint8_t> bytes(bits.size() * 8);
+  if (!bytes.empty() && fread(bytes.data(), bytes.size(), 1, file) != 1) {
+    return false;
+  }
+  for (size_t i = 0; i < bits.size(); i++) {
+    uint64_t word = 0;
+    for (int j = 0; j < 8; j++) {
+      word |= static_cast<uint64_t>(bytes[i * 8 + j]) << (8 * j);
+    }
+    bits[i] = word;
+  }
+  return true;
+}
+
+size_t _count(const std::vector<uint64_t> &bits) {
+  size_t count = 0;
+  for (uint64_t word : bits) {
+    count += std::popcount(word);
+  }
+  return count;
+}
+
+} // namespace
+
+CodeDataLogger::CodeDataLogger(size_t prgSize, size_t chrSize)
+    : prgSize(prgSize), chrSize(chrSize), opCodes(_words(prgSize)),
+      operands(_words(prgSize)), data(_words(prgSize)),
+      rendered(_words(chrSize)) {}
+
+CodeDataLogger::CodeDataLogger(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (file == nullptr) {
+    throw std::runtime_error(std::format("Failed to open {}", path));
+  }
+  uint8_t header[sizeof(MAGIC) + 8];
+  bool ok = fread(header, sizeof(header), 1, file) == 1 &&
+            memcmp(header, MAGIC, sizeof(MAGIC)) == 0;
+  if (ok) {
+    prgSize = _readU32(header + sizeof(MAGIC));
+    chrSize = _readU32(header + sizeof(MAGIC) + 4);
+    opCodes.resize(_words(prgSize));
+    operands.resize(_words(prgSize));
+    data.resize(_words(prgSize));
+    rendered.resize(_words(chrSize));
+    ok = _readBits(file, opCodes) && _readBits(file, operands) &&
+         _readBits(file, data) && _readBits(file, rendered);
+  }
+  fclose(file);
+  if (!ok) {
+    throw std::runtime_error(std::format("{} is not a code/data log", path));
+  }
+}
+
+void CodeDataLogger::merge(const CodeDataLogger &other) {
+  if (other.prgSize != prgSize || other.chrSize != chrSize) {
+    throw std::runtime_error("Can not merge code/data logs of different ROMs");
+  }
+  for (size_t i = 0; i < opCodes.size(); i++) {
+    opCodes[i] |= other.opCodes[i];
+    operands[i] |= other.operands[i];
+    data[i] |= other.data[i];
+  }
+  for (size_t i = 0; i < rendered.size(); i++) {
+    rendered[i] |= other.rendered[i];
+  }
+}
+
+void CodeDataLogger::save(const char *path) {
+  FILE *file = fopen(path, "wb");
+  if (file == nullptr) {
+    throw std::runtime_error(std::format("Failed to open {}", path));
+  }
+  uint8_t header[sizeof(MAGIC) + 8];
+  memcpy(header, MAGIC, sizeof(MAGIC));
+  _writeU32(header + sizeof(MAGIC), prgSize);
+  _writeU32(header + sizeof(MAGIC) + 4, chrSize);
+  fwrite(header, sizeof(header), 1, file);
+  _writeBits(file, opCodes);
+  _writeBits(file, operands);
+  _writeBits(file, data);
+  _writeBits(file, rendered);
+  fclose(file);
+}
+
+CodeDataLogger::Coverage CodeDataLogger::coverage() {
+  Coverage coverage;
+  coverage.opCodes = _count(opCodes);
+  coverage.operands = _count(operands);
+  coverage.data = _count(data);
+  coverage.rendered = _count(rendered);
+  for (size_t i = 0; i < opCodes.size(); i++) {
+    coverage.prg += std::popcount(opCodes[i] | operands[i] | data[i]);
+  }
+  return coverage;
+}
+
+CodeDataLogger mergeCodeDataLogs(const std::vector<std::string> &paths,
+                                 unsigned jobs) {
+  if (paths.empty()) {
+    throw std::runtime_error("No code/data logs to merge");
+  }
+  if (jobs == 0) {
+    jobs = std::max(1u, std::thread::hardware_concurrency());
+  }
+  jobs = std::min<size_t>(jobs, paths.size());
+
+  // Each worker folds its share into a partial log; partials are merged last
+  std::vector<std::optional<CodeDataLogger>> partials(jobs);
+  std::vector<std::exception_ptr> errors(jobs);
+  std::atomic<size_t> next = 0;
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < jobs; i++) {
+    workers.emplace_back([&, i] {
+      try {
+        for (size_t j = next++; j < paths.size(); j = next++) {
+          CodeDataLogger log = {paths[j].data()};
+          if (partials[i]) {
+            partials[i]->merge(log);
+          } else {
+            partials[i].emplace(std::move(log));
+          }
+        }
+      } catch (...) {
+        errors[i] = std::current_exception();
+      }
+    });
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  for (auto &error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+  std::optional<CodeDataLogger> merged;
+  for (auto &partial : partials) {
+    if (!partial) {
+      continue;
+    } else if (merged) {
+      merged->merge(*partial);
+    } else {
+      merged = std::move(partial);
+    }
+  }
+  return std::move(*merged);
+}
+
+} // namespace NESPP
@@ -0,0 +1,139 @@
+#include "../include/chr.h"
+#include <array>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace NESPP {
+
+namespace {
+
+constexpr uint64_t _BROADCAST = 0x0101010101010101;
+
+consteval std::array<uint8_t, 256> _buildReverse() {
+  std::array<uint8_t, 256> table = {};
+  for (int i = 0; i < 256; i++) {
+    for (int bit = 0; bit < 8; bit++) {
+      table[i] |= ((i >> bit) & 1) << (7 - bit);
+    }
+  }
+  return table;
+}
+
+/// Bits in reverse order, for horizontal flips
+constexpr std::array<uint8_t, 256> _REVERSE = _buildReverse();
+
+consteval std::array<uint64_t, 256> _buildSpread() {
+  std::array<uint64_t, 256> table = {};
+  for (int i = 0; i < 256; i++) {
+    for (int x = 0; x < 8; x++) {
+      table[i] |= static_cast<uint64_t>((i >> (7 - x)) & 1) << (x * 8);
+    }
+  }
+  return table;
+}
+
+/// A plane byte spread out to one pixel per byte, leftmost (most
+/// significant bit) in the lowest byte
+constexpr std::array<uint64_t, 256> _SPREAD = _buildSpread();
+
+/// Eight pixels in a 64-bit word, for when there is no SIMD or fewer than
+/// a vector's worth of rows are left
+inline uint64_t _decodeRow(uint8_t low, uint8_t high, uint8_t attribute) {
+  return colourRow(_SPREAD[low] | (_SPREAD[high] << 1), attribute);
+}
+
+} // namespace
+
+void decodeTileRows(const uint8_t *low, const uint8_t *high,
+                    const uint8_t *attributes, size_t count, uint8_t *pixels,
+                    bool flip) {
+  // Flips reverse the plane bytes; the kernels then work as usual
+  auto plane = [flip](const uint8_t *bytes, size_t i) -> uint64_t {
+    return flip ? _REVERSE[bytes[i]] : bytes[i];
+  };
+  auto attribute = [attributes](size_t i) -> uint64_t {
+    return attributes == nullptr ? 0 : attributes[i];
+  };
+
+  size_t i = 0;
+#if defined(__AVX2__)
+  {
+    // Leftmost pixel is the most significant bit
+    const __m256i bits = _mm256_setr_epi8(
+        -128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1, -128, 64,
+        32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i two = _mm256_set1_epi8(2);
+    for (; i + 4 <= count; i += 4) {
+      __m256i plane0 = _mm256_set_epi64x(
+          plane(low, i + 3) * _BROADCAST, plane(low, i + 2) * _BROADCAST,
+          plane(low, i + 1) * _BROADCAST, plane(low, i) * _BROADCAST);
+      __m256i plane1 = _mm256_set_epi64x(
+          plane(high, i + 3) * _BROADCAST, plane(high, i + 2) * _BROADCAST,
+          plane(high, i + 1) * _BROADCAST, plane(high, i) * _BROADCAST);
+      // 0xFF in each pixel whose bit is set
+      plane0 = _mm256_cmpeq_epi8(_mm256_and_si256(plane0, bits), bits);
+      plane1 = _mm256_cmpeq_epi8(_mm256_and_si256(plane1, bits), bits);
+      __m256i colours = _mm256_or_si256(_mm256_and_si256(plane0, one),
+                                        _mm256_and_si256(plane1, two));
+      __m256i opaque = _mm256_or_si256(plane0, plane1);
+      __m256i palette = _mm256_set_epi64x(
+          attribute(i + 3) * _BROADCAST, attribute(i + 2) * _BROADCAST,
+          attribute(i + 1) * _BROADCAST, attribute(i) * _BROADCAST);
+      __m256i result =
+          _mm256_or_si256(colours, _mm256_and_si256(palette, opaque));
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(pixels + i * 8),
+                          result);
+    }
+  }
+#endif
+#if defined(__SSE2__)
+  {
+    const __m128i bits = _mm_setr_epi8(-128, 64, 32, 16, 8, 4, 2, 1, -128, 64,
+                                       32, 16, 8, 4, 2, 1);
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i two = _mm_set1_epi8(2);
+    for (; i + 2 <= count; i += 2) {
+      __m128i plane0 = _mm_set_epi64x(plane(low, i + 1) * _BROADCAST,
+                                      plane(low, i) * _BROADCAST);
+      __m128i plane1 = _mm_set_epi64x(plane(high, i + 1) * _BROADCAST,
+                                      plane(high, i) * _BROADCAST);
+      plane0 = _mm_cmpeq_epi8(_mm_and_si128(plane0, bits), bits);
+      plane1 = _mm_cmpeq_epi8(_mm_and_si128(plane1, bits), bits);
+      __m128i colours = _mm_or_si128(_mm_and_si128(plane0, one),
+                                     _mm_and_si128(plane1, two));
+      __m128i opaque = _mm_or_si128(plane0, plane1);
+      __m128i palette = _mm_set_epi64x(attribute(i + 1) * _BROADCAST,
+                                       attribute(i) * _BROADCAST);
+      __m128i result = _mm_or_si128(colours, _mm_and_si128(palette, opaque));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(pixels + i * 8), result);
+    }
+  }
+#endif
+  for (; i < count; i++) {
+    uint64_t row = _decodeRow(plane(low, i), plane(high, i), attribute(i));
+    // Pixels are little-endian in the word
+    for (int x = 0; x < 8; x++) {
+      pixels[i * 8 + x] = row >> (x * 8);
+    }
+  }
+}
+
+void decodeTile(const uint8_t *tile, uint8_t *pixels, bool flip) {
+  // 8 bytes for plane 0, 8 bytes for plane 1
+  decodeTileRows(tile, tile + 8, nullptr, 8, pixels, flip);
+}
+
+void decodeTiles(const uint8_t *tiles, size_t count, uint8_t *pixels,
+                 bool flip) {
+  for (size_t i = 0; i < count; i++) {
+    decodeTileRows(tiles + i * 16, tiles + i * 16 + 8, nullptr, 8,
+                   pixels + i * 64, flip);
+  }
+}
+
+} // namespace NESPP
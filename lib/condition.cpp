@@ -0,0 +1,337 @@
+#include "../include/condition.h"
+#include "../include/vm.h" // for VM
+#include <cctype>          // for isspace, isdigit, isalpha, isalnum
+#include <cstdlib>         // for strtol
+#include <cstring>         // for strncmp, strlen
+#include <format>
+#include <stdexcept> // std::runtime_error
+#include <utility>   // std::pair
+
+namespace NESPP {
+
+/// Recursive descent straight to bytecode, tracking the stack depth the
+/// code will need.
+struct BreakCondition::_Parser {
+  BreakCondition &condition;
+  const char *start;
+  const char *cursor;
+  int depth = 0;
+
+  [[noreturn]] void fail(const char *message) {
+    throw std::runtime_error(std::format("{} at column {} of \"{}\"", message,
+                                         cursor - start + 1, start));
+  }
+
+  void skipSpace() {
+    while (isspace(static_cast<unsigned char>(*cursor))) {
+      cursor++;
+    }
+  }
+
+  /// Consumes token if it is next. Words must not run into an identifier.
+  bool accept(const char *token) {
+    skipSpace();
+    size_t length = strlen(token);
+    if (strncmp(cursor, token, length) != 0) {
+      return false;
+    }
+    if (isalpha(static_cast<unsigned char>(token[0])) &&
+        isalnum(static_cast<unsigned char>(cursor[length]))) {
+      return false;
+    }
+    cursor += length;
+    return true;
+  }
+
+  void emit(Op op, int32_t operand = 0) {
+    condition.code.push_back({op, operand});
+    switch (op) {
+    case Op::memory:
+    case Op::changed:
+    case Op::logicalNot:
+      // pop one, push one
+      break;
+    case Op::add:
+    case Op::subtract:
+    case Op::bitAnd:
+    case Op::bitOr:
+    case Op::bitXor:
+    case Op::equal:
+    case Op::notEqual:
+    case Op::less:
+    case Op::lessEqual:
+    case Op::greater:
+    case Op::greaterEqual:
+    case Op::logicalAnd:
+    case Op::logicalOr:
+      depth -= 1;
+      break;
+    default:
+      depth += 1;
+      if (depth > STACK_SIZE) {
+        fail("Expression too deep");
+      }
+      break;
+    }
+  }
+
+  void parseOr() {
+    parseAnd();
+    while (accept("||")) {
+      parseAnd();
+      emit(Op::logicalOr);
+    }
+  }
+
+  void parseAnd() {
+    parseComparison();
+    while (accept("&&")) {
+      parseComparison();
+      emit(Op::logicalAnd);
+    }
+  }
+
+  void parseComparison() {
+    parseSum();
+    // Two-character operators first
+    constexpr std::pair<const char *, Op> operators[] = {
+        {"==", Op::equal},        {"!=", Op::notEqual}, {"<=", Op::lessEqual},
+        {">=", Op::greaterEqual}, {"<", Op::less},      {">", Op::greater},
+    };
+    for (auto [token, op] : operators) {
+      if (accept(token)) {
+        parseSum();
+        emit(op);
+        return;
+      }
+    }
+  }
+
+  void parseSum() {
+    parseUnary();
+    while (true) {
+      skipSpace();
+      if (accept("+")) {
+        parseUnary();
+        emit(Op::add);
+      } else if (accept("-")) {
+        parseUnary();
+        emit(Op::subtract);
+      } else if (cursor[0] == '&' && cursor[1] != '&') {
+        cursor++;
+        parseUnary();
+        emit(Op::bitAnd);
+      } else if (cursor[0] == '|' && cursor[1] != '|') {
+        cursor++;
+        parseUnary();
+        emit(Op::bitOr);
+      } else if (accept("^")) {
+        parseUnary();
+        emit(Op::bitXor);
+      } else {
+        return;
+      }
+    }
+  }
+
+  void parseUnary() {
+    skipSpace();
+    if (cursor[0] == '!' && cursor[1] != '=') {
+      cursor++;
+      parseUnary();
+      emit(Op::logicalNot);
+      return;
+    }
+    parsePrimary();
+    if (accept("changed")) {
+      emit(Op::changed, condition.previous.size());
+      condition.previous.push_back(0);
+      condition.seen.push_back(false);
+    }
+  }
+
+  void parseNumber() {
+    int base = 10;
+    if (*cursor == '$') {
+      base = 16;
+      cursor++;
+    } else if (strncmp(cursor, "0x", 2) == 0) {
+      base = 16;
+      cursor += 2;
+    }
+    char *end;
+    long value = strtol(cursor, &end, base);
+    if (end == cursor || value < 0 || value > 0xFFFF) {
+      fail("Expected a number from 0 to $FFFF");
+    }
+    cursor = end;
+    emit(Op::constant, value);
+  }
+
+  void parsePrimary() {
+    skipSpace();
+    if (accept("(")) {
+      parseOr();
+      if (!accept(")")) {
+        fail("Expected )");
+      }
+    } else if (accept("[")) {
+      parseOr();
+      if (!accept("]")) {
+        fail("Expected ]");
+      }
+      emit(Op::memory);
+    } else if (*cursor == '#') {
+      cursor++;
+      parseNumber();
+    } else if (*cursor == '$' || isdigit(static_cast<unsigned char>(*cursor))) {
+      parseNumber();
+    } else if (accept("hits")) {
+      emit(Op::hitCount);
+    } else if (accept("SP")) {
+      emit(Op::registerSP);
+    } else if (accept("PC")) {
+      emit(Op::registerPC);
+    } else if (accept("A")) {
+      emit(Op::registerA);
+    } else if (accept("X")) {
+      emit(Op::registerX);
+    } else if (accept("Y")) {
+      emit(Op::registerY);
+    } else if (accept("S")) {
+      emit(Op::registerS);
+    } else {
+      constexpr const char *flags = "CZIDBUVN";
+      for (int bit = 0; bit < 8; bit++) {
+        // B and the unused bit only exist on the stack
+        if (bit == 4 || bit == 5) {
+          continue;
+        }
+        char name[2] = {flags[bit], '\0'};
+        if (accept(name)) {
+          emit(Op::flag, 1 << bit);
+          return;
+        }
+      }
+      fail("Expected a number, register, flag, [address] or (");
+    }
+  }
+};
+
+BreakCondition::BreakCondition(const char *expression) : source(expression) {
+  _Parser parser = {.condition = *this,
+                    .start = source.data(),
+                    .cursor = source.data()};
+  parser.parseOr();
+  parser.skipSpace();
+  if (*parser.cursor != '\0') {
+    parser.fail("Unexpected input");
+  }
+}
+
+bool BreakCondition::evaluate(VM &vm) {
+  hits += 1;
+  int32_t stack[STACK_SIZE];
+  int top = -1;
+  for (const _Operation &operation : code) {
+    switch (operation.op) {
+    case Op::constant:
+      stack[++top] = operation.operand;
+      break;
+    case Op::registerA:
+      stack[++top] = vm.A;
+      break;
+    case Op::registerX:
+      stack[++top] = vm.X;
+      break;
+    case Op::registerY:
+      stack[++top] = vm.Y;
+      break;
+    case Op::registerSP:
+      stack[++top] = vm.SP;
+      break;
+    case Op::registerS:
+      stack[++top] = vm.S;
+      break;
+    case Op::registerPC:
+      stack[++top] = vm.PC.to16();
+      break;
+    case Op::flag:
+      stack[++top] = (vm.S & operation.operand) != 0;
+      break;
+    case Op::hitCount:
+      // Saturates rather than wrapping negative
+      stack[++top] = hits > INT32_MAX ? INT32_MAX : static_cast<int32_t>(hits);
+      break;
+    case Op::memory:
+      stack[top] = vm.inspect(static_cast<uint16_t>(stack[top]));
+      break;
+    case Op::changed: {
+      int32_t value = stack[top];
+      stack[top] = seen[operation.operand] &&
+                   previous[operation.operand] != value;
+      previous[operation.operand] = value;
+      seen[operation.operand] = true;
+      break;
+    }
+    case Op::logicalNot:
+      stack[top] = !stack[top];
+      break;
+    case Op::add:
+      top--;
+      stack[top] = stack[top] + stack[top + 1];
+      break;
+    case Op::subtract:
+      top--;
+      stack[top] = stack[top] - stack[top + 1];
+      break;
+    case Op::bitAnd:
+      top--;
+      stack[top] = stack[top] & stack[top + 1];
+      break;
+    case Op::bitOr:
+      top--;
+      stack[top] = stack[top] | stack[top + 1];
+      break;
+    case Op::bitXor:
+      top--;
+      stack[top] = stack[top] ^ stack[top + 1];
+      break;
+    case Op::equal:
+      top--;
+      stack[top] = stack[top] == stack[top + 1];
+      break;
+    case Op::notEqual:
+      top--;
+      stack[top] = stack[top] != stack[top + 1];
+      break;
+    case Op::less:
+      top--;
+      stack[top] = stack[top] < stack[top + 1];
+      break;
+    case Op::lessEqual:
+      top--;
+      stack[top] = stack[top] <= stack[top + 1];
+      break;
+    case Op::greater:
+      top--;
+      stack[top] = stack[top] > stack[top + 1];
+      break;
+    case Op::greaterEqual:
+      top--;
+      stack[top] = stack[top] >= stack[top + 1];
+      break;
+    case Op::logicalAnd:
+      top--;
+      stack[top] = stack[top] && stack[top + 1];
+      break;
+    case Op::logicalOr:
+      top--;
+      stack[top] = stack[top] || stack[top + 1];
+      break;
+    }
+  }
+  return stack[top] != 0;
+}
+
+} // namespace NESPP
@@ -1,33 +1,52 @@
 #include "../include/debug.h"
+#include "../include/disassembler.h" // for formatInstruction
 #include "../include/instructions.h" // for Instruction, OpCode
+#include "../include/timeline.h"     // for TimelineSpan
+#include "../include/trace.h"        // for TraceEvent
 #include "../include/vm.h"           // for VM
 #include "../include/word.h"         // for Word
+#include <algorithm>                 // std::min
 #include <bitset>                    // std::bitset
 #include <cstdio>
-#include <cstring>                   // for strncmp
+#include <cstring>                   // for strncmp, memcpy
 #include <format>
 #include <locale.h>
 #include <ncurses.h>
 #include <stdexcept>
 #include <stdint.h> // for uint8_t
-#include <utility>  // std::move
+#include <utility>  // std::move, std::exchange
 
 namespace NESPP {
 
-_Queue::_Queue(int _size) : size(_size) {}
-
-void _Queue::enqueue(std::string element) {
-  if (contents.size() == size) {
-    contents.pop_front();
+_Queue::_Queue(int _size) : size(_size) {
+  if (size == 0 || size > CAPACITY) {
+    throw std::runtime_error(
+        std::format("_Queue size must be 1..{}, got {}", CAPACITY, _size));
   }
-  contents.push_back(element);
 }
 
+char *_Queue::next() {
+  char *line = lines[count % size];
+  count += 1;
+  line[0] = '\0';
+  return line;
+}
+
+void _Queue::enqueue(std::string_view element) {
+  char *line = next();
+  size_t length = std::min(element.size(), LINE_SIZE - 1);
+  memcpy(line, element.data(), length);
+  line[length] = '\0';
+}
+
+void _Queue::clear() { count = 0; }
+
 void _Queue::renderLines(int y, int x, int _, int width) {
   // TODO check if height < size
   int currentY = y;
-  for (auto line : contents) {
-    mvaddnstr(currentY, x, line.data(), width);
+  uint64_t first = count > size ? count - size : 0;
+  for (uint64_t i = first; i < count; i++) {
+    mvaddnstr(currentY, x, lines[i % size], width);
     currentY += 1;
   }
 }
@@ -84,7 +103,8 @@ void _renderStack(Debugger *dbg) {
     if (ptr > 0x01FF) {
       break;
     }
-    auto val = dbg->peek16(ptr);
+    // Straight from RAM so that drawing doesn't trip read watchpoints
+    auto val = dbg->ram[ptr];
     mvprintw(y + i + 1, x + 1, "%04X: %02X", ptr, val);
   }
   _renderBox(y, x, height, width);
@@ -101,56 +121,413 @@ Debugger::~Debugger() {
   endwin();
   printf("called endwin()\n");
   fflush(stdout);
-  VM::~VM();
 }
 
 void Debugger::render() {
-  clear();
+  // Formatting is deferred to here so that run mode only pays for it once
+  // per redraw
+  instructionQueue.clear();
+  uint64_t first = executed > instructionQueue.size
+                       ? executed - instructionQueue.size
+                       : 0;
+  for (uint64_t i = first; i < executed; i++) {
+    _Executed &entry = history[i % _Queue::CAPACITY];
+    char *line = instructionQueue.next();
+    // Re-encoded from what actually ran, which self-modifying code may
+    // since have overwritten
+    Instruction &instruction = entry.instruction;
+    uint8_t bytes[3] = {static_cast<uint8_t>(
+        opCodeByteLookup[static_cast<int>(instruction.opCode.type)]
+                        [static_cast<int>(instruction.opCode.addressing)])};
+    switch (instruction.opCode.addressing) {
+    case AddressingMode::absolute:
+    case AddressingMode::indirect:
+      bytes[1] = instruction.operand.absolute.low;
+      bytes[2] = instruction.operand.absolute.high;
+      break;
+    case AddressingMode::immediate:
+    case AddressingMode::relative:
+    case AddressingMode::zeropage:
+      bytes[1] = instruction.operand.immediate;
+      break;
+    case AddressingMode::accumulator:
+    case AddressingMode::implied:
+      break;
+    }
+    auto end = std::format_to_n(line, _Queue::LINE_SIZE - 1, "{:4X}: ",
+                                entry.address);
+    formatInstruction(end.out, _Queue::LINE_SIZE - (end.out - line),
+                      entry.address, bytes);
+  }
+
+  // erase() rather than clear() so refresh() only sends what changed
+  erase();
   _renderInstruction(this);
   _renderRegisters(this);
   _renderStack(this);
   _renderDebug(this);
 
+  mvaddstr(instructionQueue.size + 7, 0, status.data());
   // prompt
   mvaddstr(instructionQueue.size + 6, 0, "> ");
   refresh();
 }
 
+void Debugger::run(uint64_t count, int32_t until) {
+  using Clock = std::chrono::steady_clock;
+  // Instructions between looking at the clock and the keyboard
+  constexpr uint64_t batchSize = 4096;
+
+  bool interactive = count > 1;
+  if (interactive) {
+    status = "Running; press any key to break";
+    noecho();
+    cbreak();
+    nodelay(stdscr, TRUE);
+    render();
+  } else {
+    status.clear();
+  }
+
+  // An unimplemented opcode or a failing condition must not leave the
+  // terminal in nodelay mode, or the prompt would read ERR forever
+  auto restoreTerminal = [interactive]() {
+    if (interactive) {
+      nodelay(stdscr, FALSE);
+      nocbreak();
+      echo();
+    }
+  };
+
+  Clock::time_point lastRedraw = Clock::now();
+  uint64_t remaining = count;
+  bool stopped = false;
+  try {
+    while (remaining > 0 && !stopped) {
+      {
+        TimelineSpan span = {"cpu"};
+        uint64_t batch = std::min(remaining, batchSize);
+        for (; batch > 0; batch--) {
+          uint16_t address = PC.to16();
+          if (remaining != count &&
+              ((breakpoints.test(address) && _shouldBreak(address)) ||
+               address == until)) {
+            status = std::format("{} at ${:04X}",
+                                 address == until ? "Reached" : "Breakpoint",
+                                 address);
+            stopped = true;
+            break;
+          }
+          history[executed % _Queue::CAPACITY] = {address, step()};
+          executed += 1;
+          remaining -= 1;
+          rewind.onStep(*this);
+          if (watchpoints != nullptr && watches.halted) [[unlikely]] {
+            status = std::format("Watchpoint {}", watches.halted->toString());
+            watches.halted.reset();
+            stopped = true;
+            break;
+          }
+        }
+      }
+      drainTrace();
+
+      if (interactive && !stopped &&
+          Clock::now() - lastRedraw >= REDRAW_INTERVAL) {
+        if (getch() != ERR) {
+          // Drop the rest of whatever was typed so it isn't read as a command
+          flushinp();
+          status = std::format("Interrupted at ${:04X}", PC.to16());
+          stopped = true;
+        } else {
+          TimelineSpan span = {"Debugger::render"};
+          render();
+          lastRedraw = Clock::now();
+        }
+      }
+    }
+  } catch (...) {
+    restoreTerminal();
+    throw;
+  }
+
+  if (interactive && !stopped) {
+    status = std::format("Stepped {} instructions", count);
+  }
+  restoreTerminal();
+}
+
 void Debugger::start() {
   PC = {
       peek16(0xFFFD), // high
       peek16(0xFFFC), // low
   };
+  rewind.capture(*this);
 
   while (1) {
-    auto insLoc = PC;
-    Instruction ins = decodeInstruction();
-    instructionQueue.enqueue(
-        std::format("{:4X}: {}", insLoc.to16(), ins.toString().data()));
-    execute(ins);
-    render();
+    {
+      TimelineSpan span = {"Debugger::render"};
+      render();
+    }
 
     constexpr size_t inputSize = 1024;
     char inputLine[inputSize] = {0};
-    int result = getnstr(inputLine, inputSize);
+    int result;
+    {
+      TimelineSpan span = {"input"};
+      result = getnstr(inputLine, inputSize);
+    }
     if (result == ERR) {
       throw std::runtime_error("getnstr returned ERR");
     }
-    if (strncmp(inputLine, "", 1) == 0) {
-      // step into
-      continue;
-    } else if (strncmp(inputLine, "setppu2", 7) == 0) {
-      // TODO: is this right?
-      // we're branching on if the zero flag is set, so don't branch
-      ppuRegisters[2] = 1 << 7;
-      debug(std::format("Setting PPU[2] = #{:02X}", ppuRegisters[2]));
-      continue;
+    // A typo at the prompt should not end the session
+    try {
+      command(inputLine);
+    } catch (const std::exception &e) {
+      status = std::format("Error: {}", e.what());
+    } catch (const char *msg) {
+      status = std::format("Error: {}", msg);
+    }
+  }
+}
+
+/// Commands:
+///
+///   (empty)                step into one instruction
+///   step N, s N            execute N instructions
+///   continue, c, run, r    run until a breakpoint or a keypress
+///   until XXXX, u XXXX     run until PC reaches $XXXX
+///   break XXXX, b XXXX     toggle a breakpoint at $XXXX
+///   break XXXX if EXPR     break at $XXXX only when EXPR holds, see
+///                          BreakCondition
+///   watch SPEC, w SPEC     stop when SPEC is hit, see parseWatchpoint
+///   log SPEC               log hits of SPEC to the debug pane
+///   unwatch N              remove watchpoint #N
+///   watches                list watchpoints in the debug pane
+///   back N, step-back N    go back N instructions (default 1)
+///   reverse-continue, rc   go back to the previous breakpoint hit
+///   reverse-until-write XXXX, rw XXXX
+///                          go back to the last instruction that wrote
+///                          $XXXX
+///   setppu2                force PPU[2] bit 7 (vblank)
+void Debugger::command(const char *input) {
+  constexpr uint64_t forever = UINT64_MAX;
+  char name[16] = {0};
+  char argument[32] = {0};
+  int fields = sscanf(input, "%15s %31s", name, argument);
+
+  auto hexArgument = [&]() -> uint16_t {
+    unsigned int address;
+    const char *text = argument[0] == '$' ? argument + 1 : argument;
+    if (fields < 2 || sscanf(text, "%x", &address) != 1 || address > 0xFFFF) {
+      throw std::runtime_error(
+          std::format("Expected a hex address after \"{}\"", name));
+    }
+    return address;
+  };
+
+  if (fields <= 0) {
+    // step into
+    run(1);
+  } else if (strcmp(name, "step") == 0 || strcmp(name, "s") == 0) {
+    unsigned long long count = 1;
+    if (fields == 2 && sscanf(argument, "%llu", &count) != 1) {
+      throw std::runtime_error(
+          std::format("Expected an instruction count, got \"{}\"", argument));
+    }
+    run(count);
+  } else if (strcmp(name, "continue") == 0 || strcmp(name, "c") == 0 ||
+             strcmp(name, "run") == 0 || strcmp(name, "r") == 0) {
+    run(forever);
+  } else if (strcmp(name, "until") == 0 || strcmp(name, "u") == 0) {
+    run(forever, hexArgument());
+  } else if (strcmp(name, "break") == 0 || strcmp(name, "b") == 0) {
+    uint16_t address = hexArgument();
+    const char *expression = strstr(input, " if ");
+    if (expression != nullptr) {
+      // Compiled here, once, rather than on every hit
+      conditions.insert_or_assign(address, BreakCondition(expression + 4));
+      breakpoints.set(address);
+      status = std::format("Breakpoint at ${:04X} if {}", address,
+                           expression + 4);
     } else {
+      breakpoints.flip(address);
+      conditions.erase(address);
+      status = std::format("Breakpoint at ${:04X} {}", address,
+                           breakpoints.test(address) ? "set" : "cleared");
+    }
+  } else if (strcmp(name, "watch") == 0 || strcmp(name, "w") == 0 ||
+             strcmp(name, "log") == 0) {
+    if (fields < 2) {
       throw std::runtime_error(
-          std::format("Unrecognized debugger input: \"{}\" ({})", inputLine,
-                      strlen(inputLine)));
+          std::format("Expected a watchpoint after \"{}\"", name));
+    }
+    WatchAction action =
+        strcmp(name, "log") == 0 ? WatchAction::log : WatchAction::halt;
+    uint32_t id = watches.add(parseWatchpoint(argument, action));
+    watchpoints = &watches;
+    status = std::format("Watchpoint #{} set", id);
+  } else if (strcmp(name, "unwatch") == 0) {
+    unsigned int id = 0;
+    if (fields < 2 || sscanf(argument, "%u", &id) != 1) {
+      throw std::runtime_error("Expected a watchpoint number after unwatch");
+    }
+    status = watches.remove(id) ? std::format("Watchpoint #{} removed", id)
+                                : std::format("No watchpoint #{}", id);
+    watchpoints = watches.empty() ? nullptr : &watches;
+  } else if (strcmp(name, "watches") == 0) {
+    for (const Watchpoint &watchpoint : watches.list()) {
+      debug(watchpoint.toString());
+    }
+  } else if (strcmp(name, "back") == 0 || strcmp(name, "step-back") == 0) {
+    unsigned long long count = 1;
+    if (fields == 2 && sscanf(argument, "%llu", &count) != 1) {
+      throw std::runtime_error(
+          std::format("Expected an instruction count, got \"{}\"", argument));
+    }
+    uint64_t target = instructions > count ? instructions - count : 0;
+    status = _seek(target) ? std::format("At instruction {}", instructions)
+                           : std::format("History only goes back to {}",
+                                         rewind.oldest());
+  } else if (strcmp(name, "reverse-continue") == 0 ||
+             strcmp(name, "rc") == 0) {
+    // Conditions see replayed state, but their hits and "changed" carry on
+    // from copies rather than being rewound
+    auto replayed = conditions;
+    auto before = [&]() {
+      uint16_t address = PC.to16();
+      if (!breakpoints.test(address)) {
+        return false;
+      }
+      auto found = replayed.find(address);
+      return found == replayed.end() || found->second.evaluate(*this);
+    };
+    uint64_t found = 0;
+    WatchpointSet *installed = std::exchange(watchpoints, nullptr);
+    bool matched = _reverseSearch(before, [] { return false; }, found);
+    watchpoints = installed;
+    if (matched) {
+      _seek(found);
+      status = std::format("Breakpoint at ${:04X}, instruction {}", PC.to16(),
+                           instructions);
+    } else {
+      status = std::format("No breakpoint hit since instruction {}",
+                           rewind.oldest());
+    }
+  } else if (strcmp(name, "reverse-until-write") == 0 ||
+             strcmp(name, "rw") == 0) {
+    uint16_t address = hexArgument();
+    WatchpointSet writes;
+    writes.add({.first = address,
+                .last = address,
+                .kinds = WatchKind::write,
+                .action = WatchAction::log});
+    WatchpointSet *installed = std::exchange(watchpoints, &writes);
+    auto after = [&]() {
+      bool wrote = !writes.hits.empty();
+      writes.hits.clear();
+      return wrote;
+    };
+    uint64_t found = 0;
+    bool matched = _reverseSearch([] { return false; }, after, found);
+    watchpoints = installed;
+    if (matched) {
+      _seek(found);
+      status = std::format("${:04X} written by ${:04X}, instruction {}",
+                           address, PC.to16(), instructions);
+    } else {
+      status = std::format("${:04X} not written since instruction {}",
+                           address, rewind.oldest());
+    }
+  } else if (strcmp(name, "setppu2") == 0) {
+    // TODO: is this right?
+    // we're branching on if the zero flag is set, so don't branch
+    ppu->status |= 1 << 7;
+    // Replaying from older keyframes would no longer get here
+    rewind.capture(*this);
+    debug(std::format("Setting PPU[2] = #{:02X}", ppu->inspect(2)));
+  } else {
+    throw std::runtime_error(
+        std::format("Unrecognized debugger input: \"{}\" ({})", input,
+                    strlen(input)));
+  }
+}
+
+bool Debugger::_seek(uint64_t target) {
+  const VMState *keyframe = rewind.keyframeAtOrBefore(target);
+  if (keyframe == nullptr) {
+    return false;
+  }
+  loadState(*keyframe);
+  // Replaying must not stop, and has already been logged
+  WatchpointSet *installed = std::exchange(watchpoints, nullptr);
+  while (instructions < target) {
+    uint16_t address = PC.to16();
+    history[executed % _Queue::CAPACITY] = {address, step()};
+    executed += 1;
+  }
+  watchpoints = installed;
+  _discardTrace();
+  return true;
+}
+
+template <typename Before, typename After>
+bool Debugger::_reverseSearch(Before before, After after, uint64_t &found) {
+  VMState current;
+  saveState(current);
+  bool matched = false;
+  uint64_t end = instructions;
+  while (end > 0 && !matched) {
+    const VMState *keyframe = rewind.keyframeAtOrBefore(end - 1);
+    if (keyframe == nullptr) {
+      break;
     }
+    uint64_t start = keyframe->instructions;
+    loadState(*keyframe);
+    // Later matches in the interval win
+    while (instructions < end) {
+      uint64_t index = instructions;
+      if (before()) {
+        found = index;
+        matched = true;
+      }
+      step();
+      if (after()) {
+        found = index;
+        matched = true;
+      }
+    }
+    end = start;
+  }
+  loadState(current);
+  _discardTrace();
+  return matched;
+}
+
+void Debugger::_discardTrace() {
+#if NESPP_TRACE
+  TraceEvent event;
+  while (trace.pop(event)) {
+  }
+#endif
+}
+
+bool Debugger::_shouldBreak(uint16_t address) {
+  auto found = conditions.find(address);
+  return found == conditions.end() || found->second.evaluate(*this);
+}
+
+void Debugger::drainTrace() {
+#if NESPP_TRACE
+  TraceEvent event;
+  while (trace.pop(event)) {
+    event.format(debugQueue.next(), _Queue::LINE_SIZE);
+  }
+#endif
+  for (const WatchHit &hit : watches.hits) {
+    hit.format(debugQueue.next(), _Queue::LINE_SIZE);
   }
+  watches.hits.clear();
 }
 
 void Debugger::debug(std::string msg) { debugQueue.enqueue(msg); }
@@ -0,0 +1,435 @@
+#include "../include/disassembler.h"
+#include "../include/cdl.h" // for CodeDataLogger
+#include "../include/rom.h" // for Rom
+#include <algorithm>        // std::min, std::max
+#include <atomic>
+#include <cstring> // for memcpy
+#include <format>
+#include <stdexcept> // std::runtime_error
+#include <thread>
+
+namespace NESPP {
+
+namespace {
+
+constexpr uint8_t _SIZES[] = {
+    1, // implied
+    1, // accumulator
+    2, // immediate
+    2, // zeropage
+    2, // zeropageX
+    2, // zeropageY
+    3, // absolute
+    3, // absoluteX
+    3, // absoluteY
+    3, // indirect
+    2, // indirectX
+    2, // indirectY
+    2, // relative
+};
+
+/// Offset into a bank of a CPU address, or -1 if it is not mapped there
+int32_t _offset(uint16_t origin, size_t size, bool mirrored,
+                uint16_t address) {
+  if (mirrored) {
+    // NROM: 16 KiB is mirrored at $8000 and $C000
+    return address >= 0x8000 ? (address - 0x8000) % size : -1;
+  }
+  if (address < origin || static_cast<size_t>(address - origin) >= size) {
+    return -1;
+  }
+  return address - origin;
+}
+
+/// Labels of one bank, for operands that point into it
+struct _Labels {
+  const std::vector<bool> &marked;
+  uint16_t origin;
+  size_t size;
+  bool mirrored;
+
+  /// The listing address of the label for address, or -1 if there is none
+  int32_t find(uint16_t address) const {
+    int32_t at = _offset(origin, size, mirrored, address);
+    return at >= 0 && marked[at] ? origin + at : -1;
+  }
+};
+
+char *_hex(char *out, uint32_t value, int digits) {
+  constexpr char digitsTable[] = "0123456789ABCDEF";
+  for (int i = digits - 1; i >= 0; i--) {
+    out[i] = digitsTable[value & 0xF];
+    value >>= 4;
+  }
+  return out + digits;
+}
+
+char *_append(char *out, const char *text) {
+  while (*text != '\0') {
+    *out++ = *text++;
+  }
+  return out;
+}
+
+/// An address operand: a label if there is one, else $XXXX, or $XX when
+/// the mode is zeropage
+char *_address(char *out, uint16_t value, bool wide, const _Labels *labels) {
+  if (labels != nullptr) {
+    int32_t label = labels->find(value);
+    if (label >= 0) {
+      *out++ = 'L';
+      out = _hex(out, label, 4);
+      if (label != value) {
+        // A mirror of the label, e.g. $8009 for LC009 in 16 KiB NROM
+        out = _append(out, "-$");
+        out = _hex(out, label - value, 4);
+      }
+      return out;
+    }
+  }
+  if (wide && value < 0x100) {
+    // ca65 would otherwise shrink it to zeropage and change the size
+    out = _append(out, "a:");
+  }
+  *out++ = '$';
+  return _hex(out, value, wide ? 4 : 2);
+}
+
+/// Longest output is ".byte $XX" or "LDA a:L1234,X"; 32 is plenty
+constexpr size_t _LINE = 32;
+
+size_t _format(char *line, uint16_t address, const uint8_t *bytes,
+               const _Labels *labels) {
+  using enum DisassemblyMode;
+  const DisassemblyOpCode &opCode = disassemblyLookup[bytes[0]];
+  char *out = line;
+  if (opCode.mnemonic == nullptr) {
+    out = _append(out, ".byte $");
+    out = _hex(out, bytes[0], 2);
+    return out - line;
+  }
+  out = _append(out, opCode.mnemonic);
+  uint16_t word = bytes[1] | (bytes[2] << 8);
+  switch (opCode.mode) {
+  case implied:
+    break;
+  case accumulator:
+    out = _append(out, " A");
+    break;
+  case immediate:
+    out = _append(out, " #$");
+    out = _hex(out, bytes[1], 2);
+    break;
+  case zeropage:
+  case zeropageX:
+  case zeropageY:
+    *out++ = ' ';
+    out = _address(out, bytes[1], false, nullptr);
+    out = _append(out, opCode.mode == zeropageX   ? ",X"
+                       : opCode.mode == zeropageY ? ",Y"
+                                                  : "");
+    break;
+  case absolute:
+  case absoluteX:
+  case absoluteY:
+    *out++ = ' ';
+    out = _address(out, word, true, labels);
+    out = _append(out, opCode.mode == absoluteX   ? ",X"
+                       : opCode.mode == absoluteY ? ",Y"
+                                                  : "");
+    break;
+  case indirect:
+    out = _append(out, " (");
+    out = _address(out, word, true, labels);
+    *out++ = ')';
+    break;
+  case indirectX:
+    out = _append(out, " ($");
+    out = _hex(out, bytes[1], 2);
+    out = _append(out, ",X)");
+    break;
+  case indirectY:
+    out = _append(out, " ($");
+    out = _hex(out, bytes[1], 2);
+    out = _append(out, "),Y");
+    break;
+  case relative: {
+    uint16_t target = address + 2 + static_cast<int8_t>(bytes[1]);
+    *out++ = ' ';
+    out = _address(out, target, true, labels);
+    break;
+  }
+  }
+  return out - line;
+}
+
+enum _Mark : uint8_t { _DATA, _OPCODE, _OPERAND };
+
+/// Buffered append of one listing line
+void _line(std::string &out, const char *text, size_t length) {
+  out.append(text, length);
+  out.push_back('\n');
+}
+
+} // namespace
+
+uint8_t disassemblySize(uint8_t opCode) {
+  const DisassemblyOpCode &entry = disassemblyLookup[opCode];
+  return entry.mnemonic == nullptr ? 1
+                                   : _SIZES[static_cast<int>(entry.mode)];
+}
+
+size_t formatInstruction(char *buffer, size_t size, uint16_t address,
+                         const uint8_t *bytes) {
+  if (size == 0) {
+    return 0;
+  }
+  char line[_LINE];
+  size_t length = std::min(_format(line, address, bytes, nullptr), size - 1);
+  memcpy(buffer, line, length);
+  buffer[length] = '\0';
+  return length;
+}
+
+Disassembler::Disassembler(std::shared_ptr<Rom> _rom) : rom(std::move(_rom)) {
+  size_t prgSize = rom->prgSize;
+  if (prgSize == 0 || prgSize % 0x4000 != 0) {
+    throw std::runtime_error(
+        std::format("Cannot disassemble {} bytes of PRG", prgSize));
+  }
+  if (prgSize <= 0x8000) {
+    banks.push_back({.origin = static_cast<uint16_t>(0x10000 - prgSize),
+                     .offset = 0,
+                     .size = prgSize,
+                     .entryPoints = {}});
+  } else {
+    for (size_t offset = 0; offset < prgSize; offset += 0x4000) {
+      bool fixed = offset + 0x4000 == prgSize;
+      uint16_t origin = fixed ? 0xC000 : 0x8000;
+      banks.push_back({.origin = origin,
+                       .offset = offset,
+                       .size = 0x4000,
+                       .entryPoints = {}});
+    }
+  }
+
+  // NMI, reset and IRQ, from the end of the fixed bank
+  const uint8_t *vectors = rom->prgBlob + prgSize - 6;
+  for (int i = 0; i < 3; i++) {
+    uint16_t address = vectors[i * 2] | (vectors[i * 2 + 1] << 8);
+    for (size_t bank = 0; bank < banks.size(); bank++) {
+      // The vectors always see the fixed bank
+      if (banks[bank].offset + banks[bank].size == prgSize) {
+        addEntryPoint(bank, address);
+      }
+    }
+  }
+}
+
+void Disassembler::seed(const CodeDataLogger &cdl) {
+  if (cdl.prgSize != static_cast<size_t>(rom->prgSize)) {
+    throw std::runtime_error(
+        std::format("Code/data log is for {} bytes of PRG, ROM has {}",
+                    cdl.prgSize, rom->prgSize));
+  }
+  for (size_t bank = 0; bank < banks.size(); bank++) {
+    const _Bank &b = banks[bank];
+    for (size_t i = 0; i < b.size; i++) {
+      if (CodeDataLogger::test(cdl.opCodes, b.offset + i)) {
+        addEntryPoint(bank, b.origin + i);
+      }
+    }
+  }
+}
+
+void Disassembler::addEntryPoint(size_t bank, uint16_t address) {
+  if (_bankOffset(banks.at(bank), address) >= 0) {
+    banks[bank].entryPoints.push_back(address);
+  }
+}
+
+int32_t Disassembler::_bankOffset(const _Bank &bank, uint16_t address) const {
+  return _offset(bank.origin, bank.size, banks.size() == 1, address);
+}
+
+std::string Disassembler::_listBank(size_t index) const {
+  const _Bank &bank = banks[index];
+  const uint8_t *bytes = rom->prgBlob + bank.offset;
+  std::vector<uint8_t> marks(bank.size, _DATA);
+  std::vector<bool> labels(bank.size, false);
+
+  auto label = [&](uint16_t address) {
+    int32_t at = _bankOffset(bank, address);
+    if (at >= 0) {
+      labels[at] = true;
+    }
+    return at;
+  };
+
+  // Recursive descent, with an explicit stack rather than recursion
+  std::vector<int32_t> pending;
+  for (uint16_t address : bank.entryPoints) {
+    pending.push_back(label(address));
+  }
+  while (!pending.empty()) {
+    int32_t at = pending.back();
+    pending.pop_back();
+    while (at >= 0 && static_cast<size_t>(at) < bank.size &&
+           marks[at] == _DATA) {
+      const DisassemblyOpCode &opCode = disassemblyLookup[bytes[at]];
+      uint8_t size = disassemblySize(bytes[at]);
+      if (opCode.mnemonic == nullptr ||
+          static_cast<size_t>(at + size) > bank.size) {
+        break;
+      }
+      // Don't decode over something already decoded differently
+      bool overlaps = false;
+      for (int i = 1; i < size; i++) {
+        overlaps = overlaps || marks[at + i] != _DATA;
+      }
+      if (overlaps) {
+        break;
+      }
+      marks[at] = _OPCODE;
+      for (int i = 1; i < size; i++) {
+        marks[at + i] = _OPERAND;
+      }
+
+      uint16_t address = bank.origin + at;
+      uint8_t op = bytes[at];
+      // Operands are in the bank, as checked above
+      uint16_t word = size == 1   ? 0
+                      : size == 2 ? bytes[at + 1]
+                                  : bytes[at + 1] | (bytes[at + 2] << 8);
+      using enum DisassemblyMode;
+      if (opCode.mode == relative) {
+        pending.push_back(label(address + 2 + static_cast<int8_t>(word)));
+      } else if (op == 0x20 || op == 0x4C) {
+        // JSR, JMP
+        pending.push_back(label(word));
+      } else if (opCode.mode == absolute || opCode.mode == absoluteX ||
+                 opCode.mode == absoluteY || opCode.mode == indirect) {
+        // Data (or a jump table) in this bank
+        label(word);
+      }
+      // JMP, JMP (ind), RTS, RTI, BRK
+      if (op == 0x4C || op == 0x6C || op == 0x60 || op == 0x40 || op == 0x00) {
+        break;
+      }
+      at += size;
+    }
+  }
+
+  _Labels lookup = {.marked = labels,
+                    .origin = bank.origin,
+                    .size = bank.size,
+                    .mirrored = banks.size() == 1};
+
+  std::string out = std::format("\n; Bank {}: PRG ${:05X}-${:05X}\n", index,
+                                bank.offset, bank.offset + bank.size - 1);
+  out += banks.size() == 1 ? ".segment \"CODE\"\n"
+                           : std::format(".segment \"BANK{}\"\n", index);
+  out += std::format(".org ${:04X}\n", bank.origin);
+
+  char line[96];
+  size_t vectors = bank.offset + bank.size == static_cast<size_t>(rom->prgSize)
+                       ? bank.size - 6
+                       : SIZE_MAX;
+  size_t at = 0;
+  while (at < bank.size) {
+    uint16_t address = bank.origin + at;
+    if (labels[at]) {
+      char *end = _hex(_append(line, "L"), address, 4);
+      *end++ = ':';
+      _line(out, line, end - line);
+    }
+
+    if (marks[at] == _OPCODE) {
+      uint8_t size = disassemblySize(bytes[at]);
+      // A label into the middle of an instruction (self-modifying code, or
+      // BIT tricks)
+      for (int i = 1; i < size; i++) {
+        if (labels[at + i]) {
+          char *end = _hex(_append(line, "L"), address + i, 4);
+          end = _append(end, " := * + ");
+          *end++ = '0' + i;
+          _line(out, line, end - line);
+        }
+      }
+      char *end = _append(line, "        ");
+      end += _format(end, address, bytes + at, &lookup);
+      // Comment column with the address and encoding
+      while (end - line < 40) {
+        *end++ = ' ';
+      }
+      end = _hex(_append(end, "; $"), address, 4);
+      for (int i = 0; i < size; i++) {
+        *end++ = ' ';
+        end = _hex(end, bytes[at + i], 2);
+      }
+      _line(out, line, end - line);
+      at += size;
+    } else if (at == vectors && marks[at] == _DATA &&
+               marks[at + 2] == _DATA && marks[at + 4] == _DATA &&
+               !labels[at + 2] && !labels[at + 4]) {
+      char *end = _append(line, "        .word ");
+      const char *names[3] = {"nmi", "reset", "irq"};
+      for (int i = 0; i < 3; i++) {
+        uint16_t word = bytes[at + i * 2] | (bytes[at + i * 2 + 1] << 8);
+        end = _address(end, word, true, &lookup);
+        end = _append(end, i < 2 ? ", " : "");
+      }
+      end = _append(end, "  ; ");
+      for (int i = 0; i < 3; i++) {
+        end = _append(end, names[i]);
+        end = _append(end, i < 2 ? ", " : "");
+      }
+      _line(out, line, end - line);
+      at += 6;
+    } else {
+      // Up to 16 data bytes, stopping at code, labels and the vectors
+      char *end = _append(line, "        .byte ");
+      size_t start = at;
+      do {
+        if (at != start) {
+          *end++ = ',';
+        }
+        *end++ = '$';
+        end = _hex(end, bytes[at], 2);
+        at++;
+      } while (at < bank.size && at - start < 16 && marks[at] != _OPCODE &&
+               !labels[at] && at != vectors);
+      _line(out, line, end - line);
+    }
+  }
+  return out;
+}
+
+std::string Disassembler::listing(unsigned jobs) {
+  if (jobs == 0) {
+    jobs = std::max(1u, std::thread::hardware_concurrency());
+  }
+  jobs = std::min<size_t>(jobs, banks.size());
+
+  std::vector<std::string> listings(banks.size());
+  std::atomic<size_t> next = 0;
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < jobs; i++) {
+    workers.emplace_back([&] {
+      for (size_t j = next++; j < banks.size(); j = next++) {
+        listings[j] = _listBank(j);
+      }
+    });
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+
+  std::string out = ".setcpu \"6502\"\n";
+  for (auto &listing : listings) {
+    out += listing;
+  }
+  return out;
+}
+
+} // namespace NESPP
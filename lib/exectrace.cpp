@@ -0,0 +1,391 @@
+#include "../include/exectrace.h"
+#include <cstdlib>   // for strtoul
+#include <cstring>   // for memcmp, strstr
+#include <format>    // std::format
+#include <stdexcept> // std::runtime_error
+#include <utility>   // std::move
+#include <zlib.h>
+
+namespace NESPP {
+
+namespace {
+
+constexpr char MAGIC[8] = {'N', 'E', 'S', 'T', 'R', 'C', 1, 0};
+
+// Worst case: flags, PC, 3 opcode bytes, 5 registers, 10 byte varint
+constexpr size_t MAX_RECORD_SIZE = 1 + 2 + 3 + 5 + 10;
+
+// Blocks waiting for the writer before the emulation thread has to wait
+constexpr size_t MAX_PENDING = 8;
+
+enum : uint8_t {
+  _explicitPC = 1 << 0,
+  _changedA = 1 << 1,
+  _changedX = 1 << 2,
+  _changedY = 1 << 3,
+  _changedP = 1 << 4,
+  _changedSP = 1 << 5,
+  // Bits 6-7 hold size - 1
+};
+
+void _writeU32(uint8_t *dst, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    dst[i] = (value >> (8 * i)) & 0xFF;
+  }
+}
+
+uint32_t _readU32(const uint8_t *src) {
+  return src[0] | (src[1] << 8) | (src[2] << 16) |
+         (static_cast<uint32_t>(src[3]) << 24);
+}
+
+} // namespace
+
+std::string ExecutionRecord::toString() {
+  std::string bytesString;
+  for (int i = 0; i < 3; i++) {
+    bytesString += i < size ? std::format("{:02X} ", bytes[i]) : "   ";
+  }
+  return std::format("{:04X}  {} A:{:02X} X:{:02X} Y:{:02X} P:{:02X} SP:{:02X} "
+                     "CYC:{}",
+                     pc, bytesString, A, X, Y, P, SP, cycle);
+}
+
+ExecutionTraceRecorder::ExecutionTraceRecorder(const char *path) {
+  file = fopen(path, "wb");
+  if (file == nullptr) {
+    throw std::runtime_error(
+        std::format("Failed to open trace file at {}", path));
+  }
+  if (fwrite(MAGIC, sizeof(MAGIC), 1, file) != 1) {
+    fclose(file);
+    throw std::runtime_error(
+        std::format("Failed to write trace file at {}", path));
+  }
+  block.reserve(BLOCK_SIZE);
+  writer = std::thread(&ExecutionTraceRecorder::_writeLoop, this);
+}
+
+ExecutionTraceRecorder::~ExecutionTraceRecorder() {
+  try {
+    close();
+  } catch (const std::exception &e) {
+    fprintf(stderr, "[Error] %s!\n", e.what());
+  }
+}
+
+void ExecutionTraceRecorder::close() {
+  if (file == nullptr) {
+    return;
+  }
+  if (!block.empty()) {
+    _submit();
+  }
+  {
+    std::lock_guard lock(mutex);
+    done = true;
+  }
+  wake.notify_all();
+  writer.join();
+  if (fclose(file) != 0 && error.empty()) {
+    error = "Failed to close the execution trace";
+  }
+  file = nullptr;
+  _checkError();
+}
+
+void ExecutionTraceRecorder::_checkError() {
+  std::lock_guard lock(mutex);
+  if (!error.empty()) {
+    throw std::runtime_error(error);
+  }
+}
+
+void ExecutionTraceRecorder::record(const ExecutionRecord &current) {
+  if (block.size() + MAX_RECORD_SIZE > BLOCK_SIZE) {
+    _submit();
+  }
+
+  uint8_t flags = (current.size - 1) << 6;
+  if (current.pc != static_cast<uint16_t>(previous.pc + previous.size)) {
+    flags |= _explicitPC;
+  }
+  flags |= current.A != previous.A ? _changedA : 0;
+  flags |= current.X != previous.X ? _changedX : 0;
+  flags |= current.Y != previous.Y ? _changedY : 0;
+  flags |= current.P != previous.P ? _changedP : 0;
+  flags |= current.SP != previous.SP ? _changedSP : 0;
+
+  block.push_back(flags);
+  if (flags & _explicitPC) {
+    block.push_back(current.pc & 0xFF);
+    block.push_back(current.pc >> 8);
+  }
+  for (int i = 0; i < current.size; i++) {
+    block.push_back(current.bytes[i]);
+  }
+  if (flags & _changedA) {
+    block.push_back(current.A);
+  }
+  if (flags & _changedX) {
+    block.push_back(current.X);
+  }
+  if (flags & _changedY) {
+    block.push_back(current.Y);
+  }
+  if (flags & _changedP) {
+    block.push_back(current.P);
+  }
+  if (flags & _changedSP) {
+    block.push_back(current.SP);
+  }
+  // LEB128 varint; nearly always a single byte
+  uint64_t delta = current.cycle - previous.cycle;
+  while (delta >= 0x80) {
+    block.push_back((delta & 0x7F) | 0x80);
+    delta >>= 7;
+  }
+  block.push_back(delta);
+
+  previous = current;
+}
+
+void ExecutionTraceRecorder::flush() {
+  if (file == nullptr) {
+    return;
+  }
+  if (!block.empty()) {
+    _submit();
+  }
+  {
+    std::unique_lock lock(mutex);
+    wake.wait(lock, [this] { return pending.empty() && !writing; });
+    if (fflush(file) != 0 && error.empty()) {
+      error = "Failed to write the execution trace";
+    }
+  }
+  _checkError();
+}
+
+void ExecutionTraceRecorder::_submit() {
+  std::unique_lock lock(mutex);
+  wake.wait(lock, [this] { return pending.size() < MAX_PENDING; });
+  pending.push_back(std::move(block));
+  if (spare.empty()) {
+    block = {};
+    block.reserve(BLOCK_SIZE);
+  } else {
+    block = std::move(spare.back());
+    spare.pop_back();
+  }
+  previous = {};
+  lock.unlock();
+  wake.notify_all();
+}
+
+void ExecutionTraceRecorder::_writeLoop() {
+  std::vector<uint8_t> compressed;
+  while (true) {
+    std::vector<uint8_t> raw;
+    {
+      std::unique_lock lock(mutex);
+      wake.wait(lock, [this] { return !pending.empty() || done; });
+      if (pending.empty()) {
+        return;
+      }
+      raw = std::move(pending.front());
+      pending.pop_front();
+      writing = true;
+    }
+    wake.notify_all();
+
+    // Throwing here would terminate, so errors are kept for flush() and
+    // close(), and later blocks are dropped
+    std::string failure;
+    {
+      std::lock_guard lock(mutex);
+      failure = error;
+    }
+    if (failure.empty()) {
+      uLongf compressedSize = compressBound(raw.size());
+      compressed.resize(8 + compressedSize);
+      int result = compress2(compressed.data() + 8, &compressedSize,
+                             raw.data(), raw.size(), Z_BEST_SPEED);
+      if (result != Z_OK) {
+        failure = std::format("zlib compress2 failed with {}", result);
+      } else {
+        _writeU32(compressed.data(), raw.size());
+        _writeU32(compressed.data() + 4, compressedSize);
+        if (fwrite(compressed.data(), 8 + compressedSize, 1, file) != 1) {
+          failure = "Failed to write the execution trace";
+        }
+      }
+    }
+
+    raw.clear();
+    {
+      std::lock_guard lock(mutex);
+      spare.push_back(std::move(raw));
+      writing = false;
+      if (error.empty()) {
+        error = failure;
+      }
+    }
+    wake.notify_all();
+  }
+}
+
+ExecutionTraceReader::ExecutionTraceReader(const char *path) {
+  file = fopen(path, "rb");
+  if (file == nullptr) {
+    throw std::runtime_error(
+        std::format("Failed to open trace file at {}", path));
+  }
+  char magic[sizeof(MAGIC)];
+  if (fread(magic, sizeof(magic), 1, file) != 1 ||
+      memcmp(magic, MAGIC, sizeof(MAGIC)) != 0) {
+    fclose(file);
+    throw std::runtime_error(std::format("{} is not an execution trace", path));
+  }
+}
+
+ExecutionTraceReader::~ExecutionTraceReader() { fclose(file); }
+
+bool ExecutionTraceReader::_readBlock() {
+  uint8_t header[8];
+  size_t headerSize = fread(header, 1, sizeof(header), file);
+  if (headerSize == 0) {
+    return false;
+  } else if (headerSize != sizeof(header)) {
+    throw std::runtime_error("Truncated execution trace");
+  }
+  uLongf rawSize = _readU32(header);
+  uint32_t compressedSize = _readU32(header + 4);
+  // The recorder never writes more, so anything bigger is corruption
+  if (rawSize > ExecutionTraceRecorder::BLOCK_SIZE ||
+      compressedSize > compressBound(ExecutionTraceRecorder::BLOCK_SIZE)) {
+    throw std::runtime_error("Corrupt execution trace block header");
+  }
+
+  std::vector<uint8_t> compressed(compressedSize);
+  if (fread(compressed.data(), compressedSize, 1, file) != 1) {
+    throw std::runtime_error("Truncated execution trace");
+  }
+  block.resize(rawSize);
+  int result = uncompress(block.data(), &rawSize, compressed.data(),
+                          compressedSize);
+  if (result != Z_OK || rawSize != block.size()) {
+    throw std::runtime_error(
+        std::format("zlib uncompress failed with {}", result));
+  }
+  offset = 0;
+  previous = {};
+  return true;
+}
+
+bool ExecutionTraceReader::next(ExecutionRecord &current) {
+  while (offset >= block.size()) {
+    if (!_readBlock()) {
+      return false;
+    }
+  }
+
+  const uint8_t *src = block.data() + offset;
+  const uint8_t *end = block.data() + block.size();
+  // Records never straddle blocks, so running out is a truncated file
+  auto take = [&]() -> uint8_t {
+    if (src == end) {
+      throw std::runtime_error("Truncated execution trace record");
+    }
+    return *src++;
+  };
+  uint8_t flags = take();
+  current = previous;
+  current.size = (flags >> 6) + 1;
+  if (flags & _explicitPC) {
+    uint8_t low = take();
+    current.pc = low | (take() << 8);
+  } else {
+    current.pc = previous.pc + previous.size;
+  }
+  for (int i = 0; i < 3; i++) {
+    current.bytes[i] = i < current.size ? take() : 0;
+  }
+  if (flags & _changedA) {
+    current.A = take();
+  }
+  if (flags & _changedX) {
+    current.X = take();
+  }
+  if (flags & _changedY) {
+    current.Y = take();
+  }
+  if (flags & _changedP) {
+    current.P = take();
+  }
+  if (flags & _changedSP) {
+    current.SP = take();
+  }
+  uint64_t delta = 0;
+  for (int shift = 0;; shift += 7) {
+    if (shift >= 64) {
+      throw std::runtime_error("Malformed execution trace cycle delta");
+    }
+    uint8_t byte = take();
+    delta |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      break;
+    }
+  }
+  current.cycle = previous.cycle + delta;
+
+  offset = src - block.data();
+  previous = current;
+  return true;
+}
+
+bool parseNestestLine(const char *line, ExecutionRecord &record) {
+  // C000  4C F5 C5  JMP $C5F5    A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 21 CYC:7
+  if (strlen(line) < 16) {
+    return false;
+  }
+  char *end;
+  record.pc = strtoul(line, &end, 16);
+  if (end != line + 4) {
+    return false;
+  }
+  record.size = 0;
+  for (int i = 0; i < 3; i++) {
+    const char *byte = line + 6 + 3 * i;
+    if (*byte == ' ') {
+      break;
+    }
+    record.bytes[i] = strtoul(byte, nullptr, 16);
+    record.size += 1;
+  }
+
+  struct {
+    const char *label;
+    uint8_t *field;
+  } registers[] = {
+      {" A:", &record.A}, {" X:", &record.X},   {" Y:", &record.Y},
+      {" P:", &record.P}, {" SP:", &record.SP},
+  };
+  // Skip the disassembly column, it can contain "A:" lookalikes
+  const char *columns = line + 16;
+  for (auto &reg : registers) {
+    const char *found = strstr(columns, reg.label);
+    if (found == nullptr) {
+      return false;
+    }
+    *reg.field = strtoul(found + strlen(reg.label), nullptr, 16);
+  }
+  const char *cycle = strstr(columns, "CYC:");
+  if (cycle == nullptr) {
+    return false;
+  }
+  record.cycle = strtoull(cycle + 4, nullptr, 10);
+  return record.size > 0;
+}
+
+} // namespace NESPP
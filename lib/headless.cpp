@@ -0,0 +1,12 @@
+#include "../include/headless.h"
+#include <utility> // std::move
+
+namespace NESPP {
+
+HeadlessVM::HeadlessVM(std::shared_ptr<Rom> rom) : VM(std::move(rom)) {}
+
+HeadlessVM::HeadlessVM(uint8_t *flatBus) : VM(flatBus) {}
+
+void HeadlessVM::debug(std::string) {}
+
+} // namespace NESPP
@@ -59,22 +59,52 @@ Instruction _make(OpCode opCode, uint8_t **src) {
   return instruction;
 }
 
+uint8_t instructionSize(AddressingMode mode) {
+  using enum AddressingMode;
+  switch (mode) {
+  case absolute:
+  case indirect:
+    return 3;
+  case immediate:
+  case relative:
+  case zeropage:
+    return 2;
+  case accumulator:
+  case implied:
+    return 1;
+  }
+  return 1;
+}
+
+Instruction decodeInstruction(const uint8_t *bytes) {
+  using enum AddressingMode;
+  OpCode opCode = opCodeLookup[bytes[0]];
+  switch (opCode.addressing) {
+  case absolute:
+    return {opCode, {.absolute = {bytes[2], bytes[1]}}};
+  case indirect:
+    return {opCode, {.indirect = {bytes[2], bytes[1]}}};
+  case immediate:
+    return {opCode, {.immediate = bytes[1]}};
+  case relative:
+    return {opCode, {.relative = bytes[1]}};
+  case zeropage:
+    return {opCode, {.zeropage = bytes[1]}};
+  case accumulator:
+    return {opCode, {.accumulator = nullptr}};
+  case implied:
+    break;
+  }
+  return {opCode, {.implied = nullptr}};
+}
+
 bool OpCode::operator==(OpCode other) {
   return (type == other.type && addressing == other.addressing);
 }
 
 std::string OpCode::toString() {
-  int opcode = -1;
-  std::string operandString;
-
-  for (int i = 0; i <= 0xFF; i++) {
-    OpCode current = opCodeLookup[i];
-    if (*this == current) {
-      opcode = i;
-      break;
-    }
-  }
-
+  int opcode = opCodeByteLookup[static_cast<int>(type)]
+                               [static_cast<int>(addressing)];
   if (opcode == -1) {
     throw std::runtime_error("BUG");
   }
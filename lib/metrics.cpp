@@ -0,0 +1,185 @@
+#include "../include/metrics.h"
+#include <algorithm> // std::find
+#include <cstdio>    // for fopen, fputs
+#include <filesystem>
+#include <format>
+#include <vector>
+
+namespace NESPP {
+
+namespace {
+
+/// Plain snapshot of a VMMetrics
+struct _Values {
+  uint64_t instructions = 0;
+  uint64_t cycles = 0;
+  uint64_t frames = 0;
+  uint64_t reads[BUS_REGION_COUNT] = {0};
+  uint64_t writes[BUS_REGION_COUNT] = {0};
+  uint64_t bankSwitches = 0;
+  uint64_t tileCacheHits = 0;
+  uint64_t tileCacheMisses = 0;
+  uint64_t idleCyclesSkipped = 0;
+  uint64_t exceptions = 0;
+
+  void add(const VMMetrics &metrics) {
+    auto load = [](const VMMetrics::Counter &counter) {
+      return counter.load(std::memory_order_relaxed);
+    };
+    instructions += load(metrics.instructions);
+    cycles += load(metrics.cycles);
+    frames += load(metrics.frames);
+    for (int i = 0; i < BUS_REGION_COUNT; i++) {
+      reads[i] += load(metrics.reads[i]);
+      writes[i] += load(metrics.writes[i]);
+    }
+    bankSwitches += load(metrics.bankSwitches);
+    tileCacheHits += load(metrics.tileCacheHits);
+    tileCacheMisses += load(metrics.tileCacheMisses);
+    idleCyclesSkipped += load(metrics.idleCyclesSkipped);
+    exceptions += load(metrics.exceptions);
+  }
+
+  void add(const _Values &other) {
+    instructions += other.instructions;
+    cycles += other.cycles;
+    frames += other.frames;
+    for (int i = 0; i < BUS_REGION_COUNT; i++) {
+      reads[i] += other.reads[i];
+      writes[i] += other.writes[i];
+    }
+    bankSwitches += other.bankSwitches;
+    tileCacheHits += other.tileCacheHits;
+    tileCacheMisses += other.tileCacheMisses;
+    idleCyclesSkipped += other.idleCyclesSkipped;
+    exceptions += other.exceptions;
+  }
+};
+
+std::mutex _mutex;
+std::vector<VMMetrics *> _live;
+_Values _retired;
+uint64_t _nextId = 1;
+
+constexpr const char *_regionNames[BUS_REGION_COUNT] = {"ram", "ppu", "apu_io",
+                                                        "mapper"};
+
+void _family(std::string &out, const char *name, const char *help,
+             const std::vector<std::pair<std::string, _Values>> &series,
+             uint64_t _Values::*field) {
+  out += std::format("# HELP {} {}\n# TYPE {} counter\n", name, help, name);
+  for (auto &[vm, values] : series) {
+    out += std::format("{}{{vm=\"{}\"}} {}\n", name, vm, values.*field);
+  }
+}
+
+} // namespace
+
+namespace Metrics {
+
+void attach(VMMetrics *metrics) {
+  std::lock_guard lock(_mutex);
+  metrics->id = _nextId++;
+  _live.push_back(metrics);
+}
+
+void detach(VMMetrics *metrics) {
+  std::lock_guard lock(_mutex);
+  auto found = std::find(_live.begin(), _live.end(), metrics);
+  if (found != _live.end()) {
+    _retired.add(*metrics);
+    _live.erase(found);
+  }
+}
+
+std::string prometheusText() {
+  std::vector<std::pair<std::string, _Values>> series;
+  {
+    std::lock_guard lock(_mutex);
+    _Values all = _retired;
+    for (VMMetrics *metrics : _live) {
+      _Values values;
+      values.add(*metrics);
+      all.add(values);
+      series.emplace_back(std::format("{}", metrics->id), values);
+    }
+    series.emplace_back("all", all);
+  }
+
+  std::string out;
+  _family(out, "nespp_instructions_total", "Instructions retired.", series,
+          &_Values::instructions);
+  _family(out, "nespp_cycles_total", "CPU cycles executed.", series,
+          &_Values::cycles);
+  _family(out, "nespp_frames_total", "Frames completed.", series,
+          &_Values::frames);
+  _family(out, "nespp_bank_switches_total", "Mapper bank switches.", series,
+          &_Values::bankSwitches);
+  _family(out, "nespp_tile_cache_hits_total",
+          "PPU tile lookups served from the decoded tile cache.", series,
+          &_Values::tileCacheHits);
+  _family(out, "nespp_tile_cache_misses_total",
+          "PPU tile lookups that decoded the tile.", series,
+          &_Values::tileCacheMisses);
+  _family(out, "nespp_idle_cycles_skipped_total",
+          "CPU cycles fast-forwarded in idle loops.", series,
+          &_Values::idleCyclesSkipped);
+  _family(out, "nespp_exceptions_total", "Exceptions escaping VM::step.",
+          series, &_Values::exceptions);
+
+  const char *name = "nespp_bus_accesses_total";
+  out += std::format("# HELP {} CPU bus accesses by region.\n"
+                     "# TYPE {} counter\n",
+                     name, name);
+  for (auto &[vm, values] : series) {
+    for (int i = 0; i < BUS_REGION_COUNT; i++) {
+      out += std::format(
+          "{}{{vm=\"{}\",region=\"{}\",access=\"read\"}} {}\n"
+          "{}{{vm=\"{}\",region=\"{}\",access=\"write\"}} {}\n",
+          name, vm, _regionNames[i], values.reads[i], name, vm,
+          _regionNames[i], values.writes[i]);
+    }
+  }
+  return out;
+}
+
+} // namespace Metrics
+
+MetricsPublisher::MetricsPublisher(const char *path,
+                                   std::chrono::milliseconds interval)
+    : path(path), interval(interval) {
+  thread = std::thread([this] {
+    std::unique_lock lock(mutex);
+    while (!wake.wait_for(lock, this->interval, [this] { return stopping; })) {
+      lock.unlock();
+      publish();
+      lock.lock();
+    }
+  });
+}
+
+MetricsPublisher::~MetricsPublisher() {
+  {
+    std::lock_guard lock(mutex);
+    stopping = true;
+  }
+  wake.notify_one();
+  thread.join();
+  publish();
+}
+
+void MetricsPublisher::publish() {
+  std::string text = Metrics::prometheusText();
+  std::string temporary = path + ".tmp";
+  FILE *file = fopen(temporary.data(), "w");
+  if (file == nullptr) {
+    // Publishing is best-effort; the next interval will try again
+    return;
+  }
+  fputs(text.data(), file);
+  fclose(file);
+  std::error_code error;
+  std::filesystem::rename(temporary, path, error);
+}
+
+} // namespace NESPP
@@ -0,0 +1,634 @@
+#include "../include/ppu.h"
+#include "../include/cdl.h" // for CodeDataLogger
+#include "../include/chr.h" // for colourRow
+#include "../include/rom.h" // for Rom
+#include "../include/vm.h"  // for Mapper
+#include <algorithm>        // std::lower_bound
+#include <array>
+#include <bit>     // std::countr_zero
+#include <cstring> // for memset, memcpy
+#include <utility> // for std::move
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace NESPP {
+
+namespace {
+
+enum class _EventKind : uint8_t {
+  /// Render the line, then step v down a line and reload its X from t
+  render,
+  vblankStart,
+  vblankEnd,
+  /// Pre-render line: reload X from t
+  copyX,
+  /// Pre-render line: reload Y from t
+  copyY,
+};
+
+struct _Event {
+  /// Dot within the frame
+  uint32_t position;
+  _EventKind kind;
+  uint8_t line;
+};
+
+constexpr int _PRE_RENDER_LINE = 261;
+
+consteval std::array<_Event, PPU::HEIGHT + 4> _buildEvents() {
+  std::array<_Event, PPU::HEIGHT + 4> events = {};
+  auto at = [](int line, int dot) {
+    return static_cast<uint32_t>(line * PPU::DOTS_PER_SCANLINE + dot);
+  };
+  size_t i = 0;
+  for (int line = 0; line < PPU::HEIGHT; line++) {
+    events[i++] = {at(line, 257), _EventKind::render,
+                   static_cast<uint8_t>(line)};
+  }
+  events[i++] = {at(241, 1), _EventKind::vblankStart, 241};
+  events[i++] = {at(_PRE_RENDER_LINE, 1), _EventKind::vblankEnd, 0};
+  events[i++] = {at(_PRE_RENDER_LINE, 257), _EventKind::copyX, 0};
+  events[i++] = {at(_PRE_RENDER_LINE, 280), _EventKind::copyY, 0};
+  return events;
+}
+
+/// Sorted by position
+constexpr std::array<_Event, PPU::HEIGHT + 4> _EVENTS = _buildEvents();
+
+constexpr uint32_t _VBLANK_POSITION = 241 * PPU::DOTS_PER_SCANLINE + 1;
+
+/// Whether a sprite at y covers the line after line
+inline bool _spriteInRange(uint8_t y, int line, int height) {
+  return line >= y && line - y < height;
+}
+
+/// Bitmask of the sprites that cover the line after line
+uint64_t _spritesInRange(const uint8_t *oam, int line, int height) {
+  // In range when line - height < y <= line. Counting from the lowest y in
+  // range, that is one unsigned byte compare that cannot wrap past 255.
+  const uint8_t lowest = line >= height ? line - height + 1 : 0;
+  const uint8_t span = line - lowest;
+  uint64_t inRange = 0;
+#if defined(__SSE2__)
+  const __m128i yMask = _mm_set1_epi32(0xFF);
+  auto ys = [&](int sprite) {
+    // Four sprites, each one's y in the low byte of its 32-bit lane
+    return _mm_and_si128(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(oam + sprite * 4)),
+        yMask);
+  };
+  for (int i = 0; i < 64; i += 16) {
+    // Sixteen sprites' y in one byte each
+    __m128i y = _mm_packus_epi16(_mm_packs_epi32(ys(i), ys(i + 4)),
+                                 _mm_packs_epi32(ys(i + 8), ys(i + 12)));
+    __m128i offset = _mm_sub_epi8(y, _mm_set1_epi8(lowest));
+    __m128i found = _mm_cmpeq_epi8(
+        _mm_min_epu8(offset, _mm_set1_epi8(span)), offset);
+    inRange |= static_cast<uint64_t>(_mm_movemask_epi8(found)) << i;
+  }
+#else
+  for (int i = 0; i < 64; i++) {
+    if (static_cast<uint8_t>(oam[i * 4] - lowest) <= span) {
+      inRange |= static_cast<uint64_t>(1) << i;
+    }
+  }
+#endif
+  return inRange;
+}
+
+/// Mirrors a row of eight pixels, one per byte
+inline uint64_t _flipRow(uint64_t row) {
+  row = ((row & 0x00FF00FF00FF00FF) << 8) | ((row >> 8) & 0x00FF00FF00FF00FF);
+  row = ((row & 0x0000FFFF0000FFFF) << 16) |
+        ((row >> 16) & 0x0000FFFF0000FFFF);
+  return (row << 32) | (row >> 32);
+}
+
+} // namespace
+
+PPU::PPU(std::shared_ptr<Rom> _rom, Mapper *mapper)
+    : rom(std::move(_rom)), mapper(mapper),
+      _tiles(rom->chrSize == 0 ? chrRam : rom->chrBlob,
+             rom->chrSize == 0 ? sizeof(chrRam) : rom->chrSize,
+             rom->chrSize == 0) {
+  remap();
+  _seekEvent();
+}
+
+void PPU::loadState(const PPUState &state) {
+  static_cast<PPUState &>(*this) = state;
+  _tiles.invalidateAll();
+  remap();
+  _drawFrame = _drawsFrame();
+  _seekEvent();
+}
+
+void PPU::_seekEvent() {
+  uint64_t frameStart = cycle - cycle % DOTS_PER_FRAME;
+  uint32_t position = cycle - frameStart;
+  auto next = std::lower_bound(
+      _EVENTS.begin(), _EVENTS.end(), position,
+      [](const _Event &event, uint32_t p) { return event.position < p; });
+  if (next == _EVENTS.end()) {
+    next = _EVENTS.begin();
+    frameStart += DOTS_PER_FRAME;
+  }
+  _event = next - _EVENTS.begin();
+  _nextEventCycle = frameStart + next->position;
+  _updateDeadline();
+}
+
+void PPU::_updateDeadline() {
+  if (nmiPending) {
+    deadline = cycle;
+    return;
+  }
+  // cycle is the next dot to run, so vblank has started once it is past
+  // the vblank dot
+  uint64_t vblank = cycle - cycle % DOTS_PER_FRAME + _VBLANK_POSITION + 1;
+  deadline = cycle < vblank ? vblank : vblank + DOTS_PER_FRAME;
+}
+
+void PPU::acknowledgeNmi() {
+  nmiPending = false;
+  _updateDeadline();
+}
+
+void PPU::_runEvents(uint64_t target) {
+  while (_nextEventCycle < target) {
+    const _Event &event = _EVENTS[_event];
+    // The event's dot has run
+    cycle = _nextEventCycle + 1;
+    switch (event.kind) {
+    case _EventKind::render:
+      if (_drawFrame) {
+        _renderScanline(event.line);
+      } else {
+        _skipScanline(event.line);
+      }
+      if (_renderingEnabled()) {
+        _incrementY();
+        v = (v & ~0x041F) | (t & 0x041F);
+        // Sprite fetches for the next line reset it
+        oamAddress = 0;
+      }
+      break;
+    case _EventKind::vblankStart:
+      status |= 0x80;
+      frames += 1;
+      if (control & 0x80) {
+        nmiPending = true;
+      }
+      _updateDeadline();
+      break;
+    case _EventKind::vblankEnd:
+      // Vblank, sprite 0 hit and sprite overflow
+      status &= ~0xE0;
+      // The next frame starts here
+      _drawFrame = _drawsFrame();
+      break;
+    case _EventKind::copyX:
+      if (_renderingEnabled()) {
+        v = (v & ~0x041F) | (t & 0x041F);
+        oamAddress = 0;
+      }
+      break;
+    case _EventKind::copyY:
+      if (_renderingEnabled()) {
+        v = (v & ~0x7BE0) | (t & 0x7BE0);
+      }
+      break;
+    }
+
+    uint64_t frameStart = _nextEventCycle - event.position;
+    _event += 1;
+    if (_event == _EVENTS.size()) {
+      _event = 0;
+      frameStart += DOTS_PER_FRAME;
+    }
+    _nextEventCycle = frameStart + _EVENTS[_event].position;
+  }
+}
+
+uint8_t PPU::read(uint8_t reg) {
+  switch (reg) {
+  case 2: {
+    uint8_t value = (status & 0xE0) | (openBus & 0x1F);
+    status &= ~0x80;
+    writeToggle = false;
+    openBus = value;
+    return value;
+  }
+  case 4:
+    openBus = inspect(4);
+    return openBus;
+  case 7: {
+    uint16_t address = v & 0x3FFF;
+    uint8_t value;
+    if (address >= 0x3F00) {
+      // Palette reads are immediate, but still refill the buffer from the
+      // nametable underneath
+      value = (palette[_paletteIndex(address)] & 0x3F) | (openBus & 0xC0);
+      readBuffer = peekVram(address - 0x1000);
+    } else {
+      value = readBuffer;
+      readBuffer = peekVram(address);
+    }
+    v = (v + _increment()) & 0x7FFF;
+    openBus = value;
+    return value;
+  }
+  default:
+    // Write-only
+    return openBus;
+  }
+}
+
+uint8_t PPU::inspect(uint8_t reg) const {
+  switch (reg) {
+  case 2:
+    return (status & 0xE0) | (openBus & 0x1F);
+  case 4:
+    // Attribute bits 2-4 do not exist
+    return (oamAddress & 0x03) == 2 ? oam[oamAddress] & 0xE3
+                                    : oam[oamAddress];
+  case 7: {
+    uint16_t address = v & 0x3FFF;
+    return address >= 0x3F00 ? palette[_paletteIndex(address)] : readBuffer;
+  }
+  default:
+    return openBus;
+  }
+}
+
+void PPU::write(uint8_t reg, uint8_t value) {
+  openBus = value;
+  switch (reg) {
+  case 0:
+    // Enabling NMIs during vblank raises one straight away
+    if (!(control & 0x80) && (value & 0x80) && (status & 0x80)) {
+      nmiPending = true;
+      _updateDeadline();
+    }
+    control = value;
+    t = (t & ~0x0C00) | ((value & 0x03) << 10);
+    break;
+  case 1:
+    mask = value;
+    break;
+  case 3:
+    oamAddress = value;
+    break;
+  case 4:
+    oam[oamAddress++] = value;
+    break;
+  case 5:
+    if (!writeToggle) {
+      t = (t & ~0x001F) | (value >> 3);
+      fineX = value & 0x07;
+    } else {
+      t = (t & ~0x73E0) | ((value & 0x07) << 12) | ((value & 0xF8) << 2);
+    }
+    writeToggle = !writeToggle;
+    break;
+  case 6:
+    if (!writeToggle) {
+      t = (t & 0x00FF) | ((value & 0x3F) << 8);
+    } else {
+      t = (t & 0xFF00) | value;
+      v = t;
+    }
+    writeToggle = !writeToggle;
+    break;
+  case 7:
+    _pokeVram(v & 0x3FFF, value);
+    v = (v + _increment()) & 0x7FFF;
+    break;
+  default:
+    break;
+  }
+}
+
+void PPU::writeOam(const uint8_t *source) {
+  size_t first = sizeof(oam) - oamAddress;
+  memcpy(oam + oamAddress, source, first);
+  memcpy(oam, source + first, oamAddress);
+}
+
+size_t PPU::_paletteIndex(uint16_t address) const {
+  size_t index = address & 0x1F;
+  // Sprite colour 0 entries mirror the background ones
+  return (index & 0x13) == 0x10 ? index & 0x0F : index;
+}
+
+int32_t PPU::_chrOffset(uint16_t address) const {
+  int32_t page = _chrPages[(address >> 10) & 0x07];
+  return page < 0 ? -1 : page + (address & 0x3FF);
+}
+
+void PPU::remap() {
+  // Unmapped CHR reads as zeros
+  static const uint8_t unmapped[0x400] = {0};
+  const bool ram = rom->chrSize == 0;
+  uint8_t *chr = ram ? chrRam : rom->chrBlob;
+  for (int i = 0; i < 8; i++) {
+    int32_t offset = ram ? i * 0x400 : mapper->chrOffset(i * 0x400);
+    _chrPages[i] = offset;
+    _readPages[i] = offset < 0 ? unmapped : chr + offset;
+    // CHR ROM is read-only
+    _writePages[i] = offset < 0 || !ram ? _discarded : chr + offset;
+  }
+
+  // The 1 KiB of nametables shown at $2000, $2400, $2800 and $2C00, by
+  // Mirroring; $3000-$3EFF shows the same
+  static constexpr uint8_t layouts[][4] = {
+      {0, 0, 1, 1}, {0, 1, 0, 1}, {0, 0, 0, 0}, {1, 1, 1, 1}, {0, 1, 2, 3},
+  };
+  const uint8_t *layout = layouts[static_cast<int>(mapper->mirroring())];
+  for (int i = 0; i < 8; i++) {
+    uint8_t *page = nametables + layout[i % 4] * 0x400;
+    _readPages[8 + i] = page;
+    _writePages[8 + i] = page;
+  }
+}
+
+uint8_t PPU::peekVram(uint16_t address) const {
+  address &= 0x3FFF;
+  if (address >= 0x3F00) {
+    return palette[_paletteIndex(address)];
+  }
+  return _vram(address);
+}
+
+void PPU::_pokeVram(uint16_t address, uint8_t value) {
+  if (address >= 0x3F00) {
+    palette[_paletteIndex(address)] = value;
+    return;
+  }
+  _writePages[address >> 10][address & 0x3FF] = value;
+  if (address < 0x2000 && rom->chrSize == 0) {
+    _tiles.invalidate(_chrOffset(address));
+  }
+}
+
+void PPU::_incrementY() {
+  if ((v & 0x7000) != 0x7000) {
+    v += 0x1000;
+    return;
+  }
+  v &= ~0x7000;
+  uint16_t coarseY = (v >> 5) & 0x1F;
+  if (coarseY == 29) {
+    coarseY = 0;
+    v ^= 0x0800;
+  } else if (coarseY == 31) {
+    // Out of range; wraps without switching nametables
+    coarseY = 0;
+  } else {
+    coarseY += 1;
+  }
+  v = (v & ~0x03E0) | (coarseY << 5);
+}
+
+uint64_t PPU::_tileRow(int32_t offset, int row) {
+  // Unmapped CHR reads as zeros
+  if (offset < 0) {
+    return 0;
+  }
+  uint64_t pixels;
+  memcpy(&pixels, _tiles.tile(offset) + row * 8, 8);
+  if (cdl != nullptr && rom->chrSize != 0) {
+    cdl->markRendered(offset + row);
+    cdl->markRendered(offset + row + 8);
+  }
+  return pixels;
+}
+
+uint64_t PPU::_spriteRow(int line, int index) {
+  const uint8_t *sprite = oam + index * 4;
+  const uint8_t tile = sprite[1];
+  const uint8_t attributes = sprite[2];
+  const bool tall = control & 0x20;
+  // Evaluated on the line before, and drawn a line below their y
+  int row = line - 1 - sprite[0];
+  if (attributes & 0x80) {
+    row = (tall ? 15 : 7) - row;
+  }
+
+  uint16_t address;
+  if (tall) {
+    // Bit 0 picks the pattern table, and the bottom half is the next tile
+    address = ((tile & 0x01) << 12) | ((tile & 0xFE) << 4) |
+              ((row & 0x08) << 1);
+  } else {
+    address = (control & 0x08 ? 0x1000 : 0x0000) | (tile << 4);
+  }
+  uint64_t pixels = _tileRow(_chrOffset(address), row & 0x07);
+  return attributes & 0x40 ? _flipRow(pixels) : pixels;
+}
+
+void PPU::_renderBackground(uint8_t *pixels) {
+  // The four 1 KiB pages of the background's pattern table
+  const int32_t *pages = _chrPages + (control & 0x10 ? 4 : 0);
+  const int fineY = (v >> 12) & 0x07;
+
+  // Fine X can push the line up to 7 pixels into a 33rd tile
+  constexpr int tiles = WIDTH / 8 + 1;
+  // Eight pixels per word, in memory order
+  uint64_t row[tiles];
+  uint16_t address = v;
+  for (int i = 0; i < tiles; i++) {
+    uint8_t tile = _vram(0x2000 | (address & 0x0FFF));
+    uint8_t attribute =
+        _vram(0x23C0 | (address & 0x0C00) | ((address >> 4) & 0x38) |
+              ((address >> 2) & 0x07));
+    // Each attribute byte covers 4x4 tiles, two bits per 2x2 quadrant
+    int shift = ((address >> 4) & 0x04) | (address & 0x02);
+    attribute = ((attribute >> shift) & 0x03) << 2;
+
+    int32_t page = pages[tile >> 6];
+    uint64_t colours =
+        _tileRow(page < 0 ? -1 : page + ((tile & 0x3F) << 4), fineY);
+    row[i] = colourRow(colours, attribute);
+
+    // Coarse X, wrapping into the horizontally adjacent nametable
+    if ((address & 0x001F) == 31) {
+      address = (address & ~0x001F) ^ 0x0400;
+    } else {
+      address += 1;
+    }
+  }
+  memcpy(pixels, reinterpret_cast<uint8_t *>(row) + fineX, WIDTH);
+}
+
+int PPU::_evaluateSprites(int line, uint8_t *selected) {
+  const int height = control & 0x20 ? 16 : 8;
+  uint64_t inRange = _spritesInRange(oam, line, height);
+  int count = 0;
+  for (; inRange != 0 && count < 8; count++) {
+    selected[count] = std::countr_zero(inRange);
+    inRange &= inRange - 1;
+  }
+  if (count < 8) {
+    return count;
+  }
+
+  // Having found 8, the hardware looks on for a ninth to set the overflow
+  // flag, but steps through each sprite's bytes as it steps through the
+  // sprites, so it takes tiles, attributes and X for Y. See
+  // https://www.nesdev.org/wiki/PPU_sprite_evaluation
+  int byte = 0;
+  for (int n = selected[7] + 1; n < 64; n++) {
+    if (_spriteInRange(oam[n * 4 + byte], line, height)) {
+      status |= 0x20;
+      break;
+    }
+    byte = (byte + 1) & 0x03;
+  }
+  return count;
+}
+
+void PPU::_renderSprites(int line, const uint8_t *selected, int count,
+                         uint8_t *pixels) {
+  memset(pixels, 0, WIDTH);
+  for (int i = 0; i < count; i++) {
+    const uint8_t *sprite = oam + selected[i] * 4;
+    const uint8_t attributes = sprite[2];
+    uint64_t colours = _spriteRow(line, selected[i]);
+    colours = colourRow(colours, 0x10 | ((attributes & 0x03) << 2));
+    uint8_t row8[8];
+    memcpy(row8, &colours, 8);
+
+    const uint8_t flags =
+        (attributes & 0x20) | (selected[i] == 0 ? 0x40 : 0x00);
+    const int x = sprite[3];
+    const int width = std::min(8, WIDTH - x);
+    for (int j = 0; j < width; j++) {
+      // Earlier sprites win, even where they are behind the background
+      if (row8[j] != 0 && pixels[x + j] == 0) {
+        pixels[x + j] = row8[j] | flags;
+      }
+    }
+  }
+}
+
+void PPU::_renderScanline(int line) {
+  uint8_t pixels[WIDTH];
+  if (mask & 0x08) {
+    _renderBackground(pixels);
+    if (!(mask & 0x02)) {
+      // Background hidden in the leftmost 8 pixels
+      memset(pixels, 0, 8);
+    }
+  } else {
+    memset(pixels, 0, WIDTH);
+  }
+
+  // Evaluated on the line before; the pre-render line evaluates none, so
+  // line 0 has no sprites
+  uint8_t selected[8];
+  int count = 0;
+  if (_renderingEnabled() && line > 0) {
+    count = _evaluateSprites(line - 1, selected);
+  }
+
+  uint16_t *out = framebuffer + line * WIDTH;
+  uint8_t colours[32];
+  for (int i = 0; i < 32; i++) {
+    // Transparent pixels show the backdrop, palette entry 0
+    colours[i] = palette[i % 4 == 0 ? 0 : i];
+  }
+  uint8_t greyscale = mask & 0x01 ? 0x30 : 0x3F;
+  uint16_t emphasis = (mask & 0xE0) << 1;
+  for (int x = 0; x < WIDTH; x++) {
+    out[x] = (colours[pixels[x]] & greyscale) | emphasis;
+  }
+  if (!(mask & 0x10) || count == 0) {
+    return;
+  }
+
+  uint8_t sprites[WIDTH];
+  _renderSprites(line, selected, count, sprites);
+  if (!(mask & 0x04)) {
+    // Sprites hidden in the leftmost 8 pixels
+    memset(sprites, 0, 8);
+  }
+  // Only the at most 64 pixels under a sprite can change; overlaps are
+  // visited twice, to the same effect
+  for (int i = 0; i < count; i++) {
+    const int left = oam[selected[i] * 4 + 3];
+    const int right = std::min(left + 8, WIDTH);
+    for (int x = left; x < right; x++) {
+      uint8_t sprite = sprites[x];
+      if (sprite == 0) {
+        continue;
+      }
+      bool backgroundOpaque = pixels[x] & 0x03;
+      // Clipped pixels are already transparent, and there is never a hit
+      // at x = 255
+      if ((sprite & 0x40) && backgroundOpaque && x != WIDTH - 1) {
+        status |= 0x40;
+      }
+      if (!(sprite & 0x20) || !backgroundOpaque) {
+        out[x] = (colours[sprite & 0x1F] & greyscale) | emphasis;
+      }
+    }
+  }
+}
+
+void PPU::_skipScanline(int line) {
+  if (!_renderingEnabled() || line == 0) {
+    return;
+  }
+  // Evaluation is cheap and sets the overflow flag
+  uint8_t selected[8];
+  int count = _evaluateSprites(line - 1, selected);
+  // Sprite 0 is selected first if at all, and can only hit once a frame
+  if (count == 0 || selected[0] != 0 || (mask & 0x18) != 0x18 ||
+      (status & 0x40)) {
+    return;
+  }
+
+  // Screen pixel x is pixel x + fineX of the line's tiles, which start at
+  // v; the 8 under sprite 0 straddle at most two tiles
+  const int x = oam[3];
+  const int position = x + fineX;
+  const uint16_t table = control & 0x10 ? 0x1000 : 0x0000;
+  const int fineY = (v >> 12) & 0x07;
+  auto backgroundRow = [&](int tiles) {
+    uint16_t address = v;
+    int coarseX = (address & 0x001F) + tiles;
+    for (; coarseX >= 32; coarseX -= 32) {
+      address ^= 0x0400;
+    }
+    address = (address & ~0x001F) | coarseX;
+    uint8_t tile = _vram(0x2000 | (address & 0x0FFF));
+    return _tileRow(_chrOffset(table | (tile << 4)), fineY);
+  };
+  const int shift = position % 8 * 8;
+  uint64_t background = backgroundRow(position / 8) >> shift;
+  if (shift != 0) {
+    background |= backgroundRow(position / 8 + 1) << (64 - shift);
+  }
+
+  // Pixels are 0-3, one per byte; a hit is both opaque in the same byte
+  constexpr uint64_t broadcast = 0x0101010101010101;
+  uint64_t sprite = _spriteRow(line, 0);
+  uint64_t hits = (background | (background >> 1)) &
+                  (sprite | (sprite >> 1)) & broadcast;
+  // Either layer clipped on the left hides the leftmost 8 pixels, and
+  // there is never a hit at x = 255
+  const int left = (mask & 0x06) == 0x06 ? 0 : 8;
+  for (int i = 0; i < 8; i++) {
+    if (x + i < left || x + i >= WIDTH - 1) {
+      hits &= ~(static_cast<uint64_t>(0xFF) << (i * 8));
+    }
+  }
+  if (hits != 0) {
+    status |= 0x40;
+  }
+}
+
+} // namespace NESPP
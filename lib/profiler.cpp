@@ -0,0 +1,80 @@
+#include "../include/profiler.h"
+#include "../include/disassembler.h" // for formatInstruction
+#include "../include/instructions.h" // for opCodeLookup
+#include "../include/vm.h"           // for VM
+#include <algorithm>                 // std::partial_sort, std::sort
+#include <format>
+#include <vector>
+
+namespace NESPP {
+
+void GuestProfiler::clear() {
+  std::fill(std::begin(byAddress), std::end(byAddress), Counter{});
+  std::fill(std::begin(byOpCode), std::end(byOpCode), Counter{});
+}
+
+GuestProfiler::Counter GuestProfiler::total() {
+  Counter sum;
+  for (const Counter &counter : byOpCode) {
+    sum.count += counter.count;
+    sum.cycles += counter.cycles;
+  }
+  return sum;
+}
+
+std::string GuestProfiler::report(VM &vm, size_t top) {
+  Counter sum = total();
+  double percentScale = sum.cycles == 0 ? 0 : 100.0 / sum.cycles;
+  std::string out = std::format("{} instructions, {} cycles\n\n", sum.count,
+                                sum.cycles);
+
+  std::vector<uint16_t> addresses;
+  for (uint32_t address = 0; address < 0x10000; address++) {
+    if (byAddress[address].count > 0) {
+      addresses.push_back(address);
+    }
+  }
+  auto byCycles = [this](uint16_t a, uint16_t b) {
+    return byAddress[a].cycles > byAddress[b].cycles;
+  };
+  top = std::min(top, addresses.size());
+  std::partial_sort(addresses.begin(), addresses.begin() + top,
+                    addresses.end(), byCycles);
+
+  out += "      cycles       %        count  address  instruction\n";
+  for (size_t i = 0; i < top; i++) {
+    uint16_t address = addresses[i];
+    const Counter &counter = byAddress[address];
+    uint8_t bytes[3];
+    for (int j = 0; j < 3; j++) {
+      bytes[j] = vm.inspect(address + j);
+    }
+    // Self-modifying code may have replaced what actually ran
+    char text[32];
+    formatInstruction(text, sizeof(text), address, bytes);
+    out += std::format("{:12} {:6.2f}% {:12}  ${:04X}    {}\n", counter.cycles,
+                       counter.cycles * percentScale, counter.count, address,
+                       text);
+  }
+
+  std::vector<int> opCodes;
+  for (int opCode = 0; opCode < 0x100; opCode++) {
+    if (byOpCode[opCode].count > 0) {
+      opCodes.push_back(opCode);
+    }
+  }
+  std::sort(opCodes.begin(), opCodes.end(), [this](int a, int b) {
+    return byOpCode[a].cycles > byOpCode[b].cycles;
+  });
+  out += "\n      cycles       %        count  opcode\n";
+  for (int opCode : opCodes) {
+    const Counter &counter = byOpCode[opCode];
+    OpCode code = opCodeLookup[opCode];
+    out += std::format("{:12} {:6.2f}% {:12}  {}\n", counter.cycles,
+                       counter.cycles * percentScale, counter.count,
+                       code.toString());
+  }
+  return out;
+}
+
+} // namespace NESPP
@@ -0,0 +1,55 @@
+#include "../include/rewind.h"
+#include <format>
+#include <stdexcept> // std::runtime_error
+
+namespace NESPP {
+
+RewindBuffer::RewindBuffer(uint64_t interval, size_t capacity)
+    : interval(interval), slots(capacity) {
+  if (interval == 0 || (interval & (interval - 1)) != 0) {
+    throw std::runtime_error(
+        std::format("Rewind interval must be a power of two, got {}",
+                    interval));
+  }
+  if (capacity == 0) {
+    throw std::runtime_error("Rewind capacity must be positive");
+  }
+}
+
+void RewindBuffer::capture(VM &vm) {
+  // After rewinding, running forward again recaptures the same points
+  if (vm.instructions == 0) {
+    count = 0;
+  } else {
+    truncate(vm.instructions - 1);
+  }
+  if (count == slots.size()) {
+    first = (first + 1) % slots.size();
+    count -= 1;
+  }
+  vm.saveState(_at(count));
+  count += 1;
+}
+
+const VMState *RewindBuffer::keyframeAtOrBefore(uint64_t instruction) const {
+  // Newest first; there are at most a few hundred
+  for (size_t i = count; i > 0; i--) {
+    const VMState &state = _at(i - 1);
+    if (state.instructions <= instruction) {
+      return &state;
+    }
+  }
+  return nullptr;
+}
+
+void RewindBuffer::truncate(uint64_t instruction) {
+  while (count > 0 && _at(count - 1).instructions > instruction) {
+    count -= 1;
+  }
+}
+
+uint64_t RewindBuffer::oldest() const {
+  return count == 0 ? UINT64_MAX : _at(0).instructions;
+}
+
+} // namespace NESPP
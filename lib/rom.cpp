@@ -12,19 +12,36 @@
 
 #include <cstdint>
 #include <cstdio>
+#include <cstring> // for memcpy
 #include <format>
 #include <stdexcept>
+#include <vector>
 
 #include "../include/rom.h"
 
 Rom::Rom(const char *path) {
-  uint8_t headerBytes[HEADER_SIZE];
-
   FILE *f = fopen(path, "rb");
   if (f == nullptr) {
     throw std::runtime_error(std::format("Failed to open a ROM at {}", path));
   }
-  fread(&headerBytes, HEADER_SIZE, 1, f);
+  std::vector<uint8_t> image;
+  uint8_t chunk[0x4000];
+  size_t read;
+  while ((read = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+    image.insert(image.end(), chunk, chunk + read);
+  }
+  fclose(f);
+
+  _parse(image.data(), image.size());
+}
+
+Rom::Rom(const uint8_t *image, size_t size) { _parse(image, size); }
+
+void Rom::_parse(const uint8_t *image, size_t size) {
+  if (size < HEADER_SIZE) {
+    throw "Unknown ROM format!";
+  }
+  const uint8_t *headerBytes = image;
 
   if (headerBytes[0] != 'N' || headerBytes[1] != 'E' || headerBytes[2] != 'S' ||
       headerBytes[3] != 0x1a) {
@@ -55,20 +72,24 @@ Rom::Rom(const char *path) {
 
   // TODO parse flags 8-10
 
+  if (size < prgStart() + prgSize + chrSize) {
+    throw std::runtime_error(
+        std::format("ROM is truncated: {} bytes, expected {}", size,
+                    prgStart() + prgSize + chrSize));
+  }
+
   prgBlob = new uint8_t[prgSize];
-  fread(prgBlob, prgSize, 1, f);
+  memcpy(prgBlob, image + prgStart(), prgSize);
   // printf("read %d bytes of PRG ROM.\n", rom->prgSize);
 
   chrBlob = new uint8_t[chrSize];
-  fread(chrBlob, chrSize, 1, f);
+  memcpy(chrBlob, image + chrStart(), chrSize);
   // printf("read %d bytes of CHR ROM.\n", rom->chrSize);
-
-  fclose(f);
 }
 
 Rom::~Rom() {
-  delete prgBlob;
-  delete chrBlob;
+  delete[] prgBlob;
+  delete[] chrBlob;
 }
 
 inline size_t Rom::prgStart() { return HEADER_SIZE; }
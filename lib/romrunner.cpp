@@ -0,0 +1,350 @@
+#include "../include/romrunner.h"
+#include "../include/callgraph.h"    // for CallGraphProfiler
+#include "../include/cdl.h"          // for CodeDataLogger
+#include "../include/headless.h"     // for HeadlessVM
+#include "../include/instructions.h" // for Instruction, OpCodeType
+#include "../include/profiler.h"     // for GuestProfiler
+#include "../include/rom.h"          // for Rom
+#include "../include/timeline.h"     // for TimelineSpan
+#include "../include/watch.h"        // for WatchpointSet
+#include "../include/word.h"         // for Word
+#include <algorithm>                 // std::min, std::max
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <format>
+#include <memory>
+#include <thread>
+
+namespace NESPP {
+
+namespace {
+
+/// Instructions between checks of the result protocol and idle detection
+constexpr int CHECK_INTERVAL = 4096;
+
+/// Blargg ROMs ask for a reset and expect it no sooner than ~100ms later
+constexpr uint64_t RESET_DELAY_CYCLES = 179'000;
+
+/// A window whose PCs all fall within this many bytes may be a spin loop
+constexpr int IDLE_PC_RANGE = 16;
+
+struct _IdleSnapshot {
+  uint16_t PC;
+  uint8_t A, X, Y, S, SP;
+
+  bool operator==(const _IdleSnapshot &) const = default;
+};
+
+_IdleSnapshot _snapshot(VM &vm) {
+  return {vm.PC.to16(), vm.A, vm.X, vm.Y, vm.S, vm.SP};
+}
+
+bool _hasBlarggSignature(VM &vm) {
+  return vm.inspect(0x6001) == 0xDE && vm.inspect(0x6002) == 0xB0 &&
+         vm.inspect(0x6003) == 0x61;
+}
+
+std::string _blarggText(VM &vm) {
+  std::string text;
+  for (uint16_t address = 0x6004; address < 0x8000; address++) {
+    uint8_t c = vm.inspect(address);
+    if (c == 0) {
+      break;
+    }
+    text.push_back(static_cast<char>(c));
+  }
+  return text;
+}
+
+void _appendJsonString(std::string &out, const std::string &value) {
+  out.push_back('"');
+  for (char c : value) {
+    switch (c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        out += std::format("\\u{:04x}", c);
+      } else {
+        out.push_back(c);
+      }
+    }
+  }
+  out.push_back('"');
+}
+
+void _runVM(RomResult &result, const RomRunOptions &options, VM &vm) {
+  std::string name = std::filesystem::path(result.path).filename().string();
+  bool isNestest = name.find("nestest") != std::string::npos;
+  // State after the power-on reset sequence
+  vm.cycles = 7;
+  vm.SP = 0xFD;
+  vm.S = 0x24;
+  if (isNestest) {
+    // Automation mode skips the menu and needs no PPU
+    result.protocol = RomProtocol::nestest;
+    vm.PC = Word(0xC000);
+  } else {
+    vm.PC = {vm.inspect(0xFFFD), vm.inspect(0xFFFC)};
+  }
+
+  uint64_t resetAt = 0;
+  int idleWindows = 0;
+  _IdleSnapshot lastSnapshot = _snapshot(vm);
+  while (vm.cycles < options.maxCycles) {
+    uint16_t low = 0xFFFF;
+    uint16_t high = 0;
+    TimelineSpan span = {"cpu"};
+    for (int i = 0; i < CHECK_INTERVAL; i++) {
+      uint16_t pc = vm.PC.to16();
+      low = std::min(low, pc);
+      high = std::max(high, pc);
+      Instruction instruction = vm.step();
+      result.instructions += 1;
+      result.cycles = vm.cycles;
+
+      // nestest's top-level routine returns past the initial stack frame
+      if (isNestest && instruction.opCode.type == OpCodeType::RTS &&
+          vm.SP == 0xFF) {
+        uint8_t official = vm.inspect(0x02);
+        uint8_t unofficial = vm.inspect(0x03);
+        result.code = official | (unofficial << 8);
+        result.status = result.code == 0 ? RomStatus::pass : RomStatus::fail;
+        result.message = std::format("$02=${:02X} $03=${:02X}", official,
+                                     unofficial);
+        return;
+      }
+    }
+
+    if (!isNestest && _hasBlarggSignature(vm)) {
+      result.protocol = RomProtocol::blargg;
+      uint8_t status = vm.inspect(0x6000);
+      if (status < 0x80) {
+        result.code = status;
+        result.status = status == 0 ? RomStatus::pass : RomStatus::fail;
+        result.message = _blarggText(vm);
+        return;
+      } else if (status == 0x81) {
+        if (resetAt == 0) {
+          resetAt = vm.cycles + RESET_DELAY_CYCLES;
+        } else if (vm.cycles >= resetAt) {
+          vm.reset();
+          resetAt = 0;
+        }
+      }
+    }
+
+    // Spinning in a few bytes of code with registers unchanged between
+    // windows: nothing observable is going to happen. Except while a
+    // requested reset is pending, which blargg ROMs wait for in a spin loop.
+    _IdleSnapshot snapshot = _snapshot(vm);
+    if (resetAt == 0 && high - low < IDLE_PC_RANGE &&
+        snapshot == lastSnapshot) {
+      idleWindows += 1;
+    } else {
+      idleWindows = 0;
+    }
+    lastSnapshot = snapshot;
+    if (options.idleWindows > 0 && idleWindows >= options.idleWindows) {
+      result.status = RomStatus::idle;
+      if (result.protocol == RomProtocol::blargg) {
+        result.message = _blarggText(vm);
+      }
+      return;
+    }
+  }
+  result.status = RomStatus::timeout;
+}
+
+void _run(RomResult &result, const RomRunOptions &options) {
+  std::shared_ptr<Rom> rom{new Rom(result.path.c_str())};
+  HeadlessVM vm = {rom};
+  vm.ppu->renderEvery = options.renderEvery;
+
+  std::unique_ptr<GuestProfiler> profiler;
+  if (options.profileTop > 0) {
+    profiler = std::make_unique<GuestProfiler>();
+    vm.profiler = profiler.get();
+  }
+  std::unique_ptr<CallGraphProfiler> callGraph;
+  if (options.callGraph) {
+    callGraph = std::make_unique<CallGraphProfiler>();
+    vm.callGraph = callGraph.get();
+  }
+  std::unique_ptr<CodeDataLogger> cdl;
+  if (!options.cdlDirectory.empty()) {
+    cdl = std::make_unique<CodeDataLogger>(rom->prgSize, rom->chrSize);
+    vm.cdl = cdl.get();
+  }
+  WatchpointSet watchpoints;
+  if (!options.watchpoints.empty()) {
+    for (Watchpoint watchpoint : options.watchpoints) {
+      watchpoint.action = WatchAction::log;
+      watchpoints.add(watchpoint);
+    }
+    vm.watchpoints = &watchpoints;
+  }
+  // Where a crashing ROM spent its time is just as interesting
+  auto report = [&]() {
+    if (profiler) {
+      result.profile = profiler->report(vm, options.profileTop);
+    }
+    if (callGraph) {
+      result.callGraph = callGraph->report();
+      result.folded = callGraph->folded();
+    }
+    if (cdl) {
+      std::string path = romOutputPath(options.cdlDirectory, options.root,
+                                       result.path, ".cdl");
+      if (std::filesystem::exists(path)) {
+        cdl->merge(CodeDataLogger(path.c_str()));
+      }
+      cdl->save(path.c_str());
+    }
+    for (const WatchHit &hit : watchpoints.hits) {
+      result.watchHits += std::format("{:>10} {}\n", hit.cycle, hit.toString());
+    }
+    if (watchpoints.droppedHits > 0) {
+      result.watchHits += std::format("({} more hits not logged)\n",
+                                      watchpoints.droppedHits);
+    }
+  };
+  try {
+    _runVM(result, options, vm);
+  } catch (...) {
+    report();
+    throw;
+  }
+  report();
+}
+
+} // namespace
+
+RomResult runTestRom(const std::string &path, const RomRunOptions &options) {
+  RomResult result;
+  result.path = path;
+  auto start = std::chrono::steady_clock::now();
+  try {
+    _run(result, options);
+  } catch (const std::exception &e) {
+    result.status = RomStatus::error;
+    result.message = e.what();
+  } catch (const char *msg) {
+    result.status = RomStatus::error;
+    result.message = msg;
+  }
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  result.milliseconds = elapsed.count();
+  return result;
+}
+
+std::string romOutputPath(const std::string &directory,
+                          const std::string &root, const std::string &path,
+                          const char *extension) {
+  std::filesystem::path name = std::filesystem::path(path).filename();
+  if (!root.empty()) {
+    std::filesystem::path relative =
+        std::filesystem::path(path).lexically_relative(root);
+    if (!relative.empty() && *relative.begin() != "." &&
+        *relative.begin() != "..") {
+      name = relative;
+    }
+  }
+  std::filesystem::path output = std::filesystem::path(directory) / name;
+  output.replace_extension(extension);
+  std::filesystem::create_directories(output.parent_path());
+  return output.string();
+}
+
+std::vector<RomResult> runTestRoms(const std::vector<std::string> &paths,
+                                   const RomRunOptions &options,
+                                   unsigned jobs) {
+  if (jobs == 0) {
+    jobs = std::max(1u, std::thread::hardware_concurrency());
+  }
+  jobs = std::min<size_t>(jobs, paths.size());
+
+  std::vector<RomResult> results(paths.size());
+  std::atomic<size_t> next = 0;
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < jobs; i++) {
+    workers.emplace_back([&, i] {
+      Timeline::setThreadName(std::format("worker {}", i).data());
+      for (size_t j = next++; j < paths.size(); j = next++) {
+        TimelineSpan span = {"runTestRom"};
+        results[j] = runTestRom(paths[j], options);
+      }
+    });
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  return results;
+}
+
+std::string resultsToJson(const std::vector<RomResult> &results) {
+  size_t passed = 0;
+  for (auto &result : results) {
+    passed += result.status == RomStatus::pass ? 1 : 0;
+  }
+
+  std::string out =
+      std::format("{{\n  \"total\": {},\n  \"passed\": {},\n  \"failed\": {},"
+                  "\n  \"results\": [",
+                  results.size(), passed, results.size() - passed);
+  for (size_t i = 0; i < results.size(); i++) {
+    const RomResult &result = results[i];
+    out += i == 0 ? "\n    {\"rom\": " : ",\n    {\"rom\": ";
+    _appendJsonString(out, result.path);
+    out += std::format(", \"protocol\": \"{}\", \"status\": \"{}\", "
+                       "\"code\": {}, \"cycles\": {}, \"instructions\": {}, "
+                       "\"ms\": {:.3f}, \"message\": ",
+                       toString(result.protocol), toString(result.status),
+                       result.code, result.cycles, result.instructions,
+                       result.milliseconds);
+    _appendJsonString(out, result.message);
+    out += "}";
+  }
+  out += "\n  ]\n}\n";
+  return out;
+}
+
+const char *toString(RomProtocol protocol) {
+  switch (protocol) {
+  case RomProtocol::nestest:
+    return "nestest";
+  case RomProtocol::blargg:
+    return "blargg";
+  case RomProtocol::unknown:
+    return "unknown";
+  }
+  throw "Unreachable";
+}
+
+const char *toString(RomStatus status) {
+  switch (status) {
+  case RomStatus::pass:
+    return "pass";
+  case RomStatus::fail:
+    return "fail";
+  case RomStatus::timeout:
+    return "timeout";
+  case RomStatus::idle:
+    return "idle";
+  case RomStatus::error:
+    return "error";
+  }
+  throw "Unreachable";
+}
+
+} // namespace NESPP
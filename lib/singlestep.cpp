@@ -0,0 +1,434 @@
+#include "../include/singlestep.h"
+#include "../include/headless.h" // for HeadlessVM
+#include "../include/vm.h"       // for VM, BusAccess
+#include "../include/word.h"     // for Word
+#include <algorithm>             // std::find_if
+#include <cstring>               // for memcpy, strerror
+#include <exception>
+#include <format>
+#include <stdexcept> // std::runtime_error
+#include <string_view>
+
+namespace NESPP {
+
+SingleStepReader::SingleStepReader(const char *path) {
+  file = fopen(path, "rb");
+  if (file == nullptr) {
+    throw std::runtime_error(
+        std::format("Failed to open test vectors at {}", path));
+  }
+}
+
+SingleStepReader::~SingleStepReader() { fclose(file); }
+
+int SingleStepReader::_peek() {
+  if (offset == length) {
+    length = fread(buffer, 1, sizeof(buffer), file);
+    offset = 0;
+    if (length == 0) {
+      return -1;
+    }
+  }
+  return static_cast<unsigned char>(buffer[offset]);
+}
+
+int SingleStepReader::_get() {
+  int c = _peek();
+  if (c != -1) {
+    offset += 1;
+  }
+  return c;
+}
+
+void SingleStepReader::_skipWhitespace() {
+  while (true) {
+    int c = _peek();
+    if (c != ' ' && c != '\n' && c != '\r' && c != '\t') {
+      return;
+    }
+    offset += 1;
+  }
+}
+
+void SingleStepReader::_fail(const char *what) {
+  throw std::runtime_error(std::format("Malformed test vectors: {}", what));
+}
+
+void SingleStepReader::_expect(char expected) {
+  _skipWhitespace();
+  if (_get() != expected) {
+    _fail(std::format("expected '{}'", expected).data());
+  }
+}
+
+void SingleStepReader::_string(std::string &out) {
+  _expect('"');
+  out.clear();
+  while (true) {
+    int c = _get();
+    if (c == -1) {
+      _fail("unterminated string");
+    } else if (c == '"') {
+      return;
+    } else if (c == '\\') {
+      // Vector names never need real unescaping; keep the escaped char
+      c = _get();
+    }
+    out.push_back(static_cast<char>(c));
+  }
+}
+
+uint64_t SingleStepReader::_number() {
+  _skipWhitespace();
+  if (_peek() == 'n') {
+    // null, used by some vector sets for undriven bus values
+    for (char c : std::string_view("null")) {
+      if (_get() != c) {
+        _fail("expected null");
+      }
+    }
+    return 0;
+  }
+  uint64_t value = 0;
+  int c = _peek();
+  if (c < '0' || c > '9') {
+    _fail("expected a number");
+  }
+  while (c >= '0' && c <= '9') {
+    value = value * 10 + (c - '0');
+    offset += 1;
+    c = _peek();
+  }
+  return value;
+}
+
+void SingleStepReader::_skipValue() {
+  _skipWhitespace();
+  int depth = 0;
+  do {
+    int c = _peek();
+    if (c == -1) {
+      _fail("unexpected end of file");
+    } else if (c == '"') {
+      std::string ignored;
+      _string(ignored);
+    } else {
+      offset += 1;
+      if (c == '[' || c == '{') {
+        depth += 1;
+      } else if (c == ']' || c == '}') {
+        depth -= 1;
+      } else if (depth == 0) {
+        // Scalar: consume the rest of the token
+        while ((c = _peek()) != -1 && c != ',' && c != ']' && c != '}' &&
+               c != ' ' && c != '\n' && c != '\r' && c != '\t') {
+          offset += 1;
+        }
+      }
+    }
+  } while (depth > 0);
+}
+
+void SingleStepReader::_state(SingleStepState &state) {
+  state.ram.clear();
+  std::string key;
+  _expect('{');
+  _skipWhitespace();
+  if (_peek() == '}') {
+    offset += 1;
+    return;
+  }
+  do {
+    _string(key);
+    _expect(':');
+    if (key == "pc") {
+      state.pc = _number();
+    } else if (key == "s") {
+      state.s = _number();
+    } else if (key == "a") {
+      state.a = _number();
+    } else if (key == "x") {
+      state.x = _number();
+    } else if (key == "y") {
+      state.y = _number();
+    } else if (key == "p") {
+      state.p = _number();
+    } else if (key == "ram") {
+      _expect('[');
+      _skipWhitespace();
+      if (_peek() == ']') {
+        offset += 1;
+      } else {
+        do {
+          _expect('[');
+          uint16_t address = _number();
+          _expect(',');
+          uint8_t value = _number();
+          _expect(']');
+          state.ram.emplace_back(address, value);
+          _skipWhitespace();
+        } while (_get() == ',');
+      }
+    } else {
+      _skipValue();
+    }
+    _skipWhitespace();
+  } while (_get() == ',');
+}
+
+void SingleStepReader::_cycles(std::vector<SingleStepCycle> &cycles) {
+  cycles.clear();
+  std::string kind;
+  _expect('[');
+  _skipWhitespace();
+  if (_peek() == ']') {
+    offset += 1;
+    return;
+  }
+  do {
+    _expect('[');
+    uint16_t address = _number();
+    _expect(',');
+    uint8_t value = _number();
+    _expect(',');
+    _string(kind);
+    _expect(']');
+    cycles.push_back({address, value, kind == "write"});
+    _skipWhitespace();
+  } while (_get() == ',');
+}
+
+bool SingleStepReader::next(SingleStepTest &test) {
+  if (!started) {
+    _expect('[');
+    started = true;
+  }
+  _skipWhitespace();
+  int c = _peek();
+  if (c == ',') {
+    offset += 1;
+    _skipWhitespace();
+    c = _peek();
+  }
+  if (c == ']' || c == -1) {
+    return false;
+  }
+
+  std::string key;
+  _expect('{');
+  do {
+    _string(key);
+    _expect(':');
+    if (key == "name") {
+      _string(test.name);
+    } else if (key == "initial") {
+      _state(test.initial);
+    } else if (key == "final") {
+      _state(test.final);
+    } else if (key == "cycles") {
+      _cycles(test.cycles);
+    } else {
+      _skipValue();
+    }
+    _skipWhitespace();
+  } while (_get() == ',');
+  return true;
+}
+
+static void _writeState(FILE *out, const SingleStepState &state) {
+  fprintf(out, "{\"pc\": %u, \"s\": %u, \"a\": %u, \"x\": %u, \"y\": %u, "
+               "\"p\": %u, \"ram\": [",
+          state.pc, state.s, state.a, state.x, state.y, state.p);
+  for (size_t i = 0; i < state.ram.size(); i++) {
+    fprintf(out, "%s[%u, %u]", i == 0 ? "" : ", ", state.ram[i].first,
+            state.ram[i].second);
+  }
+  fputs("]}", out);
+}
+
+void writeSingleStepTest(FILE *out, const SingleStepTest &test, bool first) {
+  fprintf(out, "%s{\"name\": \"%s\", \"initial\": ", first ? "" : ",\n",
+          test.name.data());
+  _writeState(out, test.initial);
+  fputs(", \"final\": ", out);
+  _writeState(out, test.final);
+  fputs(", \"cycles\": [", out);
+  for (size_t i = 0; i < test.cycles.size(); i++) {
+    const SingleStepCycle &cycle = test.cycles[i];
+    fprintf(out, "%s[%u, %u, \"%s\"]", i == 0 ? "" : ", ", cycle.address,
+            cycle.value, cycle.write ? "write" : "read");
+  }
+  fputs("]}", out);
+}
+
+bool runSingleStepTest(VM &vm, uint8_t *memory, const SingleStepTest &test,
+                       bool checkCycles, std::string &reason) {
+  for (auto [address, value] : test.initial.ram) {
+    memory[address] = value;
+  }
+  vm.PC = Word(test.initial.pc);
+  vm.SP = test.initial.s;
+  vm.A = test.initial.a;
+  vm.X = test.initial.x;
+  vm.Y = test.initial.y;
+  vm.S = test.initial.p;
+  vm.cycles = 0;
+  vm.busLog.clear();
+
+  bool passed = true;
+  try {
+    vm.step();
+  } catch (const std::exception &e) {
+    reason = e.what();
+    passed = false;
+  } catch (const char *msg) {
+    reason = msg;
+    passed = false;
+  }
+
+  const SingleStepState &expected = test.final;
+  if (passed) {
+    struct {
+      const char *name;
+      unsigned expected;
+      unsigned actual;
+    } registers[] = {
+        {"PC", expected.pc, vm.PC.to16()}, {"S", expected.s, vm.SP},
+        {"A", expected.a, vm.A},           {"X", expected.x, vm.X},
+        {"Y", expected.y, vm.Y},           {"P", expected.p, vm.S},
+    };
+    for (auto &reg : registers) {
+      if (reg.expected != reg.actual) {
+        reason = std::format("{} = ${:02X}, expected ${:02X}", reg.name,
+                             reg.actual, reg.expected);
+        passed = false;
+        break;
+      }
+    }
+  }
+  if (passed) {
+    for (auto [address, value] : expected.ram) {
+      if (memory[address] != value) {
+        reason = std::format("[${:04X}] = ${:02X}, expected ${:02X}",
+                             address, memory[address], value);
+        passed = false;
+        break;
+      }
+    }
+  }
+  if (passed && checkCycles) {
+    if (vm.cycles != test.cycles.size()) {
+      reason = std::format("took {} cycles, expected {}", vm.cycles,
+                           test.cycles.size());
+      passed = false;
+    }
+    auto expectedCycle = test.cycles.begin();
+    for (const BusAccess &access : vm.busLog) {
+      expectedCycle = std::find_if(
+          expectedCycle, test.cycles.end(), [&](const SingleStepCycle &c) {
+            return c.address == access.address && c.value == access.value &&
+                   c.write == access.write;
+          });
+      if (passed && expectedCycle == test.cycles.end()) {
+        reason = std::format("unexpected {} of ${:02X} at ${:04X}",
+                             access.write ? "write" : "read", access.value,
+                             access.address);
+        passed = false;
+      }
+    }
+  }
+
+  // Leave the bus clean for the next vector
+  for (auto [address, _] : test.initial.ram) {
+    memory[address] = 0;
+  }
+  for (const BusAccess &access : vm.busLog) {
+    memory[access.address] = 0;
+  }
+  return passed;
+}
+
+SingleStepCapture::SingleStepCapture() : memory(0x10000) {
+  flat = std::make_unique<HeadlessVM>(memory.data());
+}
+
+SingleStepCapture::~SingleStepCapture() {}
+
+bool SingleStepCapture::capture(VM &vm, SingleStepTest &test) {
+  // Mirror the CPU-visible memory. ROM is assumed not to change between
+  // captures, so it is only copied the first time.
+  for (int mirror = 0; mirror < 0x2000; mirror += sizeof(vm.ram)) {
+    memcpy(memory.data() + mirror, vm.ram, sizeof(vm.ram));
+  }
+  uint32_t end = romCopied ? 0x8000 : 0x10000;
+  for (uint32_t address = 0x6000; address < end; address++) {
+    memory[address] = vm.inspect(address);
+  }
+  romCopied = true;
+
+  flat->PC = vm.PC;
+  flat->SP = vm.SP;
+  flat->A = vm.A;
+  flat->X = vm.X;
+  flat->Y = vm.Y;
+  flat->S = vm.S;
+  flat->cycles = 0;
+  flat->busLog.clear();
+  try {
+    flat->step();
+  } catch (...) {
+    return false;
+  }
+
+  test.initial = {.pc = vm.PC.to16(),
+                  .s = vm.SP,
+                  .a = vm.A,
+                  .x = vm.X,
+                  .y = vm.Y,
+                  .p = vm.S,
+                  .ram = {}};
+  test.final = {.pc = flat->PC.to16(),
+                .s = flat->SP,
+                .a = flat->A,
+                .x = flat->X,
+                .y = flat->Y,
+                .p = flat->S,
+                .ram = {}};
+  test.cycles.clear();
+  test.name.clear();
+
+  bool io = false;
+  uint16_t pc = vm.PC.to16();
+  for (const BusAccess &access : flat->busLog) {
+    if (access.address >= 0x2000 && access.address < 0x6000) {
+      io = true;
+    }
+    test.cycles.push_back({access.address, access.value, access.write});
+    // Opcode and operand fetches make up the name, like the reference sets
+    if (!access.write && test.cycles.size() <= 3 &&
+        access.address == static_cast<uint16_t>(pc + test.cycles.size() - 1)) {
+      test.name += std::format("{}{:02x}", test.name.empty() ? "" : " ",
+                               access.value);
+    }
+
+    bool seen = std::any_of(test.initial.ram.begin(), test.initial.ram.end(),
+                            [&](auto &entry) {
+                              return entry.first == access.address;
+                            });
+    if (!seen && !io) {
+      test.initial.ram.emplace_back(access.address, vm.inspect(access.address));
+      test.final.ram.emplace_back(access.address, memory[access.address]);
+    }
+  }
+  // Final values are only known once every access has happened
+  for (auto &entry : test.final.ram) {
+    entry.second = memory[entry.first];
+  }
+  // Undo the replay's writes to memory that is only refreshed once
+  for (auto [address, value] : test.initial.ram) {
+    memory[address] = value;
+  }
+  return !io;
+}
+
+} // namespace NESPP
@@ -0,0 +1,133 @@
+#include "../include/stress.h"
+#include "../include/assembler.h" // for Assembler, buildINes
+#include <format>
+#include <stdexcept> // std::runtime_error
+
+namespace NESPP {
+
+namespace {
+
+// Common to every workload: interrupts off and a full stack
+constexpr const char *_prologue = R"(
+reset:
+  SEI
+  CLD
+  LDX #$FF
+  TXS
+)";
+
+std::string _branchHeavy(int size) {
+  // A is shifted right once per block: the carry branch follows the bits of
+  // a per-block pattern, and the zero branch reloads it once it runs out.
+  // X counts down from $80, and the sign branch after comparing it with a
+  // per-block threshold is taken until X drops below it. So the predictor
+  // sees a mix of periods and taken rates. (The VM's compare carry is
+  // wrong, so only the sign is branched on.)
+  std::string source = "  LDA #$A5\nouter:\n  LDX #$80\nloop:\n";
+  for (int i = 0; i < size; i++) {
+    source += std::format("  LSR A\n"
+                          "  BCC a{}\n"
+                          "  STA $10\n"
+                          "a{}:\n"
+                          "  BNE b{}\n"
+                          "  LDA #${:02X}\n"
+                          "b{}:\n"
+                          "  CPX #${:02X}\n"
+                          "  BPL c{}\n"
+                          "  STA $11\n"
+                          "c{}:\n",
+                          i, i, i, (i * 0x5B + 0xA7) & 0xFF, i,
+                          (i * 0x3D + 0x11) & 0x7F, i, i);
+  }
+  source += "  DEX\n  BEQ done\n  JMP loop\ndone:\n  JMP outer\n";
+  return source;
+}
+
+std::string _memory(int size, bool zeroPage) {
+  std::string source = "outer:\n  LDX #$40\nloop:\n";
+  for (int i = 0; i < size; i++) {
+    if (zeroPage) {
+      uint8_t address = 0x10 + (i * 2) % 0xE0;
+      source += std::format("  LDA ${:02X}\n  STA ${:02X}\n", address,
+                            address + 1);
+    } else {
+      uint16_t address = 0x0300 + (i * 2) % 0x0500;
+      source += std::format("  LDA ${:04X}\n  STA ${:04X}\n", address,
+                            address + 1);
+    }
+  }
+  source += "  DEX\n  BEQ done\n  JMP loop\ndone:\n  JMP outer\n";
+  return source;
+}
+
+std::string _callChain(int size) {
+  if (size < 1 || size > 120) {
+    throw std::runtime_error(
+        std::format("Call chain depth {} must be between 1 and 120", size));
+  }
+  std::string source = "outer:\n  JSR f0\n  JMP outer\n";
+  for (int i = 0; i < size - 1; i++) {
+    source += std::format("f{}:\n  JSR f{}\n  RTS\n", i, i + 1);
+  }
+  source += std::format("f{}:\n  RTS\n", size - 1);
+  return source;
+}
+
+std::string _ppuPolling(int size) {
+  std::string source = "poll:\n";
+  for (int i = 0; i < size; i++) {
+    source += "  LDA $2002\n";
+  }
+  // Both paths restart the wait, only the branch outcome differs
+  source += "  BPL again\n  JMP poll\nagain:\n  JMP poll\n";
+  return source;
+}
+
+} // namespace
+
+const char *toString(StressWorkload workload) {
+  switch (workload) {
+  case StressWorkload::branchHeavy:
+    return "branch-heavy";
+  case StressWorkload::zeroPage:
+    return "zero-page";
+  case StressWorkload::absolute:
+    return "absolute";
+  case StressWorkload::callChain:
+    return "call-chain";
+  case StressWorkload::ppuPolling:
+    return "ppu-polling";
+  }
+  throw "Unreachable";
+}
+
+std::string stressSource(const StressParameters &parameters) {
+  if (parameters.size < 1) {
+    throw std::runtime_error("Stress workload size must be positive");
+  }
+  std::string source = _prologue;
+  switch (parameters.workload) {
+  case StressWorkload::branchHeavy:
+    return source + _branchHeavy(parameters.size);
+  case StressWorkload::zeroPage:
+    return source + _memory(parameters.size, true);
+  case StressWorkload::absolute:
+    return source + _memory(parameters.size, false);
+  case StressWorkload::callChain:
+    return source + _callChain(parameters.size);
+  case StressWorkload::ppuPolling:
+    return source + _ppuPolling(parameters.size);
+  }
+  throw "Unreachable";
+}
+
+std::vector<uint8_t> generateStressRom(const StressParameters &parameters) {
+  Assembler assembler;
+  assembler.assemble(stressSource(parameters));
+  std::vector<uint8_t> prg = assembler.link();
+  uint16_t reset = assembler.address("reset");
+  // NMI and IRQ are never enabled, but point them somewhere sane
+  return buildINes(prg, reset, reset, reset);
+}
+
+} // namespace NESPP
@@ -0,0 +1,26 @@
+#include "../include/tileCache.h"
+#include "../include/chr.h" // for decodeTiles
+#include <algorithm>        // std::fill
+
+namespace NESPP {
+
+TileCache::TileCache(const uint8_t *chr, size_t size, bool writable)
+    : chr(chr), writable(writable), pixels(size / 16 * 64),
+      valid(size / 16, writable ? 0 : 1) {
+  if (!writable) {
+    decodeTiles(chr, size / 16, pixels.data());
+  }
+}
+
+void TileCache::invalidateAll() {
+  if (writable) {
+    std::fill(valid.begin(), valid.end(), 0);
+  }
+}
+
+void TileCache::_decode(uint32_t index) {
+  decodeTile(chr + index * 16, pixels.data() + index * 64);
+  valid[index] = 1;
+}
+
+} // namespace NESPP
@@ -0,0 +1,139 @@
+#include "../include/timeline.h"
+#include <chrono>
+#include <cstdio> // for fopen, fprintf
+#include <format>
+#include <memory>
+#include <mutex>
+#include <stdexcept> // std::runtime_error
+#include <string>
+#include <vector>
+
+namespace NESPP {
+
+namespace {
+
+/// Events per thread, about 6 MiB; allocated on a thread's first span
+constexpr size_t CAPACITY = 1 << 18;
+
+struct _ThreadBuffer {
+  std::unique_ptr<TimelineEvent[]> events{new TimelineEvent[CAPACITY]};
+  /// Published with release so writeChromeTrace can read concurrently
+  std::atomic<size_t> size = 0;
+  std::atomic<uint64_t> dropped = 0;
+  uint32_t id = 0;
+  /// Guarded by _mutex
+  std::string name;
+};
+
+std::mutex _mutex;
+/// Kept after their threads exit so their events can still be exported
+std::vector<std::unique_ptr<_ThreadBuffer>> _buffers;
+thread_local _ThreadBuffer *_buffer = nullptr;
+
+std::atomic<int64_t> _epoch = 0;
+
+int64_t _steadyNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+_ThreadBuffer *_threadBuffer() {
+  if (_buffer == nullptr) {
+    std::lock_guard lock(_mutex);
+    _buffers.push_back(std::make_unique<_ThreadBuffer>());
+    _buffer = _buffers.back().get();
+    _buffer->id = _buffers.size();
+    _buffer->name = std::format("thread {}", _buffer->id);
+  }
+  return _buffer;
+}
+
+void _writeEscaped(FILE *file, const char *text) {
+  for (const char *c = text; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') {
+      fputc('\\', file);
+    }
+    fputc(*c, file);
+  }
+}
+
+} // namespace
+
+namespace Timeline {
+
+std::atomic<bool> enabled = false;
+
+void start() {
+  std::lock_guard lock(_mutex);
+  for (auto &buffer : _buffers) {
+    buffer->size.store(0, std::memory_order_relaxed);
+    buffer->dropped.store(0, std::memory_order_relaxed);
+  }
+  _epoch.store(_steadyNs(), std::memory_order_relaxed);
+  enabled.store(true, std::memory_order_release);
+}
+
+void stop() { enabled.store(false, std::memory_order_release); }
+
+uint64_t now() {
+  return _steadyNs() - _epoch.load(std::memory_order_relaxed);
+}
+
+void record(const char *name, uint64_t start, uint64_t duration) {
+  _ThreadBuffer *buffer = _threadBuffer();
+  size_t size = buffer->size.load(std::memory_order_relaxed);
+  if (size == CAPACITY) {
+    buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  buffer->events[size] = {.name = name, .start = start, .duration = duration};
+  buffer->size.store(size + 1, std::memory_order_release);
+}
+
+void setThreadName(const char *name) {
+  _ThreadBuffer *buffer = _threadBuffer();
+  std::lock_guard lock(_mutex);
+  buffer->name = name;
+}
+
+void writeChromeTrace(const char *path) {
+  FILE *file = fopen(path, "w");
+  if (file == nullptr) {
+    throw std::runtime_error(std::format("Failed to open {}", path));
+  }
+
+  std::lock_guard lock(_mutex);
+  uint64_t dropped = 0;
+  fputs("{\"displayTimeUnit\": \"ns\", \"traceEvents\": [", file);
+  bool first = true;
+  for (auto &buffer : _buffers) {
+    fprintf(file,
+            "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+            "\"tid\": %u, \"args\": {\"name\": \"",
+            first ? "" : ",", buffer->id);
+    _writeEscaped(file, buffer->name.data());
+    fputs("\"}}", file);
+    first = false;
+
+    size_t size = buffer->size.load(std::memory_order_acquire);
+    for (size_t i = 0; i < size; i++) {
+      const TimelineEvent &event = buffer->events[i];
+      fputs(",\n{\"name\": \"", file);
+      _writeEscaped(file, event.name);
+      // Chrome expects microseconds
+      fprintf(file,
+              "\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, "
+              "\"dur\": %.3f}",
+              buffer->id, event.start / 1000.0, event.duration / 1000.0);
+    }
+    dropped += buffer->dropped.load(std::memory_order_relaxed);
+  }
+  fprintf(file, "\n], \"otherData\": {\"droppedEvents\": %lu}}\n",
+          static_cast<unsigned long>(dropped));
+  fclose(file);
+}
+
+} // namespace Timeline
+
+} // namespace NESPP
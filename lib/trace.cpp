@@ -0,0 +1,70 @@
+#include "../include/trace.h"
+#include <cstdio>
+#include <format>    // std::format_to_n
+#include <stdexcept> // std::runtime_error
+#include <string>
+
+namespace NESPP {
+
+size_t TraceEvent::format(char *buffer, size_t size) const {
+  if (size == 0) {
+    return 0;
+  }
+  std::format_to_n_result<char *> result;
+  switch (kind) {
+  case TraceEventKind::ppuRead:
+    result = std::format_to_n(buffer, size - 1, "PPU register: {} = 0x{:02X}",
+                              address - 0x2000, value);
+    break;
+  case TraceEventKind::apuRead:
+    result = std::format_to_n(buffer, size - 1,
+                              "APU or I/O register: {:04X} = 0x{:02X}",
+                              address, value);
+    break;
+  case TraceEventKind::jump:
+    result = std::format_to_n(buffer, size - 1, "{:04X}: Jumping to ${:04X}",
+                              pc, address);
+    break;
+  case TraceEventKind::nmi:
+    result = std::format_to_n(buffer, size - 1, "{:04X}: NMI to ${:04X}", pc,
+                              address);
+    break;
+  case TraceEventKind::oamDma:
+    result = std::format_to_n(buffer, size - 1,
+                              "{:04X}: OAM DMA from ${:04X}", pc, address);
+    break;
+  default:
+    result = std::format_to_n(buffer, size - 1, "Unknown trace event {}",
+                              static_cast<int>(kind));
+    break;
+  }
+  *result.out = '\0';
+  return result.out - buffer;
+}
+
+std::string TraceEvent::toString() const {
+  char buffer[64];
+  return std::string(buffer, format(buffer, sizeof(buffer)));
+}
+
+TraceFileSink::TraceFileSink(const char *path) {
+  file = fopen(path, "w");
+  if (file == nullptr) {
+    throw std::runtime_error(
+        std::format("Failed to open trace file at {}", path));
+  }
+}
+
+TraceFileSink::~TraceFileSink() { fclose(file); }
+
+void TraceFileSink::drain(TraceBuffer &buffer) {
+  char line[64];
+  TraceEvent event;
+  while (buffer.pop(event)) {
+    size_t length = event.format(line, sizeof(line));
+    fprintf(file, "%10lu %.*s\n", static_cast<unsigned long>(event.cycle),
+            static_cast<int>(length), line);
+  }
+}
+
+} // namespace NESPP
@@ -0,0 +1,221 @@
+#include "../include/video.h"
+#include "../include/timeline.h" // for TimelineSpan
+#include <algorithm> // std::clamp, std::min
+#include <cmath>
+#include <cstring> // for memcpy
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace NESPP {
+
+namespace {
+
+/// Samples per cycle of the colour subcarrier; each pixel is 8 samples
+constexpr int _PHASES = 12;
+
+/// Signal voltages by luma level, from the wiki's terminated measurements
+constexpr double _LOW[4] = {0.228, 0.312, 0.552, 0.880};
+constexpr double _HIGH[4] = {0.616, 0.840, 1.100, 1.100};
+constexpr double _BLACK = 0.312;
+constexpr double _WHITE = 1.100;
+/// Each emphasis bit attenuates the signal for half of the cycle
+constexpr double _ATTENUATION = 0.746;
+/// Rotates decoded hues to match the NES's colour burst
+constexpr double _HUE = 3.5;
+
+bool _inColourPhase(int hue, int phase) {
+  return (hue + phase) % _PHASES < 6;
+}
+
+/// The signal for a framebuffer value at a phase, 0 at black and 1 at white
+double _signal(int value, int phase) {
+  int hue = value & 0x0F;
+  int level = (value >> 4) & 0x03;
+  int emphasis = value >> 6;
+  // $xE and $xF are black
+  if (hue > 13) {
+    level = 1;
+  }
+  double low = _LOW[level];
+  double high = _HIGH[level];
+  if (hue == 0) {
+    low = high;
+  } else if (hue > 12) {
+    high = low;
+  }
+  double signal = _inColourPhase(hue, phase) ? high : low;
+  if (hue < 14 && (((emphasis & 1) && _inColourPhase(0, phase)) ||
+                   ((emphasis & 2) && _inColourPhase(4, phase)) ||
+                   ((emphasis & 4) && _inColourPhase(8, phase)))) {
+    signal *= _ATTENUATION;
+  }
+  return (signal - _BLACK) / (_WHITE - _BLACK);
+}
+
+/// Weights turning 12 samples starting at phase into R, G and B: a YIQ
+/// demodulation and the YIQ to RGB matrix in one
+void _buildWeights(int phase, float weights[3][_PHASES]) {
+  constexpr double matrix[3][2] = {
+      {0.946882, 0.623557}, {-0.274788, -0.635691}, {-1.108545, 1.709007}};
+  for (int k = 0; k < _PHASES; k++) {
+    double angle = M_PI * (phase + k + _HUE) / 6;
+    double y = 1.0 / _PHASES;
+    double i = 2 * std::cos(angle) / _PHASES;
+    double q = 2 * std::sin(angle) / _PHASES;
+    for (int c = 0; c < 3; c++) {
+      weights[c][k] = y + matrix[c][0] * i + matrix[c][1] * q;
+    }
+  }
+}
+
+uint32_t _rgba(double r, double g, double b) {
+  uint8_t bytes[4] = {
+      static_cast<uint8_t>(std::clamp(r, 0.0, 1.0) * 255 + 0.5),
+      static_cast<uint8_t>(std::clamp(g, 0.0, 1.0) * 255 + 0.5),
+      static_cast<uint8_t>(std::clamp(b, 0.0, 1.0) * 255 + 0.5), 0xFF};
+  uint32_t pixel;
+  memcpy(&pixel, bytes, 4);
+  return pixel;
+}
+
+} // namespace
+
+VideoOutput::VideoOutput() {
+  float weights[_PHASES][3][_PHASES];
+  for (int phase = 0; phase < _PHASES; phase++) {
+    _buildWeights(phase, weights[phase]);
+  }
+  // A pixel starting at phase start * 4 is decoded from a window starting
+  // 2 samples earlier
+  auto window = [&](int start) {
+    return weights[(start * 4 + _PHASES - 2) % _PHASES];
+  };
+
+  for (int value = 0; value < 512; value++) {
+    for (int start = 0; start < 3; start++) {
+      float samples[8];
+      for (int k = 0; k < 8; k++) {
+        samples[k] = _signal(value, (start * 4 + k) % _PHASES);
+      }
+      // Neighbours start 8 samples later or earlier
+      auto own = window(start);
+      auto right = window((start + 2) % 3);
+      auto left = window((start + 1) % 3);
+      for (int c = 0; c < 3; c++) {
+        _own[value][start][c] = 0;
+        for (int k = 0; k < 8; k++) {
+          _own[value][start][c] += own[c][k + 2] * samples[k];
+        }
+        _toRight[value][start][c] =
+            right[c][0] * samples[6] + right[c][1] * samples[7];
+        _toLeft[value][start][c] =
+            left[c][10] * samples[0] + left[c][11] * samples[1];
+      }
+      _own[value][start][3] = 0;
+      _toRight[value][start][3] = 0;
+      _toLeft[value][start][3] = 0;
+    }
+
+    // A whole cycle of the colour on its own
+    double rgb[3] = {0};
+    for (int k = 0; k < _PHASES; k++) {
+      for (int c = 0; c < 3; c++) {
+        rgb[c] += weights[0][c][k] * _signal(value, k);
+      }
+    }
+    palette[value] = _rgba(rgb[0], rgb[1], rgb[2]);
+  }
+}
+
+void VideoOutput::convert(const uint16_t *framebuffer, uint32_t *rgba) const {
+  TimelineSpan span = {"VideoOutput::convert"};
+  for (int i = 0; i < PPU::WIDTH * PPU::HEIGHT; i++) {
+    rgba[i] = palette[framebuffer[i] & 0x1FF];
+  }
+}
+
+void VideoOutput::convertNtsc(const uint16_t *framebuffer, uint32_t *rgba,
+                              unsigned jobs) const {
+  TimelineSpan span = {"VideoOutput::convertNtsc"};
+  if (jobs == 0) {
+    jobs = std::max(1u, std::thread::hardware_concurrency());
+  }
+  jobs = std::min<unsigned>(jobs, PPU::HEIGHT);
+
+  // Contiguous bands of rows; the calling thread takes the first
+  std::vector<std::thread> workers;
+  auto band = [jobs](unsigned i) { return PPU::HEIGHT * i / jobs; };
+  for (unsigned i = 1; i < jobs; i++) {
+    workers.emplace_back([=, this] {
+      _ntscRows(framebuffer, rgba, band(i), band(i + 1));
+    });
+  }
+  _ntscRows(framebuffer, rgba, band(0), band(1));
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+void VideoOutput::_ntscRows(const uint16_t *framebuffer, uint32_t *rgba,
+                            int first, int last) const {
+  // One per band, on whichever thread runs it
+  TimelineSpan span = {"VideoOutput::ntscRows"};
+  for (int y = first; y < last; y++) {
+    // Black beyond the edges, which contributes nothing
+    uint16_t values[1 + PPU::WIDTH + 1];
+    values[0] = 0x0F;
+    values[1 + PPU::WIDTH] = 0x0F;
+    for (int x = 0; x < PPU::WIDTH; x++) {
+      values[1 + x] = framebuffer[y * PPU::WIDTH + x] & 0x1FF;
+    }
+    uint32_t *out = rgba + y * PPU::WIDTH;
+    // 341 dots of 8 samples put each line 4 samples further along the
+    // subcarrier, and each pixel 8 further than the last
+    int start = y % 3;
+    int left = (start + 1) % 3;
+    int right = (start + 2) % 3;
+
+    // Each pixel's sum of its three contributions
+    auto sum = [&](int x, auto add) {
+      add(_own[values[1 + x]][start], _toRight[values[x]][left],
+          _toLeft[values[2 + x]][right]);
+      left = start;
+      start = right;
+      right = (right + 2) % 3;
+    };
+#if defined(__SSE2__)
+    const __m128 scale = _mm_set1_ps(255);
+    for (int x = 0; x < PPU::WIDTH; x += 4) {
+      __m128i pixels[4];
+      for (int i = 0; i < 4; i++) {
+        sum(x + i, [&](const float *a, const float *b, const float *c) {
+          __m128 rgb = _mm_add_ps(_mm_load_ps(a),
+                                  _mm_add_ps(_mm_load_ps(b), _mm_load_ps(c)));
+          pixels[i] = _mm_cvtps_epi32(_mm_mul_ps(rgb, scale));
+        });
+      }
+      // The saturating packs clamp to 0-255; x86 is little-endian, so each
+      // pixel's R is its low byte
+      __m128i bytes =
+          _mm_packus_epi16(_mm_packs_epi32(pixels[0], pixels[1]),
+                           _mm_packs_epi32(pixels[2], pixels[3]));
+      // Lane 3 summed zeros; alpha is opaque
+      bytes = _mm_or_si128(bytes, _mm_set1_epi32(0xFF000000));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x), bytes);
+    }
+#else
+    for (int x = 0; x < PPU::WIDTH; x++) {
+      sum(x, [&](const float *a, const float *b, const float *c) {
+        out[x] = _rgba(a[0] + b[0] + c[0], a[1] + b[1] + c[1],
+                       a[2] + b[2] + c[2]);
+      });
+    }
+#endif
+  }
+}
+
+} // namespace NESPP
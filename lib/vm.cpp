@@ -1,6 +1,7 @@
 #include "../include/vm.h"           // for VM, Mapper0, Mapper
 #include "../include/instructions.h" // for OpCode, Instruction, OpCode::AND_ABS, OpC...
 #include "../include/rom.h"          // for Rom
+#include "../include/timeline.h"     // for TimelineSpan
 #include "../include/word.h"         // for Absolute
 #include <array>
 #include <cassert>
@@ -39,7 +40,7 @@ uint8_t Mapper0::peek16(uint16_t address) {
     throw "Unreachable";
   } else if (address < 0x8000) {
     // unbanked PRG-RAM
-    throw "TODO: implement PRG-RAM";
+    return prgRam[address - 0x6000];
   } else {
     // either continuation of PRG or mirror
     uint16_t offset = address - 0x8000;
@@ -52,7 +53,7 @@ void Mapper0::poke16(uint16_t address, uint8_t value) {
     throw "Unreachable";
   } else if (address < 0x8000) {
     // unbanked PRG-RAM
-    throw "TODO: implement PRG-RAM";
+    prgRam[address - 0x6000] = value;
   } else {
     // either continuation of PRG or mirror
     uint16_t offset = address - 0x8000;
@@ -60,6 +61,56 @@ void Mapper0::poke16(uint16_t address, uint8_t value) {
   }
 }
 
+int32_t Mapper0::prgOffset(uint16_t address) {
+  if (address < 0x8000) {
+    return -1;
+  }
+  // 16 KiB ROMs are mirrored
+  return (address - 0x8000) % rom->prgSize;
+}
+
+int32_t Mapper0::chrOffset(uint16_t address) {
+  if (address >= 0x2000 || rom->chrSize == 0) {
+    return -1;
+  }
+  return address % rom->chrSize;
+}
+
+Mirroring Mapper0::mirroring() {
+  // Hardwired on the board
+  if (rom->alternativeNametableLayout) {
+    return Mirroring::fourScreen;
+  }
+  return rom->nameTableArrangement == 0 ? Mirroring::horizontal
+                                        : Mirroring::vertical;
+}
+
+const uint8_t *Mapper0::memoryPage(uint8_t page) {
+  if (page < 0x60) {
+    return nullptr;
+  } else if (page < 0x80) {
+    return prgRam + ((page - 0x60) << 8);
+  }
+  return prg + ((page - 0x80) << 8);
+}
+
+void Mapper0::saveState(std::vector<uint8_t> &out) {
+  // Writes to PRG land in our copy, so it is state too
+  out.resize(sizeof(prgRam) + sizeof(prg));
+  memcpy(out.data(), prgRam, sizeof(prgRam));
+  memcpy(out.data() + sizeof(prgRam), prg, sizeof(prg));
+}
+
+void Mapper0::loadState(const std::vector<uint8_t> &in) {
+  if (in.size() != sizeof(prgRam) + sizeof(prg)) {
+    throw std::runtime_error(
+        std::format("Mapper0 state is {} bytes, expected {}", in.size(),
+                    sizeof(prgRam) + sizeof(prg)));
+  }
+  memcpy(prgRam, in.data(), sizeof(prgRam));
+  memcpy(prg, in.data() + sizeof(prgRam), sizeof(prg));
+}
+
 VM::VM(std::shared_ptr<Rom> _rom) {
   this->rom = std::move(_rom);
 
@@ -71,9 +122,25 @@ VM::VM(std::shared_ptr<Rom> _rom) {
   default:
     throw "Oops!";
   }
+  ppu = new PPU(rom, mapper);
+#if NESPP_METRICS
+  Metrics::attach(&metrics);
+#endif
 }
 
-VM::~VM() { delete mapper; }
+VM::VM(uint8_t *flatBus) : _flatBus(flatBus) {
+#if NESPP_METRICS
+  Metrics::attach(&metrics);
+#endif
+}
+
+VM::~VM() {
+#if NESPP_METRICS
+  Metrics::detach(&metrics);
+#endif
+  delete ppu;
+  delete mapper;
+}
 
 void VM::start() {
   {
@@ -83,56 +150,358 @@ void VM::start() {
     PC = {high, low};
   }
 
-  Instruction current;
   while (1) {
-    // printf("$%02X: ", PC);
-    current = decodeInstruction();
-    execute(current);
+    step();
+  }
+}
+
+void VM::reset() {
+  PC = {peek16(0xFFFD), peek16(0xFFFC)};
+  // The reset sequence performs three suppressed stack pushes
+  SP -= 3;
+  S |= _I;
+  cycles += 7;
+}
+
+void VM::saveState(VMState &state) const {
+  if (mapper == nullptr) {
+    throw std::runtime_error("saveState is not supported in flat-bus mode");
+  }
+  state.PC = PC;
+  state.A = A;
+  state.X = X;
+  state.Y = Y;
+  state.SP = SP;
+  state.S = S;
+  state.cycles = cycles;
+  state.instructions = instructions;
+  memcpy(state.ram, ram, sizeof(ram));
+  memcpy(state.ppuRegisters, ppuRegisters, sizeof(ppuRegisters));
+  memcpy(state.apuAndIoRegisters, apuAndIoRegisters,
+         sizeof(apuAndIoRegisters));
+  state.ppu = *ppu;
+  mapper->saveState(state.mapper);
+}
+
+void VM::loadState(const VMState &state) {
+  if (mapper == nullptr) {
+    throw std::runtime_error("loadState is not supported in flat-bus mode");
+  }
+  PC = state.PC;
+  A = state.A;
+  X = state.X;
+  Y = state.Y;
+  SP = state.SP;
+  S = state.S;
+  cycles = state.cycles;
+  instructions = state.instructions;
+  memcpy(ram, state.ram, sizeof(ram));
+  memcpy(ppuRegisters, state.ppuRegisters, sizeof(ppuRegisters));
+  memcpy(apuAndIoRegisters, state.apuAndIoRegisters,
+         sizeof(apuAndIoRegisters));
+  // First, since the PPU's page table follows the mapper
+  mapper->loadState(state.mapper);
+  ppu->loadState(state.ppu);
+  _framesCounted = ppu->frames;
+}
+
+Instruction VM::step() {
+  uint16_t address = PC.to16();
+  uint64_t startCycles = cycles;
+#if NESPP_METRICS
+  try {
+#endif
+    Instruction instruction = decodeInstruction();
+    if (recorder != nullptr) {
+      _record(address);
+    }
+    if (cdl != nullptr) {
+      _logCode(address);
+    }
+    execute(instruction);
+    if (profiler != nullptr) {
+      profiler->record(address, _instructionOpCode, cycles - startCycles);
+    }
+    if (callGraph != nullptr) {
+      callGraph->record(instruction.opCode.type, PC.to16(), SP,
+                        cycles - startCycles);
+    }
+    instructions += 1;
+    if (ppu != nullptr && cycles * 3 >= ppu->deadline) [[unlikely]] {
+      _syncPpu();
+    }
+#if NESPP_METRICS
+    VMMetrics::add(metrics.instructions);
+    VMMetrics::add(metrics.cycles, cycles - startCycles);
+#endif
+    return instruction;
+#if NESPP_METRICS
+  } catch (...) {
+    VMMetrics::add(metrics.exceptions);
+    throw;
   }
+#endif
+}
+
+void VM::_logCode(uint16_t address) {
+  if (mapper == nullptr) {
+    return;
+  }
+  // decodeInstruction() has already advanced PC past the operand
+  uint16_t end = PC.to16();
+  for (uint16_t byte = address; byte != end; byte++) {
+    int32_t offset = mapper->prgOffset(byte);
+    if (offset < 0) {
+      continue;
+    } else if (byte == address) {
+      cdl->markOpCode(offset);
+    } else {
+      cdl->markOperand(offset);
+    }
+  }
+}
+
+void VM::_record(uint16_t address) {
+  ExecutionRecord record = {
+      .pc = address,
+      // decodeInstruction() has already advanced PC past the operand
+      .size = static_cast<uint8_t>(PC.to16() - address),
+      .A = A,
+      .X = X,
+      .Y = Y,
+      .P = S,
+      .SP = SP,
+      .cycle = cycles,
+  };
+  for (int i = 0; i < record.size; i++) {
+    // Already fetched; reading them again must not count, log or trip
+    // watchpoints a second time
+    record.bytes[i] = inspect(address + i);
+  }
+  recorder->record(record);
 }
 
 uint8_t VM::peek(Word address) {
   return peek16(address.low | (address.high << 8));
 }
 
-uint8_t VM::peek8(uint8_t offset) { return ram[offset]; }
+uint8_t VM::peek8(uint8_t offset) { return peek16(offset); }
 
 uint8_t VM::peek16(uint16_t address) {
+  if (watchpoints != nullptr &&
+      watchpoints->watched(WatchSpace::cpu, address)) [[unlikely]] {
+    return _watchedPeek16(address);
+  }
+  return _peek16(address);
+}
+
+void VM::poke16(uint16_t address, uint8_t value) {
+  if (watchpoints != nullptr &&
+      watchpoints->watched(WatchSpace::cpu, address)) [[unlikely]] {
+    _watchedPoke16(address, value);
+    return;
+  }
+  _poke16(address, value);
+}
+
+uint8_t VM::_watchedPeek16(uint16_t address) {
+  uint8_t value = _peek16(address);
+  // Instruction fetches are not data reads
+  if (!_fetching) {
+    watchpoints->check(WatchSpace::cpu, false, address, value, value,
+                       _instructionAddress, cycles);
+  }
+  return value;
+}
+
+void VM::_watchedPoke16(uint16_t address, uint8_t value) {
+  uint8_t oldValue = inspect(address);
+  _poke16(address, value);
+  watchpoints->check(WatchSpace::cpu, true, address, oldValue, value,
+                     _instructionAddress, cycles);
+}
+
+inline void VM::_catchUpPpu() {
+  ppu->cdl = cdl;
+  ppu->catchUp(cycles * 3);
+}
+
+void VM::_syncPpu() {
+  // Once per deadline, i.e. about once a frame. Catch-ups for register
+  // accesses are too frequent to give each its own span.
+  {
+    TimelineSpan span = {"PPU::catchUp"};
+    _catchUpPpu();
+  }
+#if NESPP_METRICS
+  VMMetrics::add(metrics.frames, ppu->frames - _framesCounted);
+  const TileCache &tiles = ppu->tileCache();
+  VMMetrics::add(metrics.tileCacheHits, tiles.hits - _tileHitsCounted);
+  VMMetrics::add(metrics.tileCacheMisses, tiles.misses - _tileMissesCounted);
+#endif
+  _framesCounted = ppu->frames;
+  _tileHitsCounted = ppu->tileCache().hits;
+  _tileMissesCounted = ppu->tileCache().misses;
+  if (ppu->nmiPending) {
+    ppu->acknowledgeNmi();
+    _interrupt(0xFFFA);
+  }
+}
+
+void VM::_oamDma(uint8_t page) {
+  _catchUpPpu();
+  const uint16_t base = page << 8;
+  _trace(TraceEventKind::oamDma, base, 0);
+
+  // Plain memory is copied in one go, unless watchpoints need to see each
+  // read; anything else, e.g. registers, is read a byte at a time
+  const uint8_t *source = nullptr;
+  if (watchpoints == nullptr) {
+    if (base < 0x2000) {
+      source = ram + (base & 0x07FF);
+    } else if (base >= 0x4020) {
+      source = mapper->memoryPage(page);
+    }
+  }
+  if (source != nullptr) {
+#if NESPP_METRICS
+    BusRegion region = base < 0x2000 ? BusRegion::ram : BusRegion::mapper;
+    VMMetrics::add(metrics.reads[static_cast<int>(region)], 256);
+#endif
+    if (cdl != nullptr && base >= 0x4020) {
+      for (int i = 0; i < 256; i++) {
+        int32_t offset = mapper->prgOffset(base + i);
+        if (offset >= 0) {
+          cdl->markData(offset);
+        }
+      }
+    }
+    ppu->writeOam(source);
+  } else {
+    uint8_t buffer[256];
+    for (int i = 0; i < 256; i++) {
+      buffer[i] = peek16(base + i);
+    }
+    ppu->writeOam(buffer);
+  }
+#if NESPP_METRICS
+  VMMetrics::add(metrics.writes[static_cast<int>(BusRegion::ppu)], 256);
+#endif
+
+  // 256 read/write pairs, plus a cycle to halt the CPU, plus one more to
+  // line up with a read cycle if the DMA starts on an odd one
+  cycles += 513 + (cycles & 1);
+}
+
+void VM::_interrupt(uint16_t vector) {
+  _pushWord(PC);
+  // Hardware interrupts push B clear
+  _push((S | 0x20) & ~0x10);
+  S |= _I;
+  PC = {peek16(vector + 1), peek16(vector)};
+  cycles += 7;
+  _trace(TraceEventKind::nmi, PC.to16(), 0);
+}
+
+uint8_t VM::_ppuRead(uint8_t reg) {
+  _catchUpPpu();
+  if (reg == 7 && watchpoints != nullptr) [[unlikely]] {
+    uint16_t address = ppu->v & 0x3FFF;
+    if (watchpoints->watched(WatchSpace::vram, address)) {
+      uint8_t value = ppu->peekVram(address);
+      watchpoints->check(WatchSpace::vram, false, address, value, value,
+                         _instructionAddress, cycles);
+    }
+  }
+  return ppu->read(reg);
+}
+
+void VM::_ppuWrite(uint8_t reg, uint8_t value) {
+  _catchUpPpu();
+  ppuRegisters[reg] = value;
+  if (reg == 7 && watchpoints != nullptr) [[unlikely]] {
+    uint16_t address = ppu->v & 0x3FFF;
+    if (watchpoints->watched(WatchSpace::vram, address)) {
+      uint8_t oldValue = ppu->peekVram(address);
+      ppu->write(reg, value);
+      watchpoints->check(WatchSpace::vram, true, address, oldValue, value,
+                         _instructionAddress, cycles);
+      return;
+    }
+  }
+  ppu->write(reg, value);
+}
+
+uint8_t VM::inspect(uint16_t address) {
+  if (_flatBus != nullptr) {
+    return _flatBus[address];
+  } else if (address < 0x2000) {
+    return ram[address & 0x07FF];
+  } else if (address < 0x4000) {
+    return ppu->inspect(address & 0x07);
+  } else if (address >= 0x4000 && address < 0x4018) {
+    return apuAndIoRegisters[address - 0x4000];
+  } else if (address >= 0x4020) {
+    // Only plain memory: mapper registers and unmapped space read as 0
+    const uint8_t *page = mapper->memoryPage(address >> 8);
+    if (page != nullptr) {
+      return page[address & 0xFF];
+    }
+  }
+  return 0;
+}
+
+uint8_t VM::_peek16(uint16_t address) {
+  if (_flatBus != nullptr) {
+    busLog.push_back({address, _flatBus[address], false});
+    return _flatBus[address];
+  }
   // first 2KiB
   if (address < 0x0800) {
     // printf("DEBUG RAM address: 0x%04X = 0x%02X\n", idx, ram[idx]);
+    _countBus(BusRegion::ram, false);
     return ram[address];
   } else if (address < 0x1000) {
     uint16_t normalizedIdx = address - 0x800;
     // printf("DEBUG 1st RAM mirror address: 0x%02X -> 0x%02X\n", address,
     //        normalizedIdx);
+    _countBus(BusRegion::ram, false);
     return ram[normalizedIdx];
   } else if (address < 0x1800) {
     uint16_t normalizedIdx = address - 0x1000;
     // printf("DEBUG 2nd RAM mirror address: 0x%02X -> 0x%02X\n", address,
     //        normalizedIdx);
+    _countBus(BusRegion::ram, false);
     return ram[normalizedIdx];
   } else if (address < 0x2000) {
     uint16_t normalizedIdx = address - 0x1800;
     // printf("DEBUG 3nd RAM mirror address: 0x%02X -> 0x%02X\n", address,
     //        normalizedIdx);
+    _countBus(BusRegion::ram, false);
     return ram[normalizedIdx];
-  } else if (address < 0x2008) {
-    uint8_t offset = address - 0x2000;
-    debug(std::format("DEBUG PPU register: {} = 0x{:02X}", offset,
-                      ppuRegisters[offset]));
-    return ppuRegisters[offset];
   } else if (address < 0x4000) {
-    throw "TODO implement PPU register repeats";
+    // Mirrored every 8 bytes
+    uint8_t reg = address & 0x07;
+    _countBus(BusRegion::ppu, false);
+    uint8_t value = _ppuRead(reg);
+    _trace(TraceEventKind::ppuRead, 0x2000 + reg, value);
+    return value;
   } else if (address < 0x4018) {
     uint8_t offset = address - 0x4000;
-    debug(std::format("DEBUG APU or I/O register: {} = 0x{:02X}", address,
-                      apuAndIoRegisters[offset]));
+    _countBus(BusRegion::apuIo, false);
+    _trace(TraceEventKind::apuRead, address, apuAndIoRegisters[offset]);
     return apuAndIoRegisters[offset];
   } else if (address < 0x4020) {
     throw "TODO: implement APU & I/O functionality that is normally disabled";
   } else if (address <= 0xFFFF) {
     // mapper
+    _countBus(BusRegion::mapper, false);
+    if (cdl != nullptr && !_fetching) {
+      int32_t offset = mapper->prgOffset(address);
+      if (offset >= 0) {
+        cdl->markData(offset);
+      }
+    }
     return mapper->peek16(address);
   }
   throw "Unreachable";
@@ -142,33 +511,53 @@ void VM::poke(Word address, uint8_t value) {
   poke16(address.low | (address.high << 8), value);
 }
 
-void VM::poke16(uint16_t address, uint8_t value) {
+void VM::_poke16(uint16_t address, uint8_t value) {
+  if (_flatBus != nullptr) {
+    busLog.push_back({address, value, true});
+    _flatBus[address] = value;
+    return;
+  }
   // first 2KiB
   if (address < 0x0800) {
     // printf("DEBUG RAM address: 0x%04X = 0x%02X\n", idx, ram[idx]);
+    _countBus(BusRegion::ram, true);
     ram[address] = value;
   } else if (address < 0x1000) {
     uint16_t normalizedIdx = address - 0x800;
+    _countBus(BusRegion::ram, true);
     ram[normalizedIdx] = value;
   } else if (address < 0x1800) {
     uint16_t normalizedIdx = address - 0x1000;
+    _countBus(BusRegion::ram, true);
     ram[normalizedIdx] = value;
   } else if (address < 0x2000) {
     uint16_t normalizedIdx = address - 0x1800;
+    _countBus(BusRegion::ram, true);
     ram[normalizedIdx] = value;
-  } else if (address < 0x2008) {
-    uint8_t offset = address - 0x2000;
-    ppuRegisters[offset] = value;
   } else if (address < 0x4000) {
-    throw "TODO implement PPU register repeats";
+    // Mirrored every 8 bytes
+    _countBus(BusRegion::ppu, true);
+    _ppuWrite(address & 0x07, value);
   } else if (address < 0x4018) {
     uint8_t offset = address - 0x4000;
+    _countBus(BusRegion::apuIo, true);
     apuAndIoRegisters[offset] = value;
+    if (offset == 0x14 && ppu != nullptr) {
+      _oamDma(value);
+    }
   } else if (address < 0x4020) {
     throw "TODO: implement APU & I/O functionality that is normally disabled";
   } else if (address <= 0xFFFF) {
     // mapper
-    mapper->poke16(address, value);
+    _countBus(BusRegion::mapper, true);
+    if (ppu != nullptr && mapper->remapsVram()) [[unlikely]] {
+      // Lines already due render with the old banks
+      _catchUpPpu();
+      mapper->poke16(address, value);
+      ppu->remap();
+    } else {
+      mapper->poke16(address, value);
+    }
   } else {
     throw std::runtime_error(std::format("Invalid address 0x{:4X}", address));
   }
@@ -176,7 +565,10 @@ void VM::poke16(uint16_t address, uint8_t value) {
 
 Instruction VM::decodeInstruction() {
   Instruction instruction;
+  _instructionAddress = PC.to16();
+  _fetching = true;
   uint8_t _rawCode = peek(PC); // for debugging
+  _instructionOpCode = _rawCode;
   OpCode code = opCodeLookup[_rawCode];
   switch (code.addressing) {
   case AddressingMode::absolute:
@@ -234,10 +626,12 @@ Instruction VM::decodeInstruction() {
     PC += 2;
     break;
   default:
+    _fetching = false;
     throw std::runtime_error(std::format(
         "Unimplemented instruction 0x{:02X} at 0x{:04X}", _rawCode, PC.to16()));
   }
 
+  _fetching = false;
   return instruction;
 }
 
@@ -262,6 +656,36 @@ inline void VM::_setC(bool didCarry) {
 
 inline bool VM::_getC() { return ((S & _C) > 0); }
 
+inline void VM::_branch(Instruction instruction) {
+  Word target = _operandToAddress(instruction);
+  // Taken branches cost an extra cycle, and another when crossing a page
+  cycles += (target.high == PC.high) ? 1 : 2;
+  PC = target;
+  _trace(TraceEventKind::jump, PC.to16(), 0);
+}
+
+inline void VM::_countBus([[maybe_unused]] BusRegion region,
+                          [[maybe_unused]] bool write) {
+#if NESPP_METRICS
+  VMMetrics::add(write ? metrics.writes[static_cast<int>(region)]
+                       : metrics.reads[static_cast<int>(region)]);
+#endif
+}
+
+inline void VM::_trace([[maybe_unused]] TraceEventKind kind,
+                       [[maybe_unused]] uint16_t address,
+                       [[maybe_unused]] uint8_t value) {
+#if NESPP_TRACE
+  trace.push({
+      .cycle = cycles,
+      .pc = _instructionAddress,
+      .address = address,
+      .value = value,
+      .kind = kind,
+  });
+#endif
+}
+
 void VM::_push(uint8_t v) {
   poke16(0x0100 + SP, v);
   // I *think* this behaves identically to 6502 wrapping since SP is unsigned
@@ -288,6 +712,7 @@ Word VM::_popWord() {
 
 void VM::execute(Instruction instruction) {
   Word address;
+  cycles += instruction.opCode.cycles;
   switch (instruction.opCode.type) {
     using enum OpCodeType;
     uint8_t value;
@@ -308,33 +733,28 @@ void VM::execute(Instruction instruction) {
     return;
   case BCC:
     if (!_getC()) {
-      PC = _operandToAddress(instruction);
-      debug(std::format("Jumping to ${:04X}", PC.to16()));
+      _branch(instruction);
     }
     return;
   case BCS:
     if (_getC()) {
-      PC = _operandToAddress(instruction);
-      debug(std::format("Jumping to ${:04X}", PC.to16()));
+      _branch(instruction);
     }
     return;
   case BEQ:
     if (_getZ()) {
-      PC = _operandToAddress(instruction);
-      debug(std::format("Jumping to ${:04X}", PC.to16()));
+      _branch(instruction);
     }
     return;
   case BNE:
     if (!_getZ()) {
-      PC = _operandToAddress(instruction);
-      debug(std::format("Jumping to ${:04X}", PC.to16()));
+      _branch(instruction);
     }
     return;
   case BPL:
     // if not negative...
     if ((S & _N) == 0) {
-      PC = _operandToAddress(instruction);
-      debug(std::format("Jumping to ${:04X}", PC.to16()));
+      _branch(instruction);
     }
     return;
   case CLD:
@@ -414,13 +834,13 @@ void VM::execute(Instruction instruction) {
     return;
   case JMP:
     PC = _operandToAddress(instruction);
-    debug(std::format("Jumping to ${:04X}", PC.to16()));
+    _trace(TraceEventKind::jump, PC.to16(), 0);
     return;
   case JSR:
     // https://retrocomputing.stackexchange.com/questions/19543/why-does-the-6502-jsr-instruction-only-increment-the-return-address-by-2-bytes
     _pushWord(PC - 1);
     PC = _operandToAddress(instruction);
-    debug(std::format("Jumping to ${:04X}", PC.to16()));
+    _trace(TraceEventKind::jump, PC.to16(), 0);
     return;
   case LDA:
     // TODO: handle carry with ABS,X?
@@ -461,6 +881,11 @@ void VM::execute(Instruction instruction) {
   case PHA:
     _push(A);
     return;
+  case RTI:
+    // B and bit 5 only exist on the stack
+    S = (_pop() & ~0x10) | 0x20;
+    PC = _popWord();
+    return;
   case RTS:
     // See JSR
     PC = _popWord() + 1;
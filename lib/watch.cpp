@@ -0,0 +1,172 @@
+#include "../include/watch.h"
+#include <algorithm> // std::remove_if
+#include <cstdio>    // for sscanf
+#include <cstring>   // for strncmp, strchr
+#include <format>
+#include <stdexcept> // std::runtime_error
+
+namespace NESPP {
+
+std::string Watchpoint::toString() const {
+  std::string kindText;
+  if (kinds & WatchKind::read) {
+    kindText.push_back('r');
+  }
+  if (kinds & WatchKind::write) {
+    kindText.push_back('w');
+  }
+  if (kinds & WatchKind::change) {
+    kindText.push_back('c');
+  }
+  return std::format("#{} {}{:04X}-{:04X}:{} ({})", id,
+                     space == WatchSpace::vram ? "vram:" : "", first, last,
+                     kindText, action == WatchAction::halt ? "halt" : "log");
+}
+
+Watchpoint parseWatchpoint(const char *spec, WatchAction action) {
+  Watchpoint watchpoint = {.action = action};
+  const char *text = spec;
+  if (strncmp(text, "vram:", 5) == 0) {
+    watchpoint.space = WatchSpace::vram;
+    text += 5;
+  }
+
+  unsigned int first = 0;
+  unsigned int last = 0;
+  int consumed = 0;
+  if (sscanf(text, "%x%n", &first, &consumed) != 1) {
+    throw std::runtime_error(std::format("Bad watchpoint \"{}\"", spec));
+  }
+  text += consumed;
+  last = first;
+  if (*text == '-') {
+    if (sscanf(text + 1, "%x%n", &last, &consumed) != 1) {
+      throw std::runtime_error(std::format("Bad watchpoint \"{}\"", spec));
+    }
+    text += 1 + consumed;
+  }
+  unsigned int limit = watchpoint.space == WatchSpace::vram ? 0x3FFF : 0xFFFF;
+  if (first > last || last > limit) {
+    throw std::runtime_error(
+        std::format("Bad watchpoint range in \"{}\"", spec));
+  }
+  watchpoint.first = first;
+  watchpoint.last = last;
+
+  if (*text == ':') {
+    watchpoint.kinds = 0;
+    for (text += 1; *text != '\0'; text++) {
+      switch (*text) {
+      case 'r':
+        watchpoint.kinds |= WatchKind::read;
+        break;
+      case 'w':
+        watchpoint.kinds |= WatchKind::write;
+        break;
+      case 'c':
+        watchpoint.kinds |= WatchKind::change;
+        break;
+      default:
+        throw std::runtime_error(
+            std::format("Bad watchpoint kind '{}' in \"{}\"", *text, spec));
+      }
+    }
+  } else if (*text != '\0') {
+    throw std::runtime_error(std::format("Bad watchpoint \"{}\"", spec));
+  }
+  if (watchpoint.kinds == 0) {
+    throw std::runtime_error(
+        std::format("Watchpoint \"{}\" watches nothing", spec));
+  }
+  return watchpoint;
+}
+
+size_t WatchHit::format(char *buffer, size_t size) const {
+  if (size == 0) {
+    return 0;
+  }
+  const char *prefix = space == WatchSpace::vram ? "VRAM " : "";
+  std::format_to_n_result<char *> result;
+  if (write) {
+    result = std::format_to_n(buffer, size - 1,
+                              "{:04X}: #{} {}{:04X} {:02X} -> {:02X}", pc, id,
+                              prefix, address, oldValue, value);
+  } else {
+    result = std::format_to_n(buffer, size - 1, "{:04X}: #{} {}{:04X} = {:02X}",
+                              pc, id, prefix, address, value);
+  }
+  *result.out = '\0';
+  return result.out - buffer;
+}
+
+std::string WatchHit::toString() const {
+  char buffer[64];
+  return std::string(buffer, format(buffer, sizeof(buffer)));
+}
+
+uint32_t WatchpointSet::add(Watchpoint watchpoint) {
+  watchpoint.id = nextId++;
+  watchpoints.push_back(watchpoint);
+  _rebuildPages();
+  return watchpoint.id;
+}
+
+bool WatchpointSet::remove(uint32_t id) {
+  auto end = std::remove_if(
+      watchpoints.begin(), watchpoints.end(),
+      [id](const Watchpoint &watchpoint) { return watchpoint.id == id; });
+  if (end == watchpoints.end()) {
+    return false;
+  }
+  watchpoints.erase(end, watchpoints.end());
+  _rebuildPages();
+  return true;
+}
+
+void WatchpointSet::_rebuildPages() {
+  pages[0].reset();
+  pages[1].reset();
+  for (const Watchpoint &watchpoint : watchpoints) {
+    for (int page = watchpoint.first >> 8; page <= watchpoint.last >> 8;
+         page++) {
+      pages[static_cast<int>(watchpoint.space)].set(page);
+    }
+  }
+}
+
+void WatchpointSet::check(WatchSpace space, bool write, uint16_t address,
+                          uint8_t oldValue, uint8_t value, uint16_t pc,
+                          uint64_t cycle) {
+  for (const Watchpoint &watchpoint : watchpoints) {
+    if (watchpoint.space != space || address < watchpoint.first ||
+        address > watchpoint.last) {
+      continue;
+    }
+    bool fired = write ? (watchpoint.kinds & WatchKind::write) ||
+                             ((watchpoint.kinds & WatchKind::change) &&
+                              oldValue != value)
+                       : (watchpoint.kinds & WatchKind::read);
+    if (!fired) {
+      continue;
+    }
+    WatchHit hit = {.id = watchpoint.id,
+                    .pc = pc,
+                    .address = address,
+                    .oldValue = oldValue,
+                    .value = value,
+                    .write = write,
+                    .space = space,
+                    .cycle = cycle};
+    if (watchpoint.action == WatchAction::halt) {
+      if (!halted) {
+        halted = hit;
+      }
+    } else if (hits.size() < HIT_LIMIT) {
+      hits.push_back(hit);
+    } else {
+      droppedHits += 1;
+    }
+  }
+}
+
+} // namespace NESPP